@@ -0,0 +1,239 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Admission control on the accept path
+*/
+
+#include "admission.h"
+#include "game.h"
+#include "metrics.h"
+#include "protocol.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+AdmissionControl admission;
+
+static const char *busyMsg = "Server busy, try again later\n";
+
+// how often an acceptor on a non-blocking listener checks for a stop
+static const int STOP_POLL_MS = 100;
+
+AdmissionControl::AdmissionControl()
+    : maxSessions(0), busyReply(false), tracking(false), active(0),
+      stopping(false), accepting(0), spareFd(-1)
+{
+    pthread_mutex_init(&spareLock, NULL);
+}
+
+bool AdmissionControl::start(long maxSessions, bool busyReply)
+{
+    this->maxSessions = maxSessions;
+    this->busyReply = busyReply;
+
+    spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (spareFd < 0)
+    {
+        cerr << "Error opening spare file descriptor" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// out of descriptors: free the spare one just long enough to accept the
+// pending client and close it, true if one was closed
+bool AdmissionControl::shedClient(int listenSock)
+{
+    bool shed = false;
+
+    pthread_mutex_lock(&spareLock);
+    if (spareFd >= 0)
+    {
+        close(spareFd);
+
+        int clientSock = accept4(listenSock, NULL, NULL,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSock >= 0)
+        {
+            close(clientSock);
+            metrics.count(CONNECTIONS_SHED);
+            shed = true;
+        }
+
+        spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    pthread_mutex_unlock(&spareLock);
+
+    return shed;
+}
+
+bool AdmissionControl::restoreSpare()
+{
+    pthread_mutex_lock(&spareLock);
+    if (spareFd < 0)
+    {
+        spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    bool spare = spareFd >= 0;
+    pthread_mutex_unlock(&spareLock);
+
+    return spare;
+}
+
+// a listener shared with another server process is non-blocking, so
+// the wait for a client can be given up when stopping
+int AdmissionControl::acceptBlocking(int listenSock)
+{
+    useconds_t backoff = MIN_BACKOFF_US;
+
+    while (!stopping.load())
+    {
+        int clientSock = accept(listenSock, NULL, NULL);
+        if (clientSock >= 0)
+        {
+            metrics.count(CONNECTIONS_ACCEPTED);
+            return clientSock;
+        }
+
+        int error = errno;
+        if (error == EINTR || error == ECONNABORTED)
+        {
+            continue;
+        }
+        if (error == EAGAIN || error == EWOULDBLOCK)
+        {
+            struct pollfd pfd;
+            pfd.fd = listenSock;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, STOP_POLL_MS);
+            continue;
+        }
+        printError("accept", string("client connection: ") + strerror(error));
+
+        if (error == EMFILE || error == ENFILE)
+        {
+            shedClient(listenSock);
+        }
+
+        // give sessions time to finish instead of spinning on the error
+        usleep(backoff);
+        backoff = min(backoff * 2, MAX_BACKOFF_US);
+        restoreSpare();
+    }
+
+    return -1;
+}
+
+int AdmissionControl::acceptSession(int listenSock)
+{
+    accepting.fetch_add(1);
+
+    int clientSock = -1;
+    while (clientSock < 0 && !stopping.load())
+    {
+        clientSock = acceptBlocking(listenSock);
+        if (clientSock >= 0 && !admit(clientSock))
+        {
+            clientSock = -1;
+        }
+    }
+
+    accepting.fetch_sub(1);
+    return clientSock;
+}
+
+void AdmissionControl::stopAccepting()
+{
+    stopping.store(true);
+    while (accepting.load() > 0)
+    {
+        usleep(1000);
+    }
+}
+
+int AdmissionControl::acceptReady(int listenSock, int flags, bool &failed)
+{
+    failed = false;
+    while (true)
+    {
+        int clientSock = accept4(listenSock, NULL, NULL, flags);
+        if (clientSock >= 0)
+        {
+            metrics.count(CONNECTIONS_ACCEPTED);
+            return clientSock;
+        }
+
+        int error = errno;
+        if (error == EINTR || error == ECONNABORTED)
+        {
+            continue;
+        }
+        if (error == EAGAIN || error == EWOULDBLOCK)
+        {
+            return -1;
+        }
+        printError("accept", string("client connection: ") + strerror(error));
+
+        // the pending client is gone, see if more are waiting
+        if ((error == EMFILE || error == ENFILE) && shedClient(listenSock))
+        {
+            continue;
+        }
+        failed = true;
+        return -1;
+    }
+}
+
+bool AdmissionControl::admit(int clientSock)
+{
+    // no shared counter to touch without a limit or a handoff
+    if (maxSessions == 0 && !tracking)
+    {
+        return true;
+    }
+
+    long before = active.fetch_add(1, memory_order_relaxed);
+    if (maxSessions == 0 || before < maxSessions)
+    {
+        return true;
+    }
+    active.fetch_sub(1, memory_order_relaxed);
+    metrics.count(CONNECTIONS_REJECTED);
+
+    // the reply fits in any empty socket buffer, never wait for it
+    if (busyReply)
+    {
+        string reply;
+        putV1Message(reply, busyMsg);
+        send(clientSock, reply.data(), reply.size(),
+             MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    close(clientSock);
+
+    return false;
+}
+
+void AdmissionControl::release()
+{
+    if (maxSessions != 0 || tracking)
+    {
+        active.fetch_sub(1, memory_order_relaxed);
+    }
+}
+
+void AdmissionControl::adopt()
+{
+    if (maxSessions != 0 || tracking)
+    {
+        active.fetch_add(1, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,97 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Admission control on the accept path
+*/
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+
+// pauses after accept() fails for another reason than no client waiting
+const useconds_t MIN_BACKOFF_US = 1000;
+const useconds_t MAX_BACKOFF_US = 200 * 1000;
+
+/* Decides which accepted connections get a session.
+
+   At most maxSessions sessions run at once, so the players already
+   admitted keep their latency while an accept storm is turned away
+   early. A turned away client gets a one message v1 reply saying the
+   server is busy when busyReply is set, otherwise it is just closed.
+
+   Running out of file descriptors does not stop the server. A spare
+   descriptor is kept open, and when accept() fails with EMFILE or
+   ENFILE it is closed for a moment to accept and close the pending
+   connection, so the client is told at once instead of the listen
+   queue filling up.
+
+   Before a handoff to a new server process, stopAccepting() makes the
+   blocking acceptors return, and with trackSessions() activeSessions()
+   tells when the last session has ended. */
+class AdmissionControl
+{
+public:
+    AdmissionControl();
+
+    // open the spare descriptor, false on failure; maxSessions 0 means
+    // no limit
+    bool start(long maxSessions, bool busyReply);
+
+    // accept a client and admit it, blocking until one may start a
+    // session; -1 once stopAccepting() was called. Errors are reported
+    // and retried with growing pauses instead of returning
+    int acceptSession(int listenSock);
+
+    // make every acceptSession() return -1 and wait for the threads in
+    // it, so each client they took is counted by then
+    void stopAccepting();
+
+    // accept a client from a non-blocking socket, -1 once none is
+    // pending or on an error, which sets failed so the caller stops
+    // listening for a pause instead of being woken again at once
+    int acceptReady(int listenSock, int flags, bool &failed);
+
+    // true if the client may start a session, otherwise it has been
+    // answered and closed
+    bool admit(int clientSock);
+
+    // an admitted session ended
+    void release();
+
+    // count sessions even without a limit, before the first admit()
+    void trackSessions() { tracking = true; }
+
+    // count a session handed over by the previous server, never refused
+    void adopt();
+
+    // admitted sessions not yet released, kept with a limit or tracking
+    long activeSessions() const { return active.load(); }
+
+    // after EMFILE or ENFILE, accept and close the pending client with
+    // the spare descriptor, true if one was closed
+    bool shedClient(int listenSock);
+
+    // reopen the spare descriptor if a shed could not, true if it is open
+    bool restoreSpare();
+
+private:
+    // accept a client, -1 once stopping
+    int acceptBlocking(int listenSock);
+
+    long maxSessions; // 0 for no limit
+    bool busyReply;
+    bool tracking;
+    std::atomic<long> active;
+    std::atomic<bool> stopping;
+    std::atomic<long> accepting; // threads inside acceptSession()
+
+    pthread_mutex_t spareLock;
+    int spareFd; // -1 while lent out
+};
+
+extern AdmissionControl admission;
+
+#endif
@@ -0,0 +1,153 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Blocking protocol reads and writes
+*/
+
+#ifndef BLOCKING_IO_H
+#define BLOCKING_IO_H
+
+#include "protocol.h"
+#include "frame_reader.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/* One copy of the blocking socket helpers, for the programs that read a
+   single connection in order. Everything received goes through the
+   caller's FrameReader and is parsed in place, so views returned here
+   stay valid until the next receive on that reader.
+
+   A Stream is a socket descriptor or anything else with readStream()
+   and writeStream() overloads, such as the ShmChannel of shm_ring.h. */
+
+struct Message // received v1 message
+{
+    const char *data; // view into the reader, NULL on error
+    size_t length;
+};
+
+// send to a socket, a peer that hung up is an error rather than SIGPIPE
+inline ssize_t writeStream(int sock, const char *data, size_t length)
+{
+    return send(sock, data, length, MSG_NOSIGNAL);
+}
+
+// receive a v1 int, LONG_MIN on error
+template <typename Stream>
+inline long receiveInt(FrameReader &reader, Stream &stream)
+{
+    if (!reader.fillTo(stream, V1_INT_SIZE))
+    {
+        return LONG_MIN;
+    }
+
+    // convert to host order before returning it
+    long hostInt = getV1Int(reader.data());
+    reader.consume(V1_INT_SIZE);
+
+    return hostInt;
+}
+
+// receive a v1 message of length bytes, lengths over the frame limit
+// are never buffered
+template <typename Stream>
+inline Message receiveMessage(FrameReader &reader, Stream &stream,
+                              long length)
+{
+    Message result;
+    result.data = NULL;
+    result.length = 0;
+
+    if (length < 0 || !reader.fillTo(stream, length))
+    {
+        return result;
+    }
+
+    result.data = reader.data();
+    result.length = length;
+    reader.consume(length);
+
+    return result;
+}
+
+// receive a v1 distance, -1 on error
+template <typename Stream>
+inline double receiveDistance(FrameReader &reader, Stream &stream)
+{
+    if (!reader.fillTo(stream, sizeof(double)))
+    {
+        return -1;
+    }
+
+    double hostDouble;
+    memcpy(&hostDouble, reader.data(), sizeof(double));
+    reader.consume(sizeof(double));
+
+    return hostDouble;
+}
+
+// receive one v2 frame, false on error or end of stream
+template <typename Stream>
+inline bool receiveFrame(FrameReader &reader, Stream &stream,
+                         FrameHeader &header, std::string_view &payload)
+{
+    if (!reader.fillTo(stream, FRAME_HEADER_SIZE))
+    {
+        return false;
+    }
+    header = parseHeader(reader.data());
+
+    if (!reader.fillTo(stream, FRAME_HEADER_SIZE + header.length))
+    {
+        return false;
+    }
+    payload = std::string_view(reader.data() + FRAME_HEADER_SIZE,
+                               header.length);
+    reader.consume(FRAME_HEADER_SIZE + header.length);
+
+    return true;
+}
+
+// send a whole buffer, false on error
+template <typename Stream>
+inline bool sendAll(Stream &stream, const std::string &buffer)
+{
+    size_t bytesLeft = buffer.size();
+    const char *bp = buffer.data();
+
+    while (bytesLeft)
+    {
+        ssize_t bytesSent = writeStream(stream, bp, bytesLeft);
+        if (bytesSent <= 0)
+        {
+            return false;
+        }
+        bytesLeft -= bytesSent;
+        bp += bytesSent;
+    }
+
+    return true;
+}
+
+// send a v1 int
+template <typename Stream>
+inline bool sendInt(Stream &stream, long hostInt)
+{
+    std::string out;
+    putV1Int(out, hostInt);
+    return sendAll(stream, out);
+}
+
+// send the bytes of a v1 message, its length goes first with sendInt()
+template <typename Stream>
+inline bool sendMessage(Stream &stream, const std::string &message)
+{
+    return sendAll(stream, message);
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Distance engine
+*/
+
+#include "distance.h"
+#include "game.h"
+
+#include <cmath>
+#include <cstdint>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+// entries for every pair 0 <= small <= large <= GRID_SPAN
+const size_t TABLE_SIZE = (GRID_SPAN + 1) * (GRID_SPAN + 2) / 2;
+
+size_t tableIndex(long small, long large)
+{
+    return large * (large + 1) / 2 + small;
+}
+
+// distances for every offset on the grid, filled in by the compiler;
+// the squares are exact so the square root is the one calcDist takes
+struct DistanceTable
+{
+    double distances[TABLE_SIZE];
+
+    constexpr DistanceTable() : distances()
+    {
+        size_t i = 0;
+        for (long large = 0; large <= GRID_SPAN; large++)
+        {
+            for (long small = 0; small <= large; small++)
+            {
+                distances[i++] =
+                    __builtin_sqrt((double)(small * small + large * large));
+            }
+        }
+    }
+};
+
+constexpr DistanceTable table;
+
+// the original formula, for offsets the fast paths do not cover
+double referenceDist(long dx, long dy)
+{
+    return sqrt(pow(dx, 2) + pow(dy, 2));
+}
+
+bool onGrid(long offset)
+{
+    return -GRID_SPAN <= offset && offset <= GRID_SPAN;
+}
+
+// the vector paths convert the treasure to a double
+bool exactTreasure(long coord)
+{
+    return -(1L << 52) <= coord && coord <= (1L << 52);
+}
+
+double tableDist(long dx, long dy)
+{
+    dx = dx < 0 ? -dx : dx;
+    dy = dy < 0 ? -dy : dy;
+    return dx < dy ? table.distances[tableIndex(dx, dy)]
+                   : table.distances[tableIndex(dy, dx)];
+}
+
+void scalarBatch(long randomX, long randomY, const GuessFrame *guesses,
+                 size_t count, double *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = calcDist(randomX, randomY, guesses[i].x, guesses[i].y);
+    }
+}
+
+#ifdef __x86_64__
+// GuessFrame pairs are loaded straight into vector registers
+static_assert(sizeof(GuessFrame) == 2 * sizeof(int32_t),
+              "GuessFrame must be two packed int32_t");
+
+// two guesses at a time, SSE2 is always there on x86-64; the treasure
+// and the int32_t guesses are exact in a double and so is their
+// difference, lanes past EXACT_SPAN go through the formula
+size_t sseBatch(long randomX, long randomY, const GuessFrame *guesses,
+                size_t count, double *out)
+{
+    const __m128d treasureX = _mm_set1_pd(randomX);
+    const __m128d treasureY = _mm_set1_pd(randomY);
+    const __m128d limit = _mm_set1_pd(EXACT_SPAN);
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        // x0 y0 x1 y1 -> x0 x1 y0 y1
+        __m128i pair = _mm_loadu_si128((const __m128i *)(guesses + i));
+        pair = _mm_shuffle_epi32(pair, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128d x = _mm_sub_pd(treasureX, _mm_cvtepi32_pd(pair));
+        __m128d y = _mm_sub_pd(treasureY,
+                               _mm_cvtepi32_pd(_mm_srli_si128(pair, 8)));
+
+        __m128d exact =
+            _mm_and_pd(_mm_cmple_pd(_mm_andnot_pd(sign, x), limit),
+                       _mm_cmple_pd(_mm_andnot_pd(sign, y), limit));
+        if (_mm_movemask_pd(exact) != 0x3)
+        {
+            scalarBatch(randomX, randomY, guesses + i, 2, out + i);
+            continue;
+        }
+        __m128d sum = _mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y));
+        _mm_storeu_pd(out + i, _mm_sqrt_pd(sum));
+    }
+    return i;
+}
+
+// four guesses at a time where the CPU has AVX2
+__attribute__((target("avx2")))
+size_t avxBatch(long randomX, long randomY, const GuessFrame *guesses,
+                size_t count, double *out)
+{
+    const __m256d treasureX = _mm256_set1_pd(randomX);
+    const __m256d treasureY = _mm256_set1_pd(randomY);
+    const __m256d limit = _mm256_set1_pd(EXACT_SPAN);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // x0 y0 .. x3 y3 -> x0 .. x3 y0 .. y3
+        __m256i pairs = _mm256_loadu_si256((const __m256i *)(guesses + i));
+        pairs = _mm256_permutevar8x32_epi32(pairs, split);
+        __m256d x = _mm256_sub_pd(
+            treasureX, _mm256_cvtepi32_pd(_mm256_castsi256_si128(pairs)));
+        __m256d y = _mm256_sub_pd(
+            treasureY, _mm256_cvtepi32_pd(_mm256_extracti128_si256(pairs, 1)));
+
+        __m256d exact = _mm256_and_pd(
+            _mm256_cmp_pd(_mm256_andnot_pd(sign, x), limit, _CMP_LE_OQ),
+            _mm256_cmp_pd(_mm256_andnot_pd(sign, y), limit, _CMP_LE_OQ));
+        if (_mm256_movemask_pd(exact) != 0xF)
+        {
+            scalarBatch(randomX, randomY, guesses + i, 4, out + i);
+            continue;
+        }
+        __m256d sum = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+        _mm256_storeu_pd(out + i, _mm256_sqrt_pd(sum));
+    }
+    return i;
+}
+
+bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+} // namespace
+
+// calculate distance between treasure location and user guess
+double calcDist(long randomX, long randomY, long userX, long userY)
+{
+    long dx = randomX - userX;
+    long dy = randomY - userY;
+    if (onGrid(dx) && onGrid(dy))
+    {
+        return tableDist(dx, dy);
+    }
+    return referenceDist(dx, dy);
+}
+
+// distance from the treasure to every guess, out[i] for guesses[i]
+void calcDistBatch(long randomX, long randomY, const GuessFrame *guesses,
+                   size_t count, double *out)
+{
+    size_t done = 0;
+#ifdef __x86_64__
+    // treasures this far out are not exact in a double
+    if (exactTreasure(randomX) && exactTreasure(randomY))
+    {
+        if (hasAvx2())
+        {
+            done = avxBatch(randomX, randomY, guesses, count, out);
+        }
+        done += sseBatch(randomX, randomY, guesses + done, count - done,
+                         out + done);
+    }
+#endif
+    scalarBatch(randomX, randomY, guesses + done, count - done, out + done);
+}
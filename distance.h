@@ -0,0 +1,33 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Distance engine
+*/
+
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include "protocol.h"
+
+#include <cstddef>
+
+/* Fast paths for calcDist() that return the exact same bits.
+
+   Treasures and guesses stay on the -100..100 grid, so a single distance
+   is a lookup in a table built at compile time over every |dx|,|dy| up
+   to GRID_SPAN. Batches go through SSE2/AVX2 square roots, which match
+   the reference formula as long as the squared offsets are exact in a
+   double (offsets up to EXACT_SPAN); anything larger falls back to the
+   reference formula one guess at a time. */
+
+// largest offset between two points of the grid
+const long GRID_SPAN = 200;
+
+// largest offset whose squared distance a double holds exactly
+const long EXACT_SPAN = 1L << 26;
+
+// distance from the treasure to every guess, out[i] for guesses[i]
+void calcDistBatch(long randomX, long randomY, const GuessFrame *guesses,
+                   size_t count, double *out);
+
+#endif
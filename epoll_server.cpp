@@ -0,0 +1,634 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Edge-triggered epoll server mode
+*/
+
+#include "epoll_server.h"
+#include "session.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "admission.h"
+#include "handoff.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <cerrno>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// pieces of output gathered into one sendmsg()
+const size_t SEND_IOVS = 16;
+
+// one accepted client owned by a loop
+struct Connection
+{
+    int sock;
+    size_t slot; // index in its loop's connections
+    Session session;
+    TimerNode timer; // fires when the session deadline passes
+};
+
+// what one event loop thread owns
+struct Loop
+{
+    int epfd;
+    TimerWheel wheel; // session deadlines of the connections
+    std::vector<Connection *> conns;
+    bool draining; // sessions go to the next server process
+    uint64_t acceptResume; // when to watch the listener again, 0 if it is
+    useconds_t acceptBackoff; // pause after the next accept() failure
+
+    Loop()
+        : epfd(-1), wheel(tickOf(monotonicMs())), draining(false),
+          acceptResume(0), acceptBackoff(MIN_BACKOFF_US)
+    {
+    }
+};
+
+// arguments for loop thread function
+struct LoopArgs
+{
+    int listenSock;
+};
+
+// epoll_event.data.ptr of the listening socket and the eventfds
+static char listenTag;
+static char inboxTag;
+static char drainTag;
+
+// sessions handed over by the previous server, for any loop to take
+static pthread_mutex_t inboxLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<pair<int, string> > inbox;
+static int inboxFd = -1; // readable while the inbox has sessions
+
+// readable once the loops are to hand their sessions over
+static int drainFd = -1;
+static atomic<int> loopsRunning(0);
+static atomic<int> loopsDrained(0);
+
+// own the connection from now on
+static void addConnection(Loop &loop, Connection *conn)
+{
+    conn->slot = loop.conns.size();
+    loop.conns.push_back(conn);
+}
+
+// close the connection and forget about it
+static void closeConnection(Loop &loop, Connection *conn)
+{
+    loop.wheel.cancel(&conn->timer);
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+    close(conn->sock);
+
+    Connection *moved = loop.conns.back();
+    moved->slot = conn->slot;
+    loop.conns[conn->slot] = moved;
+    loop.conns.pop_back();
+
+    delete conn;
+    admission.release();
+}
+
+// send as much pending output as the socket takes, false on error
+static bool flushConnection(Connection *conn)
+{
+    Session &session = conn->session;
+
+    while (session.pendingLength() > 0)
+    {
+        // own replies and room frames go out in one call
+        struct iovec iov[SEND_IOVS];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = session.pendingIov(iov, SEND_IOVS);
+
+        ssize_t bytesSent = sendmsg(conn->sock, &msg, MSG_NOSIGNAL);
+        if (bytesSent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // EPOLLOUT will tell us when there is room again
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printError("send", session.sending());
+            return false;
+        }
+        session.consumed(bytesSent);
+    }
+
+    return true;
+}
+
+// read everything the client sent so far, false on error or hangup
+static bool readConnection(Connection *conn)
+{
+    Session &session = conn->session;
+
+    while (true)
+    {
+        // read straight into the session's input buffer
+        size_t room;
+        char *space = session.inputSpace(room);
+        if (room == 0)
+        {
+            printError("receive", session.receiving());
+            return false;
+        }
+
+        ssize_t bytesRecv = recv(conn->sock, space, room, 0);
+        if (bytesRecv < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printError("receive", session.receiving());
+            return false;
+        }
+        if (bytesRecv == 0)
+        {
+            // a client leaving after the game is not an error
+            if (session.getState() != CLOSED)
+            {
+                printError("receive", session.receiving());
+            }
+            return false;
+        }
+        if (!session.onReceived(bytesRecv))
+        {
+            printError("receive", session.receiving());
+            return false;
+        }
+
+        // answer as soon as possible instead of after the whole read
+        if (!flushConnection(conn))
+        {
+            return false;
+        }
+    }
+}
+
+// move the connection's timer to the session's current deadline
+static void armTimer(Loop &loop, Connection *conn)
+{
+    uint64_t deadline = conn->session.deadline();
+    if (deadline == 0)
+    {
+        loop.wheel.cancel(&conn->timer);
+    }
+    else
+    {
+        loop.wheel.arm(&conn->timer, tickOf(deadline));
+    }
+}
+
+// pass the session to the next server process if it is waiting on its
+// client, true if it is gone from this loop
+static bool handOffConnection(Loop &loop, Connection *conn)
+{
+    if (!conn->session.canHandOff())
+    {
+        return false;
+    }
+
+    string state;
+    conn->session.exportState(state);
+    if (!handoff.sendSession(conn->sock, state))
+    {
+        return false;
+    }
+    closeConnection(loop, conn);
+    return true;
+}
+
+// after each event: close the session once it is over, pass it on while
+// draining, or wait for its next deadline
+static void settleConnection(Loop &loop, Connection *conn, bool ok)
+{
+    if (!ok || conn->session.done())
+    {
+        closeConnection(loop, conn);
+    }
+    else if (!loop.draining || !handOffConnection(loop, conn))
+    {
+        armTimer(loop, conn);
+    }
+}
+
+// close every connection whose deadline has passed
+static void expireConnections(Loop &loop, vector<TimerNode *> &expired)
+{
+    expired.clear();
+    loop.wheel.advance(tickOf(monotonicMs()), expired);
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        Connection *conn = (Connection *)expired[i]->owner;
+        Session &session = conn->session;
+
+        // same report as a client that hung up at this point
+        if (session.pendingLength() > 0)
+        {
+            printError("send", session.sending());
+        }
+        else
+        {
+            printError("receive", session.receiving());
+        }
+        metrics.count(SESSIONS_EXPIRED);
+        closeConnection(loop, conn);
+    }
+}
+
+// send what rooms queued on sessions of this loop
+static void flushWoken(Loop &loop, vector<Session *> &woken)
+{
+    // closing a session can hand others their room standings
+    while (Session::takeWoken(woken))
+    {
+        for (size_t i = 0; i < woken.size(); i++)
+        {
+            Connection *conn = (Connection *)woken[i]->getOwner();
+            settleConnection(loop, conn, flushConnection(conn));
+        }
+    }
+}
+
+// add a new connection's socket to the loop, false if it was closed
+static bool registerConnection(Loop &loop, Connection *conn)
+{
+    conn->timer.owner = conn;
+    conn->session.setOwner(conn);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = conn;
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, conn->sock, &event) < 0)
+    {
+        cerr << "Error registering client socket" << endl;
+        close(conn->sock);
+        delete conn;
+        admission.release();
+        return false;
+    }
+
+    addConnection(loop, conn);
+    return true;
+}
+
+// accept() failed and the level-triggered listener would wake the loop
+// again at once, so stop watching it for a growing pause
+static void pauseAccepting(Loop &loop, int listenSock)
+{
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, listenSock, NULL);
+    loop.acceptResume = monotonicMs() + (loop.acceptBackoff + 999) / 1000;
+    loop.acceptBackoff = min(loop.acceptBackoff * 2, MAX_BACKOFF_US);
+}
+
+// accept every pending connection and register it with this loop
+static void acceptConnections(Loop &loop, int listenSock)
+{
+    while (true)
+    {
+        bool failed;
+        int clientSock = admission.acceptReady(listenSock,
+                                               SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                               failed);
+        if (clientSock < 0)
+        {
+            if (failed)
+            {
+                pauseAccepting(loop, listenSock);
+            }
+            return;
+        }
+        loop.acceptBackoff = MIN_BACKOFF_US;
+        if (!admission.admit(clientSock))
+        {
+            continue;
+        }
+
+        Connection *conn = new Connection;
+        conn->sock = clientSock;
+        conn->session.start();
+        if (!registerConnection(loop, conn))
+        {
+            continue;
+        }
+
+        // the welcome message nearly always fits in the socket buffer
+        if (!flushConnection(conn))
+        {
+            closeConnection(loop, conn);
+            continue;
+        }
+        armTimer(loop, conn);
+    }
+}
+
+// take the sessions the previous server handed over, their clients may
+// have sent more in the meantime
+static void adoptConnections(Loop &loop)
+{
+    uint64_t count;
+    if (read(inboxFd, &count, sizeof(count)) < 0)
+    {
+        // another loop took them
+        return;
+    }
+
+    vector<pair<int, string> > adopted;
+    pthread_mutex_lock(&inboxLock);
+    adopted.swap(inbox);
+    pthread_mutex_unlock(&inboxLock);
+
+    for (size_t i = 0; i < adopted.size(); i++)
+    {
+        int clientSock = adopted[i].first;
+        const string &state = adopted[i].second;
+
+        Connection *conn = new Connection;
+        conn->sock = clientSock;
+        if (!conn->session.importState(state.data(), state.size()))
+        {
+            printError("adopt", "handed over session");
+            close(clientSock);
+            delete conn;
+            admission.release();
+            continue;
+        }
+        if (registerConnection(loop, conn))
+        {
+            armTimer(loop, conn);
+        }
+    }
+}
+
+// stop accepting and pass on every session already waiting on its
+// client, the others go as they get there
+static void drainLoop(Loop &loop, int listenSock)
+{
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, listenSock, NULL);
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, drainFd, NULL);
+    loop.draining = true;
+
+    // from the back, handing off moves the last connection into the
+    // freed slot
+    for (size_t i = loop.conns.size(); i > 0; i--)
+    {
+        handOffConnection(loop, loop.conns[i - 1]);
+    }
+
+    loopsDrained.fetch_add(1);
+}
+
+// register fd with the loop under tag, false on failure
+static bool watch(Loop &loop, int fd, uint32_t events, char *tag)
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = tag;
+    return epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// watch the listener again once the pause after an accept() failure is
+// over, with a spare descriptor to shed clients if sessions freed one
+static void resumeAccepting(Loop &loop, int listenSock)
+{
+    if (loop.acceptResume == 0 || monotonicMs() < loop.acceptResume)
+    {
+        return;
+    }
+    loop.acceptResume = 0;
+    if (loop.draining)
+    {
+        return;
+    }
+
+    admission.restoreSpare();
+    if (!watch(loop, listenSock, EPOLLIN | EPOLLEXCLUSIVE, &listenTag))
+    {
+        pauseAccepting(loop, listenSock);
+    }
+}
+
+// event loop thread function
+static void *loopMain(void *args)
+{
+    struct LoopArgs *loopArgs = (struct LoopArgs *)args;
+    int listenSock = loopArgs->listenSock;
+    delete loopArgs;
+
+    Loop loop;
+    loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epfd < 0)
+    {
+        cerr << "Error creating epoll instance" << endl;
+        return NULL;
+    }
+
+    // every loop waits on the listening socket and the inbox,
+    // EPOLLEXCLUSIVE wakes one; a drain wakes them all
+    if (!watch(loop, listenSock, EPOLLIN | EPOLLEXCLUSIVE, &listenTag) ||
+        !watch(loop, inboxFd, EPOLLIN | EPOLLEXCLUSIVE, &inboxTag) ||
+        !watch(loop, drainFd, EPOLLIN, &drainTag))
+    {
+        cerr << "Error registering listening socket" << endl;
+        close(loop.epfd);
+        return NULL;
+    }
+    loopsRunning.fetch_add(1);
+
+    vector<struct epoll_event> events(256);
+    vector<TimerNode *> expired;
+    vector<Session *> woken;
+
+    while (true)
+    {
+        // sleep until the next timer slot that may fire
+        int timeout = -1;
+        if (!loop.wheel.empty())
+        {
+            timeout = loop.wheel.ticksToNext() * TIMER_TICK_MS;
+        }
+        if (loop.acceptResume != 0)
+        {
+            uint64_t now = monotonicMs();
+            int pause = 0;
+            if (loop.acceptResume > now)
+            {
+                pause = loop.acceptResume - now;
+            }
+            if (timeout < 0 || pause < timeout)
+            {
+                timeout = pause;
+            }
+        }
+
+        int count = epoll_wait(loop.epfd, events.data(), events.size(),
+                               timeout);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Error with epoll_wait" << endl;
+            break;
+        }
+
+        bool drain = false;
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == &listenTag)
+            {
+                acceptConnections(loop, listenSock);
+                continue;
+            }
+            if (events[i].data.ptr == &inboxTag)
+            {
+                adoptConnections(loop);
+                continue;
+            }
+            if (events[i].data.ptr == &drainTag)
+            {
+                // after the batch, which may still name its connections
+                drain = !loop.draining;
+                continue;
+            }
+
+            Connection *conn = (Connection *)events[i].data.ptr;
+            uint32_t ready = events[i].events;
+            bool ok = true;
+
+            if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                ok = readConnection(conn);
+            }
+            if (ok && (ready & EPOLLOUT))
+            {
+                ok = flushConnection(conn);
+            }
+
+            // the session ends once the leaderboard is out
+            settleConnection(loop, conn, ok);
+        }
+
+        expireConnections(loop, expired);
+        flushWoken(loop, woken);
+        if (drain)
+        {
+            drainLoop(loop, listenSock);
+        }
+        resumeAccepting(loop, listenSock);
+    }
+
+    close(loop.epfd);
+    return NULL;
+}
+
+void runEpollServer(int listenSock, int loops)
+{
+    // loops must never block in accept()
+    int flags = fcntl(listenSock, F_GETFL, 0);
+    if (flags < 0 || fcntl(listenSock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        cerr << "Error making listening socket non-blocking" << endl;
+        return;
+    }
+
+    // sessions may already be waiting in the inbox
+    pthread_mutex_lock(&inboxLock);
+    inboxFd = eventfd(inbox.empty() ? 0 : 1, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_unlock(&inboxLock);
+    drainFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inboxFd < 0 || drainFd < 0)
+    {
+        cerr << "Error creating event loop eventfds" << endl;
+        return;
+    }
+
+    vector<pthread_t> threads;
+    for (int i = 0; i < loops; i++)
+    {
+        LoopArgs *args = new LoopArgs;
+        args->listenSock = listenSock;
+
+        pthread_t threadID;
+        int status = pthread_create(&threadID, NULL, loopMain, (void *)args);
+        if (status != 0)
+        {
+            cerr << "Error creating event loop thread" << endl;
+            delete args;
+            break;
+        }
+        threads.push_back(threadID);
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+void adoptEpollConnection(int sock, const string &state)
+{
+    // loops wait for readiness, the socket came over as it was
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        printError("adopt", "handed over session");
+        close(sock);
+        return;
+    }
+    admission.adopt();
+
+    uint64_t one = 1;
+    pthread_mutex_lock(&inboxLock);
+    inbox.push_back(make_pair(sock, state));
+    if (inboxFd >= 0 && write(inboxFd, &one, sizeof(one)) < 0)
+    {
+        printError("wake", "event loop");
+    }
+    pthread_mutex_unlock(&inboxLock);
+}
+
+void drainEpollServer()
+{
+    if (drainFd < 0)
+    {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(drainFd, &one, sizeof(one)) < 0)
+    {
+        printError("wake", "event loops");
+    }
+
+    // once every loop removed the listener none accepts again
+    while (loopsDrained.load() < loopsRunning.load())
+    {
+        usleep(1000);
+    }
+}
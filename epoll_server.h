@@ -0,0 +1,28 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Edge-triggered epoll server mode
+*/
+
+#ifndef EPOLL_SERVER_H
+#define EPOLL_SERVER_H
+
+#include <string>
+
+/* Serve every session from a fixed number of event loop threads.
+   Each loop owns its own epoll instance and accepts from the shared
+   listening socket, so sessions never move between threads.
+   Only returns if the loops could not be started. */
+void runEpollServer(int listenSock, int loops);
+
+/* Give a loop the session the previous server process handed over with
+   its client socket, for the handoff thread. A malformed state closes
+   the socket. */
+void adoptEpollConnection(int sock, const std::string &state);
+
+/* Make every loop stop accepting and pass its sessions to the next
+   server process as they wait on their clients; returns once no loop
+   accepts any more. Does nothing unless the loops are running. */
+void drainEpollServer();
+
+#endif
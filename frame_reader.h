@@ -0,0 +1,277 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Buffered frame reader with pooled buffers
+*/
+
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include "protocol.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/* Per-thread free lists of buffers in power of two size classes, from
+   256 bytes to 128 KB. Taking and returning a buffer never locks and
+   only touches the heap when a list is empty or full. A buffer returned
+   on another thread simply joins that thread's list. */
+class BufferPool
+{
+public:
+    static const size_t MIN_SIZE = 256;
+    static const int CLASSES = 10;
+    static const size_t MAX_CACHED = 64; // buffers kept per class
+
+    // buffer of at least size bytes, its real size goes in capacity,
+    // NULL if size is bigger than the largest class
+    static char *acquire(size_t size, size_t &capacity)
+    {
+        int sizeClass = classOf(size);
+        if (sizeClass < 0)
+        {
+            return NULL;
+        }
+        capacity = MIN_SIZE << sizeClass;
+
+        std::vector<char *> &list = freeList(sizeClass);
+        if (list.empty())
+        {
+            return new char[capacity];
+        }
+        char *buffer = list.back();
+        list.pop_back();
+        return buffer;
+    }
+
+    static void release(char *buffer, size_t capacity)
+    {
+        std::vector<char *> &list = freeList(classOf(capacity));
+        if (list.size() < MAX_CACHED)
+        {
+            list.push_back(buffer);
+        }
+        else
+        {
+            delete[] buffer;
+        }
+    }
+
+private:
+    static int classOf(size_t size)
+    {
+        int sizeClass = 0;
+        while ((MIN_SIZE << sizeClass) < size)
+        {
+            if (++sizeClass == CLASSES)
+            {
+                return -1;
+            }
+        }
+        return sizeClass;
+    }
+
+    // frees the cached buffers when the thread exits
+    struct FreeLists
+    {
+        std::vector<char *> lists[CLASSES];
+
+        ~FreeLists()
+        {
+            for (int i = 0; i < CLASSES; i++)
+            {
+                for (size_t j = 0; j < lists[i].size(); j++)
+                {
+                    delete[] lists[i][j];
+                }
+            }
+        }
+    };
+
+    static std::vector<char *> &freeList(int sizeClass)
+    {
+        static thread_local FreeLists lists;
+        return lists.lists[sizeClass];
+    }
+};
+
+// one read of whatever the peer sent, recv() on a socket; other byte
+// streams such as ShmChannel overload it
+inline ssize_t readStream(int sock, char *buffer, size_t length)
+{
+    return recv(sock, buffer, length, 0);
+}
+
+// largest frame accepted unless configured otherwise
+const size_t DEFAULT_MAX_FRAME = FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD;
+
+/* Received bytes of one connection, read in large chunks with a single
+   recv() and parsed in place. Messages and frame payloads are handed out
+   as views into the buffer, which stay valid until the next fill() or
+   space() call. The buffer comes from BufferPool when data arrives and
+   goes back once everything received has been parsed, so idle
+   connections hold no input memory. Nothing bigger than maxFrame is ever
+   buffered, whatever length prefix the peer sends. */
+class FrameReader
+{
+public:
+    explicit FrameReader(size_t maxFrame = DEFAULT_MAX_FRAME)
+        : buffer(NULL), capacity(0), start(0), end(0), maxFrame(maxFrame)
+    {
+    }
+
+    ~FrameReader()
+    {
+        if (buffer != NULL)
+        {
+            BufferPool::release(buffer, capacity);
+        }
+    }
+
+    const char *data() const { return buffer + start; }
+    size_t size() const { return end - start; }
+    size_t limit() const { return maxFrame; }
+
+    // drop count parsed bytes, views stay valid until the next fill
+    void consume(size_t count) { start += count; }
+
+    // make sure a message of length bytes fits, false if it is larger
+    // than the frame limit
+    bool reserve(size_t length)
+    {
+        return length <= maxFrame && ensure(length);
+    }
+
+    // free room at the end of the buffer for the next recv(), length is
+    // 0 if the buffer cannot grow any more
+    char *space(size_t &length)
+    {
+        size_t wanted = size() + 1;
+        if (!ensure(wanted < BufferPool::MIN_SIZE ? BufferPool::MIN_SIZE
+                                                  : wanted))
+        {
+            length = 0;
+            return NULL;
+        }
+        length = capacity - end;
+        return buffer + end;
+    }
+
+    // count bytes were written into space()
+    void produced(size_t count) { end += count; }
+
+    // give the buffer back to the pool if nothing is left to parse
+    void releaseIfEmpty()
+    {
+        if (buffer != NULL && start == end)
+        {
+            BufferPool::release(buffer, capacity);
+            buffer = NULL;
+            capacity = start = end = 0;
+        }
+    }
+
+    // one readStream() into the free space, returns what it returned
+    template <typename Stream>
+    ssize_t fill(Stream &stream)
+    {
+        size_t length;
+        char *bp = space(length);
+        if (length == 0)
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        ssize_t bytesRecv = readStream(stream, bp, length);
+        if (bytesRecv > 0)
+        {
+            produced(bytesRecv);
+        }
+        return bytesRecv;
+    }
+
+    // keep calling fill() until count bytes are buffered, false on
+    // error, end of stream or a count over the frame limit
+    template <typename Stream>
+    bool fillTo(Stream &stream, size_t count)
+    {
+        if (!reserve(count))
+        {
+            return false;
+        }
+        while (size() < count)
+        {
+            ssize_t bytesRecv = fill(stream);
+            if (bytesRecv <= 0 && !(bytesRecv < 0 && errno == EINTR))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // complete v2 frame at the front of the buffer, false if it has not
+    // fully arrived; tooLarge is set when it never could
+    bool peekFrame(FrameHeader &header, std::string_view &payload,
+                   bool &tooLarge)
+    {
+        tooLarge = false;
+        if (!frameComplete(data(), size(), header))
+        {
+            if (size() >= FRAME_HEADER_SIZE)
+            {
+                tooLarge = !reserve(FRAME_HEADER_SIZE + header.length);
+            }
+            return false;
+        }
+        payload = std::string_view(data() + FRAME_HEADER_SIZE, header.length);
+        return true;
+    }
+
+private:
+    // room for length bytes from the first unparsed one, moving them to
+    // the front or into a bigger buffer when needed
+    bool ensure(size_t length)
+    {
+        if (buffer != NULL && length <= capacity)
+        {
+            if (start == end || capacity - start < length)
+            {
+                memmove(buffer, buffer + start, end - start);
+                end -= start;
+                start = 0;
+            }
+            return true;
+        }
+
+        size_t newCapacity;
+        char *bigger = BufferPool::acquire(length, newCapacity);
+        if (bigger == NULL)
+        {
+            return false;
+        }
+        if (buffer != NULL)
+        {
+            memcpy(bigger, buffer + start, end - start);
+            BufferPool::release(buffer, capacity);
+        }
+        end -= start;
+        start = 0;
+        buffer = bigger;
+        capacity = newCapacity;
+        return true;
+    }
+
+    char *buffer;
+    size_t capacity;
+    size_t start; // first unparsed byte
+    size_t end;   // one past the last received byte
+    size_t maxFrame;
+};
+
+#endif
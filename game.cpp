@@ -0,0 +1,58 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Game state shared by every server mode
+*/
+
+#include "game.h"
+#include "treasure.h"
+#include "metrics.h"
+#include "logger.h"
+
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+// prints appropriate error
+void printError(string action, string object)
+{
+    logger.failure(action, object);
+    metrics.error(action, object);
+}
+
+// generate random int
+long generateLong()
+{
+    // Define the distribution for the range -100 to 100 (inclusive)
+    uniform_int_distribution<long> distribution(-100, 100);
+
+    // Generate a random number from this thread's engine, which is seeded
+    // once instead of on every call
+    long randomNumber = distribution(threadEngine());
+
+    return randomNumber;
+}
+
+// update leaderboard
+void updateBoard(leaderBoard &board, const player newPlayer)
+{
+    // the board is kept sorted by tries, so the new player goes after
+    // everyone with as few tries, earlier finishers stay ahead on ties
+    vector<player>::iterator at = upper_bound(
+        board.players.begin(), board.players.end(), newPlayer,
+        [](const player &a, const player &b) { return a.tries < b.tries; });
+
+    // a player behind a full board would be dropped right away
+    if (at - board.players.begin() >= (long)LEADERBOARD_SIZE)
+    {
+        return;
+    }
+    board.players.insert(at, newPlayer);
+
+    // Keep only the top 3 players
+    if (board.players.size() > LEADERBOARD_SIZE)
+    {
+        board.players.pop_back();
+    }
+}
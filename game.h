@@ -0,0 +1,69 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Game state shared by every server mode
+*/
+
+#ifndef GAME_H
+#define GAME_H
+
+#include <string>
+#include <vector>
+
+struct player
+{
+    // data fields
+    std::string name;
+    int tries;
+    unsigned long id; // unique per finished game, 0 until recorded
+
+    // Default constructor
+    player() : name(""), tries(0), id(0) {}
+
+    // Parameterized constructor to initialize player with name and tries
+    player(const std::string &name, int tries)
+    {
+        this->name = name;
+        this->tries = tries;
+        this->id = 0;
+    }
+};
+
+struct leaderBoard
+{
+    std::vector<player> players;
+};
+
+struct treasureLocation // store treasure location
+{
+    long x;
+    long y;
+
+    // Default constructor
+    treasureLocation() : x(0), y(0) {}
+
+    // Parameterized constructor to initialize location with x and y
+    treasureLocation(long x, long y)
+    {
+        this->x = x;
+        this->y = y;
+    }
+};
+
+// players kept on the leaderboard
+const size_t LEADERBOARD_SIZE = 3;
+
+// prints appropriate error
+void printError(std::string action, std::string object);
+
+// calculate distance between treasure location and user guess, defined
+// with its fast paths in distance.cpp
+double calcDist(long randomX, long randomY, long userX, long userY);
+
+// generate random int
+long generateLong();
+
+// update leaderboard
+void updateBoard(leaderBoard &board, const player newPlayer);
+
+#endif
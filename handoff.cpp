@@ -0,0 +1,657 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Zero-downtime restart
+*/
+
+#include "handoff.h"
+#include "leaderboard.h"
+#include "rank_index.h"
+#include "journal.h"
+#include "admission.h"
+#include "epoll_server.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "protocol.h"
+#include "frame_reader.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+Handoff handoff;
+
+// message types on the control socket
+const char HANDOFF_LISTENERS = 1;
+const char HANDOFF_READY = 2;
+const char HANDOFF_BOARD = 3;
+const char HANDOFF_RANKS = 4;
+const char HANDOFF_STATE_END = 5;
+const char HANDOFF_SERVING = 6;
+const char HANDOFF_SESSION = 7;
+const char HANDOFF_GAME = 8;
+
+// the game port and the Unix domain listener
+const int MAX_LISTENERS = 2;
+
+// a session with its name and input at the frame limit fits
+const size_t MAX_CONTROL_MESSAGE = 1 + 2 * DEFAULT_MAX_FRAME + 4096;
+
+// rank counts per RANKS message, keeps each one well under the socket
+// buffer
+const size_t RANK_SLOTS_PER_MESSAGE = 4096;
+
+// id, tries and name of a game
+static void putGame(string &out, const player &game)
+{
+    putU64(out, game.id);
+    putU32(out, game.tries);
+    putU32(out, game.name.size());
+    out += game.name;
+}
+
+static bool getGame(const string &payload, player &game)
+{
+    if (payload.size() < 16 ||
+        payload.size() - 16 != getU32(payload.data() + 12))
+    {
+        return false;
+    }
+    game.id = getU64(payload.data());
+    game.tries = getU32(payload.data() + 8);
+    game.name = payload.substr(16);
+    return true;
+}
+
+Handoff::Handoff()
+    : enabled(false), controlSock(-1), controlListen(-1), listenSock(-1),
+      localSock(-1), adopt(NULL), phase(SERVING), finishing(0),
+      successorSock(-1)
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+bool Handoff::connect(const string &path)
+{
+    enabled = true;
+    this->path = path;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // nothing there, or a stale file left by a server that is gone
+    if (::connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return false;
+    }
+
+    controlSock = sock;
+    return true;
+}
+
+// one message with its type and up to count descriptors, false on error
+bool Handoff::sendMessage(int sock, char type, const string &payload,
+                          const int *fds, int fdCount, int flags)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = &type;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = (void *)payload.data();
+    iov[1].iov_len = payload.size();
+
+    union
+    {
+        char bytes[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    if (fdCount > 0)
+    {
+        message.msg_control = control.bytes;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+    }
+
+    ssize_t bytesSent;
+    do
+    {
+        bytesSent = sendmsg(sock, &message, MSG_NOSIGNAL | flags);
+    } while (bytesSent < 0 && errno == EINTR);
+
+    return bytesSent == (ssize_t)(1 + payload.size());
+}
+
+// next message and the descriptors that came with it, its type, 0 at
+// the end of the stream or -1 on error
+int Handoff::receiveMessage(int sock, string &payload, vector<int> &fds)
+{
+    payload.resize(MAX_CONTROL_MESSAGE);
+    fds.clear();
+
+    struct iovec iov;
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+
+    union
+    {
+        char bytes[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    ssize_t bytesRecv;
+    do
+    {
+        bytesRecv = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    } while (bytesRecv < 0 && errno == EINTR);
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+         bytesRecv >= 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+    }
+
+    if (bytesRecv <= 0 || (message.msg_flags & MSG_TRUNC))
+    {
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            close(fds[i]);
+        }
+        fds.clear();
+        return bytesRecv == 0 ? 0 : -1;
+    }
+
+    char type = payload[0];
+    payload.erase(0, 1);
+    payload.resize(bytesRecv - 1);
+    return type;
+}
+
+bool Handoff::receiveListeners(int &listenSock, int &localSock,
+                               unsigned short port)
+{
+    string payload;
+    vector<int> fds;
+    int type = receiveMessage(controlSock, payload, fds);
+    if (type != HANDOFF_LISTENERS || payload.size() != 1 ||
+        fds.size() != (size_t)payload[0] || fds.empty())
+    {
+        cerr << "Error receiving listening sockets from the old server"
+             << endl;
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            close(fds[i]);
+        }
+        return false;
+    }
+
+    // the old server keeps serving if this one cannot take over
+    struct sockaddr_in servAddr;
+    socklen_t length = sizeof(servAddr);
+    if (getsockname(fds[0], (struct sockaddr *)&servAddr, &length) < 0 ||
+        servAddr.sin_family != AF_INET || ntohs(servAddr.sin_port) != port)
+    {
+        cerr << "Error: the old server does not listen on port " << port
+             << endl;
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            close(fds[i]);
+        }
+        return false;
+    }
+
+    listenSock = fds[0];
+    localSock = fds.size() > 1 ? fds[1] : -1;
+    return sendMessage(controlSock, HANDOFF_READY, "", NULL, 0);
+}
+
+bool Handoff::receiveState(leaderBoard &board, unsigned long &lastId,
+                           vector<uint64_t> &byTries)
+{
+    string payload;
+    vector<int> fds;
+
+    while (true)
+    {
+        int type = receiveMessage(controlSock, payload, fds);
+        player game;
+
+        // none of these messages carries descriptors
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            close(fds[i]);
+        }
+
+        if (type == HANDOFF_BOARD && getGame(payload, game))
+        {
+            // sent best first, re-adding them keeps the order
+            updateBoard(board, game);
+        }
+        else if (type == HANDOFF_RANKS && payload.size() >= 4 &&
+                 payload.size() - 4 == 12 * (size_t)getU32(payload.data()))
+        {
+            uint32_t slots = getU32(payload.data());
+            for (uint32_t i = 0; i < slots; i++)
+            {
+                const char *slot = payload.data() + 4 + i * 12;
+                size_t tries = min((size_t)getU32(slot), MAX_RANKED_TRIES);
+                if (tries >= byTries.size())
+                {
+                    byTries.resize(tries + 1, 0);
+                }
+                byTries[tries] += getU64(slot + 4);
+            }
+        }
+        else if (type == HANDOFF_STATE_END && payload.size() == 8)
+        {
+            lastId = getU64(payload.data());
+            return true;
+        }
+        else
+        {
+            cerr << "Error receiving the leaderboard from the old server"
+                 << endl;
+            return false;
+        }
+    }
+}
+
+// listen on the path for the next server, replacing the socket file of
+// the one before
+bool Handoff::openControl()
+{
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        cerr << "Error creating handoff socket" << endl;
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // whoever connects is handed the clients, only this user may; the
+    // peer check in successorMain() covers connecting before the chmod
+    unlink(path.c_str());
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(path.c_str(), 0600) < 0 || listen(sock, 1) < 0)
+    {
+        cerr << "Error with bind on " << path << endl;
+        close(sock);
+        return false;
+    }
+
+    controlListen = sock;
+    return true;
+}
+
+bool Handoff::start(int listenSock, int localSock, AdoptFn adopt)
+{
+    this->listenSock = listenSock;
+    this->localSock = localSock;
+    this->adopt = adopt;
+
+    // a cold start waits for a successor at once, otherwise the old
+    // server may start draining
+    bool coldStart = controlSock < 0;
+    if (coldStart ? !openControl()
+                  : !sendMessage(controlSock, HANDOFF_SERVING, "", NULL, 0))
+    {
+        return false;
+    }
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL,
+                                coldStart ? successorMain : receiverMain,
+                                this);
+    if (status != 0)
+    {
+        cerr << "Error creating handoff thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+// handoff thread function while the old server drains
+void *Handoff::receiverMain(void *args)
+{
+    Handoff *self = (Handoff *)args;
+    string payload;
+    vector<int> fds;
+    int type;
+
+    while ((type = self->receiveMessage(self->controlSock, payload, fds)) > 0)
+    {
+        player game;
+        if (type == HANDOFF_SESSION && fds.size() == 1)
+        {
+            self->adopt(fds[0], payload);
+            continue;
+        }
+        if (type == HANDOFF_GAME && getGame(payload, game))
+        {
+            ranks.add(game.tries);
+            leaderboard.finish(game);
+            continue;
+        }
+
+        printError("receive", "handoff message");
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            close(fds[i]);
+        }
+    }
+
+    // the old server is gone, the path is ours now
+    close(self->controlSock);
+    self->controlSock = -1;
+    if (!self->openControl())
+    {
+        return NULL;
+    }
+
+    return successorMain(args);
+}
+
+// handoff thread function waiting for the next server
+void *Handoff::successorMain(void *args)
+{
+    Handoff *self = (Handoff *)args;
+
+    while (true)
+    {
+        int sock = accept4(self->controlListen, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                printError("accept", "handoff connection");
+                usleep(100 * 1000);
+            }
+            continue;
+        }
+
+        // a server of another user would get our clients
+        struct ucred peer;
+        socklen_t length = sizeof(peer);
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &length) < 0 ||
+            peer.uid != geteuid())
+        {
+            printError("accept", "handoff connection from another user");
+            close(sock);
+            continue;
+        }
+
+        // only returns if the successor went away early
+        self->handOver(sock);
+        close(sock);
+    }
+
+    return NULL;
+}
+
+// the leaderboard, then the rank counts, then the last game id
+bool Handoff::sendState(int sock)
+{
+    BoardSnapshot *snapshot = leaderboard.acquire();
+    leaderBoard board = snapshot->board;
+    Leaderboard::release(snapshot);
+
+    string payload;
+    for (size_t i = 0; i < board.players.size(); i++)
+    {
+        payload.clear();
+        putGame(payload, board.players[i]);
+        if (!sendMessage(sock, HANDOFF_BOARD, payload, NULL, 0))
+        {
+            return false;
+        }
+    }
+
+    // only the tries some game finished in
+    vector<uint64_t> byTries = ranks.counts();
+    string slots;
+    uint32_t slotCount = 0;
+    for (size_t tries = 1; tries < byTries.size(); tries++)
+    {
+        if (byTries[tries] != 0)
+        {
+            putU32(slots, tries);
+            putU64(slots, byTries[tries]);
+            slotCount++;
+        }
+
+        bool last = tries + 1 == byTries.size();
+        if (slotCount == RANK_SLOTS_PER_MESSAGE || (last && slotCount > 0))
+        {
+            payload.clear();
+            putU32(payload, slotCount);
+            payload += slots;
+            if (!sendMessage(sock, HANDOFF_RANKS, payload, NULL, 0))
+            {
+                return false;
+            }
+            slots.clear();
+            slotCount = 0;
+        }
+    }
+
+    payload.clear();
+    putU64(payload, leaderboard.lastRecorded());
+    return sendMessage(sock, HANDOFF_STATE_END, payload, NULL, 0);
+}
+
+// record the games held for a successor that went away here after all
+void Handoff::keepGames()
+{
+    pthread_mutex_lock(&lock);
+    phase.store(SERVING);
+    vector<player> games;
+    games.swap(held);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < games.size(); i++)
+    {
+        ranks.add(games[i].tries);
+        leaderboard.finish(games[i]);
+    }
+}
+
+// give everything to the successor on sock and exit once drained, false
+// if it went away before it started serving
+bool Handoff::handOver(int sock)
+{
+    // connects keep queueing on the listeners while the successor starts
+    int fds[MAX_LISTENERS] = {listenSock, localSock};
+    string payload(1, (char)(localSock >= 0 ? 2 : 1));
+    vector<int> unused;
+    if (!sendMessage(sock, HANDOFF_LISTENERS, payload, fds, payload[0]) ||
+        receiveMessage(sock, payload, unused) != HANDOFF_READY)
+    {
+        printError("send", "listening sockets");
+        return false;
+    }
+
+    // games finishing from now on are the successor's; once the ones
+    // already being recorded here are done, the board, the rank counts
+    // and the journal hold every other game
+    phase.store(FORWARDING);
+    while (finishing.load() > 0)
+    {
+        usleep(1000);
+    }
+    leaderboard.sync();
+    journal.flush();
+
+    if (!sendState(sock) ||
+        receiveMessage(sock, payload, unused) != HANDOFF_SERVING)
+    {
+        printError("send", "leaderboard");
+        keepGames();
+        return false;
+    }
+
+    pthread_mutex_lock(&lock);
+    successorSock = sock;
+    phase.store(DRAINING);
+    for (size_t i = 0; i < held.size(); i++)
+    {
+        payload.clear();
+        putGame(payload, held[i]);
+        if (!sendMessage(sock, HANDOFF_GAME, payload, NULL, 0))
+        {
+            printError("send", "finished game");
+        }
+    }
+    held.clear();
+    pthread_mutex_unlock(&lock);
+
+    // the successor takes the path over once this process is gone
+    close(controlListen);
+    controlListen = -1;
+
+    // epoll sessions move over as they wait on their clients, the others
+    // finish here
+    admission.stopAccepting();
+    drainEpollServer();
+    while (admission.activeSessions() > 0)
+    {
+        usleep(10 * 1000);
+    }
+    recorder.flush();
+
+    // closing the control socket tells the successor it is on its own;
+    // the other threads are still running, so no exit handlers
+    _exit(EXIT_SUCCESS);
+}
+
+bool Handoff::beginGame()
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    // announce the game before looking, see handOver()
+    finishing.fetch_add(1);
+    if (phase.load() == SERVING)
+    {
+        return false;
+    }
+    finishing.fetch_sub(1);
+    return true;
+}
+
+void Handoff::endGame(const player &finished, bool forward)
+{
+    if (!forward)
+    {
+        if (enabled)
+        {
+            finishing.fetch_sub(1);
+        }
+        return;
+    }
+
+    string payload;
+    putGame(payload, finished);
+
+    pthread_mutex_lock(&lock);
+    bool kept = false;
+    if (successorSock >= 0)
+    {
+        if (!sendMessage(successorSock, HANDOFF_GAME, payload, NULL, 0))
+        {
+            printError("send", "finished game");
+        }
+    }
+    else if (phase.load() == FORWARDING)
+    {
+        held.push_back(finished);
+    }
+    else
+    {
+        kept = true;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // the successor went away before it had the leaderboard
+    if (kept)
+    {
+        ranks.add(finished.tries);
+        leaderboard.finish(finished);
+    }
+}
+
+bool Handoff::sendSession(int sock, const string &sessionState)
+{
+    // an event loop must not wait on a busy successor, the session
+    // stays and goes with one of its next events instead
+    pthread_mutex_lock(&lock);
+    bool sent = successorSock >= 0 &&
+                sendMessage(successorSock, HANDOFF_SESSION, sessionState,
+                            &sock, 1, MSG_DONTWAIT);
+    pthread_mutex_unlock(&lock);
+
+    if (sent)
+    {
+        metrics.count(SESSIONS_HANDED_OFF);
+    }
+    return sent;
+}
+
+void Handoff::waitForExit()
+{
+    while (true)
+    {
+        pause();
+    }
+}
@@ -0,0 +1,122 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Zero-downtime restart
+*/
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "game.h"
+
+#include <pthread.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// takes over the client socket of a session handed over with its state
+typedef void (*AdoptFn)(int sock, const std::string &sessionState);
+
+/* Replaces a running server with a new process without refusing a
+   single connect.
+
+   A server started with --handoff PATH first connects to PATH. If an
+   older server answers there, it sends its listening sockets over
+   SCM_RIGHTS, so the kernel keeps queueing connects on them throughout,
+   then its leaderboard and rank counts. The new process serves from
+   then on. The old one stops accepting, passes each epoll session over
+   with its socket the next time it waits on its client, forwards the
+   games still finishing on its side and exits after its last session.
+   No answer means a cold start. Either way the process then waits on
+   PATH for the next one.
+
+   The control socket is SOCK_SEQPACKET, one message per item, a type
+   byte first:
+     LISTENERS  listener count u8, the sockets attached
+     READY      from the new process, the listeners are usable
+     BOARD      id u64, tries u32, name u32 length + bytes
+     RANKS      slots u32, then {tries u32, games u64} per slot
+     STATE_END  lastId u64, the leaderboard is complete
+     SERVING    from the new process, it serves from now on
+     SESSION    Session::exportState(), the client socket attached
+     GAME       like BOARD, a game finished on the old side
+   The old process closes it once it is done. Until SERVING arrives it
+   can still go back to serving alone. */
+class Handoff
+{
+public:
+    Handoff();
+
+    // reach a server running at path, true if one answered and this
+    // process takes over from it, false for a cold start
+    bool connect(const std::string &path);
+
+    // the listening sockets of the old server, localSock is -1 if it had
+    // no Unix domain listener; false on failure or if they are not for
+    // port
+    bool receiveListeners(int &listenSock, int &localSock,
+                          unsigned short port);
+
+    // the leaderboard of the old server, byTries[t] games finished in t
+    // tries; false on failure
+    bool receiveState(leaderBoard &board, unsigned long &lastId,
+                      std::vector<uint64_t> &byTries);
+
+    // adopt what the old server still hands over, then wait on the path
+    // to hand these listeners over in turn; false on failure
+    bool start(int listenSock, int localSock, AdoptFn adopt);
+
+    // around recording a finished game, true if the new process records
+    // it; endGame() sends it there
+    bool beginGame();
+    void endGame(const player &finished, bool forward);
+
+    // the new process has the leaderboard, sessions may go over
+    bool draining() const { return phase.load() == DRAINING; }
+
+    // pass the client socket and session state to the new process
+    // without blocking, false if the session has to stay here for now
+    bool sendSession(int sock, const std::string &sessionState);
+
+    // park the calling thread, the process exits once drained
+    void waitForExit();
+
+private:
+    enum Phase
+    {
+        SERVING,    // no successor
+        FORWARDING, // successor connected, games go to it
+        DRAINING    // successor has the state, sessions go to it
+    };
+
+    static void *receiverMain(void *args);
+    static void *successorMain(void *args);
+    bool openControl();
+    bool handOver(int sock);
+    bool sendState(int sock);
+    void keepGames();
+    bool sendMessage(int sock, char type, const std::string &payload,
+                     const int *fds, int fdCount, int flags = 0);
+    int receiveMessage(int sock, std::string &payload,
+                       std::vector<int> &fds);
+
+    bool enabled;       // started with a path
+    std::string path;
+    int controlSock;    // to the old server while taking over, else -1
+    int controlListen;  // where a successor connects, -1 until open
+    int listenSock;     // what a successor gets
+    int localSock;
+    AdoptFn adopt;
+
+    std::atomic<Phase> phase;
+    std::atomic<long> finishing; // games being recorded here
+
+    pthread_mutex_t lock;     // sends to the successor
+    int successorSock;        // -1 until the leaderboard is out
+    std::vector<player> held; // forwarded before that
+};
+
+extern Handoff handoff;
+
+#endif
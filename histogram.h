@@ -0,0 +1,141 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Log-linear latency histogram
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <cstring>
+
+/* HDR-style histogram of non-negative integer values (nanoseconds).
+   Values are bucketed by their highest set bit and the SUB_BITS bits
+   below it, so every bucket is within 1/16 of the values it holds and
+   recording is a couple of bit operations with no allocation. */
+class Histogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    Histogram() { reset(); }
+
+    void reset()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    void record(uint64_t value)
+    {
+        counts[bucketOf(value)]++;
+        total++;
+        sum += value;
+        if (value > maxValue)
+        {
+            maxValue = value;
+        }
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        if (other.maxValue > maxValue)
+        {
+            maxValue = other.maxValue;
+        }
+    }
+
+    // count values known only by their bucket, for rebuilding a
+    // histogram from counters kept elsewhere
+    void addBucket(int bucket, uint64_t n)
+    {
+        counts[bucket] += n;
+        total += n;
+    }
+
+    // sum and largest of the values added with addBucket()
+    void addTotals(uint64_t valueSum, uint64_t valueMax)
+    {
+        sum += valueSum;
+        if (valueMax > maxValue)
+        {
+            maxValue = valueMax;
+        }
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? (double)sum / total : 0; }
+    uint64_t sumValues() const { return sum; }
+    uint64_t bucketCount(int bucket) const { return counts[bucket]; }
+
+    // value below which fraction of the recorded values fall
+    uint64_t percentile(double fraction) const
+    {
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(fraction * total);
+        if (rank >= total)
+        {
+            rank = total - 1;
+        }
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen > rank)
+            {
+                uint64_t upper = upperBound(i);
+                return upper < maxValue ? upper : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+    static int bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return (int)value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        int sub = (int)((value >> shift) & (SUB_BUCKETS - 1));
+        return (shift + 1) * SUB_BUCKETS + sub;
+    }
+
+    // largest value that lands in bucket
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        uint64_t lower = ((uint64_t)SUB_BUCKETS + sub) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+private:
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t maxValue;
+};
+
+#endif
@@ -0,0 +1,535 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Durable leaderboard journal
+*/
+
+#include "journal.h"
+#include "metrics.h"
+#include "rank_index.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+GameJournal journal;
+
+// first bytes of each file
+static const char LOG_MAGIC[8] = {'P', 'A', '4', 'G', 'A', 'M', 'E', 'S'};
+static const char SNAPSHOT_MAGIC[8] = {'P', 'A', '4', 'B', 'R', 'D', '0', '2'};
+
+// games logged between two snapshots, bounds the replay on startup
+const size_t SNAPSHOT_EVERY = 65536;
+
+/* Log record, in host byte order:
+     checksum   u32  of everything after it, name included
+     tries      u32
+     id         u64
+     finishedAt u64  ms since the epoch
+     nameLength u16
+     name       nameLength bytes */
+const size_t RECORD_HEADER_SIZE = 26;
+
+/* Snapshot file:
+     magic      8 bytes
+     checksum   u32  of everything after it
+     count      u32  records that follow
+     logOffset  u64  log bytes the leaderboard covers
+     lastId     u64  highest game id in them
+     records    the leaderboard, best first, in log record format
+     slots      u32  tries counts that follow
+     counts     slots times {tries u32, games u64}, for the rank index
+   An older snapshot has another magic and is replaced after a full
+   replay of the log. */
+const size_t SNAPSHOT_HEADER_SIZE = 32;
+
+// FNV-1a
+static uint32_t checksum(const char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// append the record of a game to out
+static void putRecord(string &out, const player &game, uint64_t finishedAt)
+{
+    uint32_t tries = game.tries;
+    uint64_t id = game.id;
+    uint16_t nameLength = min(game.name.size(), (size_t)UINT16_MAX);
+
+    size_t start = out.size();
+    out.resize(start + RECORD_HEADER_SIZE);
+    char *header = &out[start];
+    memcpy(header + 4, &tries, 4);
+    memcpy(header + 8, &id, 8);
+    memcpy(header + 16, &finishedAt, 8);
+    memcpy(header + 24, &nameLength, 2);
+    out.append(game.name, 0, nameLength);
+
+    uint32_t sum = checksum(&out[start + 4], out.size() - start - 4);
+    memcpy(&out[start], &sum, 4);
+}
+
+// read the record at data into game, its size or 0 if it is cut off or
+// damaged
+static size_t getRecord(const char *data, size_t length, player &game)
+{
+    if (length < RECORD_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t sum, tries;
+    uint64_t id;
+    uint16_t nameLength;
+    memcpy(&sum, data, 4);
+    memcpy(&tries, data + 4, 4);
+    memcpy(&id, data + 8, 8);
+    memcpy(&nameLength, data + 24, 2);
+
+    size_t size = RECORD_HEADER_SIZE + nameLength;
+    if (length < size || checksum(data + 4, size - 4) != sum)
+    {
+        return 0;
+    }
+
+    game.name.assign(data + RECORD_HEADER_SIZE, nameLength);
+    game.tries = tries;
+    game.id = id;
+    return size;
+}
+
+// write all of data, false on error
+static bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+GameJournal::GameJournal()
+    : logFd(-1), queued(0), handled(0), wakePending(false), lastId(0),
+      logSize(0), sinceSnapshot(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    sem_init(&wake, 0, 0);
+}
+
+bool GameJournal::start(const string &dir, leaderBoard &recovered,
+                        unsigned long &lastRecorded,
+                        vector<uint64_t> &finishedByTries)
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        cerr << "Error creating data directory " << dir << endl;
+        return false;
+    }
+    logPath = dir + "/games.log";
+    snapshotPath = dir + "/leaderboard.snap";
+
+    if (!openLog(loadSnapshot()))
+    {
+        return false;
+    }
+    recovered = board;
+    lastRecorded = lastId;
+    finishedByTries = byTries;
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, writerMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating game log writer thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+void GameJournal::append(const player &finished)
+{
+    if (logFd < 0)
+    {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t finishedAt = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    pthread_mutex_lock(&lock);
+    size_t before = pending.size();
+    putRecord(pending, finished, finishedAt);
+    queued += pending.size() - before;
+    pthread_mutex_unlock(&lock);
+
+    if (!wakePending.exchange(true))
+    {
+        sem_post(&wake);
+    }
+}
+
+void GameJournal::flush()
+{
+    if (logFd < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    uint64_t target = queued;
+    pthread_mutex_unlock(&lock);
+
+    while (handled.load() < target)
+    {
+        usleep(1000);
+    }
+}
+
+// leaderboard and covered log offset from the snapshot, the start of
+// the log if there is no usable snapshot
+uint64_t GameJournal::loadSnapshot()
+{
+    board.players.clear();
+    byTries.clear();
+    lastId = 0;
+
+    int fd = open(snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return sizeof(LOG_MAGIC);
+    }
+
+    struct stat info;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= SNAPSHOT_HEADER_SIZE)
+    {
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        cerr << "Error reading leaderboard snapshot, replaying the game log"
+             << endl;
+        return sizeof(LOG_MAGIC);
+    }
+
+    const char *data = (const char *)map;
+    size_t size = info.st_size;
+    uint32_t sum, count;
+    uint64_t logOffset, snapshotId;
+    memcpy(&sum, data + 8, 4);
+    memcpy(&count, data + 12, 4);
+    memcpy(&logOffset, data + 16, 8);
+    memcpy(&snapshotId, data + 24, 8);
+
+    bool valid = memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                 checksum(data + 12, size - 12) == sum;
+
+    // records are stored best first, so re-adding them keeps the order
+    size_t pos = SNAPSHOT_HEADER_SIZE;
+    for (uint32_t i = 0; valid && i < count; i++)
+    {
+        player game;
+        size_t used = getRecord(data + pos, size - pos, game);
+        if (used == 0)
+        {
+            valid = false;
+            break;
+        }
+        updateBoard(board, game);
+        pos += used;
+    }
+
+    uint32_t slots = 0;
+    valid = valid && size - pos >= 4;
+    if (valid)
+    {
+        memcpy(&slots, data + pos, 4);
+        pos += 4;
+        valid = (size - pos) / 12 >= slots;
+    }
+    for (uint32_t i = 0; valid && i < slots; i++)
+    {
+        uint32_t tries;
+        uint64_t games;
+        memcpy(&tries, data + pos, 4);
+        memcpy(&games, data + pos + 4, 8);
+        pos += 12;
+        countGames(tries, games);
+    }
+    valid = valid && pos == size;
+    munmap(map, size);
+
+    if (!valid)
+    {
+        cerr << "Error reading leaderboard snapshot, replaying the game log"
+             << endl;
+        board.players.clear();
+        byTries.clear();
+        return sizeof(LOG_MAGIC);
+    }
+
+    lastId = snapshotId;
+    return logOffset;
+}
+
+// open the log and replay what was written after snapshotOffset
+bool GameJournal::openLog(uint64_t snapshotOffset)
+{
+    logFd = open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                 0644);
+    if (logFd < 0)
+    {
+        cerr << "Error opening game log " << logPath << endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(logFd, &info) < 0)
+    {
+        cerr << "Error opening game log " << logPath << endl;
+        close(logFd);
+        logFd = -1;
+        return false;
+    }
+    uint64_t size = info.st_size;
+
+    // new log
+    if (size == 0)
+    {
+        if (!writeAll(logFd, LOG_MAGIC, sizeof(LOG_MAGIC)) ||
+            fdatasync(logFd) < 0)
+        {
+            cerr << "Error writing game log " << logPath << endl;
+            close(logFd);
+            logFd = -1;
+            return false;
+        }
+        size = sizeof(LOG_MAGIC);
+    }
+
+    // only the part after the snapshot is read, the rest is never
+    // paged in
+    void *map = MAP_FAILED;
+    if (size >= sizeof(LOG_MAGIC))
+    {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, logFd, 0);
+    }
+    if (map == MAP_FAILED ||
+        memcmp(map, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+    {
+        cerr << "Error reading game log " << logPath << endl;
+        if (map != MAP_FAILED)
+        {
+            munmap(map, size);
+        }
+        close(logFd);
+        logFd = -1;
+        return false;
+    }
+    const char *data = (const char *)map;
+
+    // the log lost games the snapshot has seen, trust the log
+    if (snapshotOffset > size)
+    {
+        cerr << "Leaderboard snapshot is ahead of the game log, replaying "
+                "the whole log"
+             << endl;
+        board.players.clear();
+        byTries.clear();
+        lastId = 0;
+        snapshotOffset = sizeof(LOG_MAGIC);
+    }
+
+    sinceSnapshot = 0;
+    logSize = snapshotOffset +
+              replay(data + snapshotOffset, size - snapshotOffset);
+    munmap(map, size);
+
+    // a crash in the middle of a write leaves a partial record
+    if (logSize < size)
+    {
+        cerr << "Dropping " << size - logSize
+             << " bytes of unfinished records from the game log" << endl;
+        if (ftruncate(logFd, logSize) < 0)
+        {
+            cerr << "Error truncating game log " << logPath << endl;
+            close(logFd);
+            logFd = -1;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// fold the records in data into the leaderboard, bytes of the complete
+// ones
+size_t GameJournal::replay(const char *data, size_t length)
+{
+    size_t pos = 0;
+    player game;
+
+    while (pos < length)
+    {
+        size_t used = getRecord(data + pos, length - pos, game);
+        if (used == 0)
+        {
+            break;
+        }
+        updateBoard(board, game);
+        countGames(game.tries, 1);
+        lastId = max(lastId, game.id);
+        sinceSnapshot++;
+        pos += used;
+    }
+
+    return pos;
+}
+
+// add games finished in tries to the counts for the rank index
+void GameJournal::countGames(uint32_t tries, uint64_t games)
+{
+    size_t slot = min((size_t)tries, MAX_RANKED_TRIES);
+    if (slot >= byTries.size())
+    {
+        byTries.resize(slot + 1, 0);
+    }
+    byTries[slot] += games;
+}
+
+// replace the snapshot with the current leaderboard
+void GameJournal::writeSnapshot()
+{
+    uint32_t count = board.players.size();
+    uint64_t logOffset = logSize;
+    uint64_t snapshotId = lastId;
+
+    // finish times are only kept in the log
+    string out(SNAPSHOT_HEADER_SIZE, '\0');
+    for (size_t i = 0; i < board.players.size(); i++)
+    {
+        putRecord(out, board.players[i], 0);
+    }
+
+    // only the tries some game finished in
+    size_t slotsAt = out.size();
+    uint32_t slots = 0;
+    out.resize(slotsAt + 4);
+    for (size_t tries = 1; tries < byTries.size(); tries++)
+    {
+        if (byTries[tries] == 0)
+        {
+            continue;
+        }
+        uint32_t slotTries = tries;
+        out.append((const char *)&slotTries, 4);
+        out.append((const char *)&byTries[tries], 8);
+        slots++;
+    }
+    memcpy(&out[slotsAt], &slots, 4);
+
+    memcpy(&out[0], SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    memcpy(&out[12], &count, 4);
+    memcpy(&out[16], &logOffset, 8);
+    memcpy(&out[24], &snapshotId, 8);
+    uint32_t sum = checksum(&out[12], out.size() - 12);
+    memcpy(&out[8], &sum, 4);
+
+    // written aside and renamed over the old one, so a crash leaves
+    // either snapshot whole
+    string tmpPath = snapshotPath + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    bool ok = fd >= 0 && writeAll(fd, out.data(), out.size()) &&
+              fsync(fd) == 0;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (!ok || rename(tmpPath.c_str(), snapshotPath.c_str()) < 0)
+    {
+        printError("write", "leaderboard snapshot");
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    sinceSnapshot = 0;
+}
+
+// writer thread function
+void *GameJournal::writerMain(void *args)
+{
+    GameJournal *self = (GameJournal *)args;
+    string batch;
+
+    while (true)
+    {
+        while (sem_wait(&self->wake) < 0 && errno == EINTR)
+        {
+        }
+        self->wakePending.store(false);
+
+        // every game that finished since the last commit
+        pthread_mutex_lock(&self->lock);
+        batch.swap(self->pending);
+        pthread_mutex_unlock(&self->lock);
+        if (batch.empty())
+        {
+            continue;
+        }
+
+        if (!writeAll(self->logFd, batch.data(), batch.size()) ||
+            fdatasync(self->logFd) < 0)
+        {
+            // drop the batch rather than leave part of it behind
+            printError("write", "game log");
+            if (ftruncate(self->logFd, self->logSize) < 0)
+            {
+                printError("truncate", "game log");
+            }
+            self->handled.fetch_add(batch.size());
+            batch.clear();
+            continue;
+        }
+        metrics.count(JOURNAL_COMMITS);
+
+        self->logSize += batch.size();
+        self->replay(batch.data(), batch.size());
+
+        if (self->sinceSnapshot >= SNAPSHOT_EVERY)
+        {
+            self->writeSnapshot();
+        }
+        self->handled.fetch_add(batch.size());
+        batch.clear();
+    }
+
+    return NULL;
+}
@@ -0,0 +1,85 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Durable leaderboard journal
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "game.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Keeps every finished game on disk so the leaderboard survives a
+   restart.
+
+   Games are appended to games.log as compact checksummed records.
+   Sessions only copy their record into a shared buffer; a writer thread
+   takes whatever piled up, writes it with one write() and makes it
+   durable with one fdatasync(), so games finishing while a sync is in
+   progress share the next one. A crash loses at most the games of the
+   batch being written, and a record torn by the crash is cut off on
+   the next start.
+
+   Every SNAPSHOT_EVERY games the writer also saves the leaderboard and
+   the log offset it covers to leaderboard.snap. Starting up maps that
+   file and replays only the log written after it, so restart time does
+   not grow with the history. The snapshot also keeps how many games
+   finished in each number of tries, so global ranks survive too. */
+class GameJournal
+{
+public:
+    GameJournal();
+
+    // recover the leaderboard kept in dir and start the writer thread,
+    // false on failure; lastRecorded is the highest game id seen and
+    // finishedByTries[t] the games finished in t tries
+    bool start(const std::string &dir, leaderBoard &recovered,
+               unsigned long &lastRecorded,
+               std::vector<uint64_t> &finishedByTries);
+
+    // queue a finished game for the next commit, does nothing unless
+    // started
+    void append(const player &finished);
+
+    // wait until every game queued so far has been written, so another
+    // process may open the journal
+    void flush();
+
+private:
+    static void *writerMain(void *args);
+    uint64_t loadSnapshot();
+    bool openLog(uint64_t snapshotOffset);
+    size_t replay(const char *data, size_t length);
+    void countGames(uint32_t tries, uint64_t games);
+    void writeSnapshot();
+
+    std::string logPath;
+    std::string snapshotPath;
+    int logFd; // -1 until started
+
+    pthread_mutex_t lock;
+    std::string pending; // records waiting for the writer
+    uint64_t queued;     // bytes ever appended to pending
+    std::atomic<uint64_t> handled; // of those, written or dropped
+    sem_t wake;
+    std::atomic<bool> wakePending;
+
+    // writer only
+    leaderBoard board;    // leaderboard as of logSize
+    std::vector<uint64_t> byTries; // games per tries as of logSize
+    unsigned long lastId; // highest game id in the log
+    uint64_t logSize;     // bytes of complete records
+    size_t sinceSnapshot; // records after the last snapshot
+};
+
+extern GameJournal journal;
+
+#endif
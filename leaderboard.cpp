@@ -0,0 +1,343 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Contention-free leaderboard
+*/
+
+#include "leaderboard.h"
+#include "journal.h"
+#include "shared_board.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <iostream>
+
+using namespace std;
+
+Leaderboard leaderboard;
+
+// epoch a reader thread entered its read section in, 0 when outside
+struct ReaderSlot
+{
+    atomic<unsigned long> epoch;
+    atomic<bool> inUse;
+    ReaderSlot *next;
+};
+
+// every slot ever created, slots are reused but never freed
+static atomic<ReaderSlot *> readerSlots(NULL);
+
+// take a free slot or add a new one to the list
+static ReaderSlot *claimSlot()
+{
+    for (ReaderSlot *slot = readerSlots.load(); slot; slot = slot->next)
+    {
+        bool expected = false;
+        if (!slot->inUse.load(memory_order_relaxed) &&
+            slot->inUse.compare_exchange_strong(expected, true))
+        {
+            return slot;
+        }
+    }
+
+    ReaderSlot *slot = new ReaderSlot;
+    slot->epoch.store(0);
+    slot->inUse.store(true);
+    slot->next = readerSlots.load();
+    while (!readerSlots.compare_exchange_weak(slot->next, slot))
+    {
+    }
+    return slot;
+}
+
+// hands the slot back when its thread exits
+struct SlotOwner
+{
+    ReaderSlot *slot;
+
+    SlotOwner() : slot(claimSlot()) {}
+    ~SlotOwner() { slot->inUse.store(false); }
+};
+
+static ReaderSlot *threadSlot()
+{
+    static thread_local SlotOwner owner;
+    return owner.slot;
+}
+
+// true if board holds the game with this id
+static bool contains(const leaderBoard &board, unsigned long id)
+{
+    for (size_t i = 0; i < board.players.size(); i++)
+    {
+        if (board.players[i].id == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Leaderboard::Leaderboard()
+    : current(new BoardSnapshot), epoch(1), nextId(1), idStride(1),
+      head(&stub), tail(&stub), wakePending(false), forwardedGames(0),
+      mergedGames(0)
+{
+    stub.next.store(NULL);
+    sem_init(&wake, 0, 0);
+}
+
+void Leaderboard::restore(const leaderBoard &board, unsigned long lastId)
+{
+    current.load()->board = board;
+    nextId.store(lastId + 1);
+}
+
+void Leaderboard::setWorker(unsigned long index, unsigned long count)
+{
+    nextId.store(index + 1);
+    idStride = count;
+}
+
+bool Leaderboard::start()
+{
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, mergerMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating leaderboard merger thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+vector<player> Leaderboard::finish(const player &finished, bool keep)
+{
+    // top-K of the games finished on this thread
+    static thread_local leaderBoard shard;
+
+    player recorded = finished;
+    recorded.id = nextId.fetch_add(idStride, memory_order_relaxed);
+
+    // a game kept by another process is only shown to its player
+    bool forwarded = false;
+    if (keep)
+    {
+        journal.append(recorded);
+
+        // a game that is not in its own thread's top-K cannot be in the
+        // global one, so only the others are sent to the merger
+        updateBoard(shard, recorded);
+        forwarded = contains(shard, recorded.id);
+    }
+    if (forwarded)
+    {
+        Node *node = new Node;
+        node->finished = recorded;
+        forwardedGames.fetch_add(1);
+        push(node);
+
+        if (!wakePending.exchange(true))
+        {
+            sem_post(&wake);
+        }
+    }
+
+    // the board of every worker, or this process's if it stays locked
+    leaderBoard seen;
+    if (!sharedBoard.enabled() || !sharedBoard.read(seen))
+    {
+        BoardSnapshot *snapshot = acquire();
+        seen = snapshot->board;
+        release(snapshot);
+    }
+
+    // the merger may not have caught up with this game yet
+    if ((forwarded || !keep) && !contains(seen, recorded.id))
+    {
+        updateBoard(seen, recorded);
+    }
+
+    return seen.players;
+}
+
+void Leaderboard::sync()
+{
+    while (mergedGames.load() < forwardedGames.load())
+    {
+        usleep(1000);
+    }
+}
+
+BoardSnapshot *Leaderboard::acquire()
+{
+    ReaderSlot *slot = threadSlot();
+
+    // announce the read before loading the pointer so the merger waits
+    slot->epoch.store(epoch.load());
+    BoardSnapshot *snapshot = current.load();
+    snapshot->refs.fetch_add(1, memory_order_relaxed);
+    slot->epoch.store(0, memory_order_release);
+
+    return snapshot;
+}
+
+void Leaderboard::release(BoardSnapshot *snapshot)
+{
+    if (snapshot->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+    {
+        delete snapshot;
+    }
+}
+
+void Leaderboard::push(Node *node)
+{
+    node->next.store(NULL, memory_order_relaxed);
+    Node *prev = head.exchange(node, memory_order_acq_rel);
+    prev->next.store(node, memory_order_release);
+}
+
+// next forwarded game, NULL if there is none or a push is half done
+Leaderboard::Node *Leaderboard::pop()
+{
+    Node *first = tail;
+    Node *next = first->next.load(memory_order_acquire);
+
+    if (first == &stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        tail = next;
+        first = next;
+        next = next->next.load(memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        tail = next;
+        return first;
+    }
+
+    // a producer swapped head but has not linked its node yet
+    if (first != head.load(memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    push(&stub);
+    next = first->next.load(memory_order_acquire);
+    if (next != NULL)
+    {
+        tail = next;
+        return first;
+    }
+
+    return NULL;
+}
+
+void Leaderboard::publish(const leaderBoard &merged)
+{
+    BoardSnapshot *snapshot = new BoardSnapshot;
+    snapshot->board = merged;
+
+    BoardSnapshot *old = current.exchange(snapshot);
+
+    // readers that enter from now on can only see the new snapshot
+    Retired entry;
+    entry.snapshot = old;
+    entry.epoch = epoch.fetch_add(1) + 1;
+    retired.push_back(entry);
+}
+
+// drop the published reference of snapshots no reader can still reach
+void Leaderboard::reclaim()
+{
+    unsigned long oldest = ~0UL;
+    for (ReaderSlot *slot = readerSlots.load(); slot; slot = slot->next)
+    {
+        unsigned long readerEpoch = slot->epoch.load();
+        if (readerEpoch != 0 && readerEpoch < oldest)
+        {
+            oldest = readerEpoch;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++)
+    {
+        if (retired[i].epoch <= oldest)
+        {
+            release(retired[i].snapshot);
+        }
+        else
+        {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+// merger thread function
+void *Leaderboard::mergerMain(void *args)
+{
+    Leaderboard *board = (Leaderboard *)args;
+    leaderBoard merged = board->current.load()->board;
+
+    while (true)
+    {
+        board->wakePending.store(false);
+
+        bool changed = false;
+        unsigned long popped = 0;
+        Node *node;
+        while ((node = board->pop()) != NULL)
+        {
+            updateBoard(merged, node->finished);
+            changed = changed || contains(merged, node->finished.id);
+            delete node;
+            popped++;
+        }
+
+        if (changed)
+        {
+            board->publish(merged);
+        }
+        board->mergedGames.fetch_add(popped);
+
+        // a failed merge is retried with the whole top-K next time
+        if (changed && sharedBoard.enabled() &&
+            !sharedBoard.merge(merged.players))
+        {
+            printError("update", "shared leaderboard");
+        }
+        board->reclaim();
+
+        // poll again shortly while old snapshots are still pinned
+        if (board->retired.empty())
+        {
+            while (sem_wait(&board->wake) < 0 && errno == EINTR)
+            {
+            }
+        }
+        else
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 10 * 1000 * 1000;
+            if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            sem_timedwait(&board->wake, &deadline);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,111 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Contention-free leaderboard
+*/
+
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include "game.h"
+
+#include <semaphore.h>
+#include <atomic>
+#include <vector>
+
+// immutable leaderboard published by the merger thread
+struct BoardSnapshot
+{
+    leaderBoard board;
+    std::atomic<long> refs; // the published pointer holds one reference
+
+    BoardSnapshot() : refs(1) {}
+};
+
+/* Leaderboard that never makes a finishing game wait for another one.
+
+   Every thread keeps its own top-K shard and only forwards a finished
+   game to the merger when it enters that shard. Forwarding is a push on
+   a lock-free queue. The merger thread folds forwarded games into the
+   global top-K and publishes it as a new immutable snapshot.
+
+   Readers pin the current snapshot inside an epoch-based read section,
+   so the merger only drops its reference once no reader can still be
+   looking at the old pointer. Nothing on the read side takes a lock.
+
+   With worker processes the merger also folds its top-K into the
+   SharedBoard and finishing games read the global board from there. */
+class Leaderboard
+{
+public:
+    Leaderboard();
+
+    // start from a leaderboard recovered from disk, before start()
+    void restore(const leaderBoard &board, unsigned long lastId);
+
+    // number games as worker index of count, so ids from different
+    // worker processes never collide on the shared board
+    void setWorker(unsigned long index, unsigned long count);
+
+    // start the merger thread, false on failure
+    bool start();
+
+    // record a finished game, in the journal too, and return the
+    // leaderboard this player should see, which includes the game if it
+    // made the top-K; unless keep is set the game is only added to the
+    // returned board, for a game another process records
+    std::vector<player> finish(const player &finished, bool keep = true);
+
+    // wait until every game recorded so far is on the published board
+    void sync();
+
+    // highest game id handed out so far
+    unsigned long lastRecorded() const { return nextId.load() - idStride; }
+
+    // pin the latest snapshot, never blocks
+    BoardSnapshot *acquire();
+
+    // drop a reference taken by acquire()
+    static void release(BoardSnapshot *snapshot);
+
+private:
+    // forwarded game on the merger queue
+    struct Node
+    {
+        std::atomic<Node *> next;
+        player finished;
+    };
+
+    // snapshot waiting for its grace period
+    struct Retired
+    {
+        BoardSnapshot *snapshot;
+        unsigned long epoch;
+    };
+
+    static void *mergerMain(void *args);
+    void push(Node *node);
+    Node *pop();
+    void publish(const leaderBoard &merged);
+    void reclaim();
+
+    std::atomic<BoardSnapshot *> current;
+    std::atomic<unsigned long> epoch;
+    std::atomic<unsigned long> nextId;
+    unsigned long idStride; // worker processes
+
+    // intrusive multi-producer single-consumer queue
+    alignas(64) std::atomic<Node *> head; // producers
+    alignas(64) Node *tail;              // merger only
+    Node stub;
+
+    sem_t wake;
+    std::atomic<bool> wakePending;
+    std::atomic<unsigned long> forwardedGames; // pushed to the merger
+    std::atomic<unsigned long> mergedGames;    // of those, published
+    std::vector<Retired> retired; // merger only
+};
+
+extern Leaderboard leaderboard;
+
+#endif
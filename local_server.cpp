@@ -0,0 +1,200 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Unix domain socket and shared memory ring sessions
+*/
+
+#include "local_server.h"
+#include "game.h"
+#include "session.h"
+#include "reaper.h"
+#include "admission.h"
+#include "metrics.h"
+#include "blocking_io.h"
+#include "shm_ring.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+// send everything the session queued, false on error
+template <typename Stream>
+static bool flushLocal(Stream &stream, Session &session)
+{
+    while (session.pendingLength() > 0)
+    {
+        ssize_t bytesSent = writeStream(stream, session.pendingData(),
+                                        session.pendingLength());
+        if (bytesSent <= 0)
+        {
+            return false;
+        }
+        session.consumed(bytesSent);
+    }
+
+    return true;
+}
+
+// run the session until it ends or fails, over the socket or the rings
+template <typename Stream>
+static void playLocal(Stream &stream, Session &session, ReapEntry &entry)
+{
+    while (true)
+    {
+        reaper.arm(&entry, session.deadline());
+
+        if (!flushLocal(stream, session))
+        {
+            printError("send", session.sending());
+            return;
+        }
+
+        if (session.done())
+        {
+            return;
+        }
+
+        size_t room;
+        char *space = session.inputSpace(room);
+        ssize_t bytesRecv = room == 0 ? -1 : readStream(stream, space, room);
+        if (bytesRecv <= 0 || !session.onReceived(bytesRecv))
+        {
+            printError("receive", session.receiving());
+            return;
+        }
+    }
+}
+
+// the client's answer to the welcome message, which attaches ring if it
+// offers one; false if the session is over
+static bool receiveFirst(int clientSock, Session &session, ShmChannel &ring,
+                         bool &useRing)
+{
+    useRing = false;
+
+    size_t room;
+    char *space = session.inputSpace(room);
+    int memfd = -1;
+    ssize_t bytesRecv =
+        room == 0 ? -1 : receiveOffer(clientSock, space, room, memfd);
+    if (memfd < 0)
+    {
+        return bytesRecv > 0 && session.onReceived(bytesRecv);
+    }
+
+    // the magic comes alone with the memfd and never reaches the session
+    if (bytesRecv != (ssize_t)V1_INT_SIZE ||
+        getV1Int(space) != PROTOCOL_RING_MAGIC)
+    {
+        close(memfd);
+        return false;
+    }
+    if (!ring.attach(clientSock, memfd))
+    {
+        return false;
+    }
+
+    metrics.count(RING_SESSIONS);
+    useRing = true;
+    return true;
+}
+
+// play one local client
+static void playLocalGame(int clientSock)
+{
+    Session session;
+    ReapEntry entry(clientSock);
+    ShmChannel ring;
+    bool useRing;
+
+    // nothing here would flush what a room queues for the session
+    session.stayOutOfRooms();
+
+    // the welcome message always goes over the socket
+    session.start();
+    reaper.arm(&entry, session.deadline());
+    if (!flushLocal(clientSock, session))
+    {
+        printError("send", session.sending());
+    }
+    else if (!receiveFirst(clientSock, session, ring, useRing))
+    {
+        printError("receive", session.receiving());
+    }
+    else if (useRing)
+    {
+        playLocal(ring, session, entry);
+    }
+    else
+    {
+        playLocal(clientSock, session, entry);
+    }
+
+    // tell a ring client before the socket goes
+    ring.close();
+    reaper.cancel(&entry);
+    admission.release();
+}
+
+// local session thread function
+static void *localSessionMain(void *args)
+{
+    int clientSock = (int)(long)args;
+
+    playLocalGame(clientSock);
+    close(clientSock);
+
+    return NULL;
+}
+
+// local accept thread function
+static void *localAcceptMain(void *args)
+{
+    int listenSock = (int)(long)args;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (true)
+    {
+        // stops when the server hands off to a new process
+        int clientSock = admission.acceptSession(listenSock);
+        if (clientSock < 0)
+        {
+            break;
+        }
+
+        pthread_t threadID;
+        if (pthread_create(&threadID, &attr, localSessionMain,
+                           (void *)(long)clientSock) != 0)
+        {
+            // turn this client away and let running sessions finish
+            printError("create", "local session thread");
+            close(clientSock);
+            admission.release();
+            usleep(10 * 1000);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
+
+bool startLocalServer(int listenSock)
+{
+    pthread_t threadID;
+    if (pthread_create(&threadID, NULL, localAcceptMain,
+                       (void *)(long)listenSock) != 0)
+    {
+        cerr << "Error creating local accept thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
@@ -0,0 +1,23 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Unix domain socket and shared memory ring sessions
+*/
+
+#ifndef LOCAL_SERVER_H
+#define LOCAL_SERVER_H
+
+/* Serve clients running on the same host from a Unix domain socket, next
+   to the TCP port whatever the mode. Every local connection gets its own
+   session thread, with the same admission limit and reaper deadlines as
+   thread mode, and never joins a room.
+
+   After the welcome message a local client may offer shared memory
+   rings in place of its username length (PROTOCOL_RING_MAGIC with a
+   memfd, see shm_ring.h). The rest of its session then goes through the
+   rings and never touches the socket again.
+
+   Starts the thread accepting from listenSock, false on failure. */
+bool startLocalServer(int listenSock);
+
+#endif
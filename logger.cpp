@@ -0,0 +1,386 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Asynchronous server log
+*/
+
+#include "logger.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+using namespace std;
+
+Logger logger;
+
+enum LogEvent
+{
+    EVENT_FAILURE,
+    EVENT_TREASURE,
+    EVENT_GUESS
+};
+
+const size_t LOG_ACTION_SIZE = 16;
+const size_t LOG_OBJECT_SIZE = 48;
+
+// records one thread can have waiting, a power of two
+const size_t LOG_RING_SIZE = 128;
+
+// same failure printed per REPEAT_WINDOW before the rest are only counted
+const int REPEAT_LIMIT = 10;
+const uint64_t REPEAT_WINDOW = 1000000000; // ns
+
+// how long the writer sleeps when nobody wakes it
+const long WRITER_POLL_NS = 20 * 1000 * 1000;
+
+// one line of output, formatted by the writer thread
+struct LogRecord
+{
+    LogEvent event;
+    LogLevel level;
+    long x;
+    long y;
+    double distance;
+    char action[LOG_ACTION_SIZE]; // truncated, always terminated
+    char object[LOG_OBJECT_SIZE];
+};
+
+// ring of one thread, written by that thread and read by the writer
+struct LogSlot
+{
+    LogRecord ring[LOG_RING_SIZE];
+    alignas(64) atomic<size_t> head; // owner only
+    alignas(64) atomic<size_t> tail; // writer only
+    atomic<uint64_t> dropped;        // owner only
+    uint64_t droppedSeen;            // writer only
+    atomic<bool> inUse;
+    LogSlot *next;
+};
+
+// every slot ever created, slots are reused but never freed
+static atomic<LogSlot *> logSlots(NULL);
+
+// take a free slot or add a new one to the list
+static LogSlot *claimSlot()
+{
+    for (LogSlot *slot = logSlots.load(); slot; slot = slot->next)
+    {
+        bool expected = false;
+        if (!slot->inUse.load(memory_order_relaxed) &&
+            slot->inUse.compare_exchange_strong(expected, true))
+        {
+            return slot;
+        }
+    }
+
+    // value initialized, the ring starts empty
+    LogSlot *slot = new LogSlot();
+    slot->inUse.store(true);
+    slot->next = logSlots.load();
+    while (!logSlots.compare_exchange_weak(slot->next, slot))
+    {
+    }
+    return slot;
+}
+
+// hands the slot back when its thread exits, the writer still drains it
+struct LogSlotOwner
+{
+    LogSlot *slot;
+
+    LogSlotOwner() : slot(claimSlot()) {}
+    ~LogSlotOwner() { slot->inUse.store(false); }
+};
+
+static LogSlot *threadSlot()
+{
+    static thread_local LogSlotOwner owner;
+    return owner.slot;
+}
+
+static void copyText(char *dest, size_t size, const string &text)
+{
+    size_t length = min(text.size(), size - 1);
+    memcpy(dest, text.data(), length);
+    dest[length] = '\0';
+}
+
+Logger::Logger() : maxLevel(LOG_INFO), wakePending(false)
+{
+    sem_init(&wake, 0, 0);
+}
+
+bool Logger::start(LogLevel level)
+{
+    maxLevel.store(level);
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, writerMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating log writer thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+bool Logger::parseLevel(const string &name, LogLevel &level)
+{
+    static const char *names[] = {"error", "warn", "info", "debug"};
+
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++)
+    {
+        if (name == names[i])
+        {
+            level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::failure(const string &action, const string &object)
+{
+    if (!enabled(LOG_ERROR))
+    {
+        return;
+    }
+
+    LogRecord record;
+    record.event = EVENT_FAILURE;
+    record.level = LOG_ERROR;
+    copyText(record.action, sizeof(record.action), action);
+    copyText(record.object, sizeof(record.object), object);
+    push(record);
+}
+
+void Logger::treasure(long x, long y)
+{
+    if (!enabled(LOG_INFO))
+    {
+        return;
+    }
+
+    LogRecord record;
+    record.event = EVENT_TREASURE;
+    record.level = LOG_INFO;
+    record.x = x;
+    record.y = y;
+    push(record);
+}
+
+void Logger::guess(long x, long y, double distance)
+{
+    if (!enabled(LOG_DEBUG))
+    {
+        return;
+    }
+
+    LogRecord record;
+    record.event = EVENT_GUESS;
+    record.level = LOG_DEBUG;
+    record.x = x;
+    record.y = y;
+    record.distance = distance;
+    push(record);
+}
+
+// copy the record into this thread's ring, never waits for the writer
+void Logger::push(const LogRecord &record)
+{
+    LogSlot *slot = threadSlot();
+    size_t head = slot->head.load(memory_order_relaxed);
+    size_t tail = slot->tail.load(memory_order_acquire);
+
+    if (head - tail == LOG_RING_SIZE)
+    {
+        slot->dropped.store(slot->dropped.load(memory_order_relaxed) + 1,
+                            memory_order_relaxed);
+        metrics.count(LOG_RECORDS_DROPPED);
+        wakeWriter();
+        return;
+    }
+
+    slot->ring[head % LOG_RING_SIZE] = record;
+    slot->head.store(head + 1, memory_order_release);
+
+    // the writer polls anyway, only hurry it when the ring fills up
+    if (head + 1 - tail >= LOG_RING_SIZE / 2)
+    {
+        wakeWriter();
+    }
+}
+
+void Logger::wakeWriter()
+{
+    if (!wakePending.exchange(true))
+    {
+        sem_post(&wake);
+    }
+}
+
+// failures seen in the current window for one message
+struct Repeat
+{
+    uint64_t windowStart;
+    int printed;
+    uint64_t suppressed;
+};
+
+static void noteSuppressed(string &batch, const string &message,
+                           const Repeat &repeat)
+{
+    if (repeat.suppressed > 0 && logger.enabled(LOG_WARN))
+    {
+        batch += message + " (repeated " + to_string(repeat.suppressed) +
+                 " more times)\n";
+    }
+}
+
+// append record to batch, failures past the repeat limit are only counted
+static void format(string &batch, const LogRecord &record,
+                   map<string, Repeat> &repeats, uint64_t now)
+{
+    char line[128];
+
+    if (record.event == EVENT_TREASURE)
+    {
+        snprintf(line, sizeof(line), "Tresure is located at (%ld, %ld)\n",
+                 record.x, record.y);
+        batch += line;
+        return;
+    }
+
+    if (record.event == EVENT_GUESS)
+    {
+        snprintf(line, sizeof(line), "Guess (%ld, %ld) is %.2f ft away\n",
+                 record.x, record.y, record.distance);
+        batch += line;
+        return;
+    }
+
+    string message = string("Failure to ") + record.action + " " +
+                     record.object;
+
+    map<string, Repeat>::iterator it = repeats.find(message);
+    if (it == repeats.end())
+    {
+        Repeat repeat = {now, 0, 0};
+        it = repeats.insert(make_pair(message, repeat)).first;
+    }
+
+    Repeat &repeat = it->second;
+    if (repeat.printed < REPEAT_LIMIT)
+    {
+        batch += message + "\n";
+        repeat.printed++;
+    }
+    else
+    {
+        repeat.suppressed++;
+    }
+}
+
+// write the whole batch to standard output
+static void writeBatch(const string &batch)
+{
+    const char *bp = batch.data();
+    size_t bytesLeft = batch.size();
+
+    while (bytesLeft > 0)
+    {
+        ssize_t bytesWritten = write(STDOUT_FILENO, bp, bytesLeft);
+        if (bytesWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        bp += bytesWritten;
+        bytesLeft -= bytesWritten;
+    }
+}
+
+// log writer thread function
+void *Logger::writerMain(void *args)
+{
+    Logger *log = (Logger *)args;
+    map<string, Repeat> repeats;
+    string batch;
+
+    while (true)
+    {
+        log->wakePending.store(false);
+        uint64_t now = metricsClock();
+        uint64_t dropped = 0;
+
+        for (LogSlot *slot = logSlots.load(); slot; slot = slot->next)
+        {
+            size_t tail = slot->tail.load(memory_order_relaxed);
+            size_t head = slot->head.load(memory_order_acquire);
+
+            for (; tail != head; tail++)
+            {
+                const LogRecord &record = slot->ring[tail % LOG_RING_SIZE];
+                if (log->enabled(record.level))
+                {
+                    format(batch, record, repeats, now);
+                }
+            }
+            slot->tail.store(tail, memory_order_release);
+
+            uint64_t slotDropped = slot->dropped.load(memory_order_relaxed);
+            dropped += slotDropped - slot->droppedSeen;
+            slot->droppedSeen = slotDropped;
+        }
+
+        if (dropped > 0 && log->enabled(LOG_WARN))
+        {
+            batch += to_string(dropped) + " log records dropped\n";
+        }
+
+        // summarize and forget failures whose window is over
+        map<string, Repeat>::iterator it = repeats.begin();
+        while (it != repeats.end())
+        {
+            if (now - it->second.windowStart >= REPEAT_WINDOW)
+            {
+                noteSuppressed(batch, it->first, it->second);
+                repeats.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        if (!batch.empty())
+        {
+            writeBatch(batch);
+            batch.clear();
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITER_POLL_NS;
+        if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000 * 1000 * 1000;
+        }
+        sem_timedwait(&log->wake, &deadline);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,64 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Asynchronous server log
+*/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <semaphore.h>
+#include <atomic>
+#include <string>
+
+struct LogRecord;
+
+enum LogLevel
+{
+    LOG_ERROR, // failures reported by printError()
+    LOG_WARN,  // dropped and suppressed records
+    LOG_INFO,  // treasure locations
+    LOG_DEBUG  // every guess
+};
+
+/* Server console output that never blocks a session.
+
+   A session thread copies a small fixed-size record into its own
+   single-producer ring and moves on. A background thread drains every
+   ring, formats the records and writes them out in batches with one
+   write() each. When a ring is full the record is dropped and counted
+   rather than waiting for the writer. The same failure repeated more
+   than a few times a second is only counted, then summarized. */
+class Logger
+{
+public:
+    Logger();
+
+    // start the writer thread, false on failure
+    bool start(LogLevel level);
+
+    // level parsed from a --log-level name, false if unknown
+    static bool parseLevel(const std::string &name, LogLevel &level);
+
+    bool enabled(LogLevel level) const
+    {
+        return level <= maxLevel.load(std::memory_order_relaxed);
+    }
+
+    void failure(const std::string &action, const std::string &object);
+    void treasure(long x, long y);
+    void guess(long x, long y, double distance);
+
+private:
+    static void *writerMain(void *args);
+    void push(const LogRecord &record);
+    void wakeWriter();
+
+    std::atomic<int> maxLevel;
+    sem_t wake;
+    std::atomic<bool> wakePending;
+};
+
+extern Logger logger;
+
+#endif
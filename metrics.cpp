@@ -0,0 +1,405 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Server metrics and admin endpoint
+*/
+
+#include "metrics.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+Metrics metrics;
+
+// different printError() action and object pairs one thread keeps apart,
+// the last one also counts any pair beyond that
+const int MAX_ERROR_KINDS = 32;
+
+// longest an admin client may take to send its request or read the page
+// before the admin thread moves on to the next one
+const time_t ADMIN_TIMEOUT_SECONDS = 2;
+
+// histogram one thread records into while render() reads it
+struct LiveHistogram
+{
+    atomic<uint64_t> counts[Histogram::BUCKETS];
+    atomic<uint64_t> sum;
+    atomic<uint64_t> max;
+};
+
+struct ErrorCount
+{
+    string action; // written once before the entry is published
+    string object;
+    atomic<uint64_t> count;
+};
+
+// metrics of one thread
+struct MetricsSlot
+{
+    atomic<uint64_t> counters[COUNTER_COUNT];
+    LiveHistogram timers[TIMER_COUNT];
+    ErrorCount errors[MAX_ERROR_KINDS];
+    atomic<int> errorKinds; // published entries of errors
+    atomic<bool> inUse;
+    MetricsSlot *next;
+};
+
+// every slot ever created, slots are reused but never freed
+static atomic<MetricsSlot *> metricsSlots(NULL);
+
+// take a free slot or add a new one to the list
+static MetricsSlot *claimSlot()
+{
+    for (MetricsSlot *slot = metricsSlots.load(); slot; slot = slot->next)
+    {
+        bool expected = false;
+        if (!slot->inUse.load(memory_order_relaxed) &&
+            slot->inUse.compare_exchange_strong(expected, true))
+        {
+            return slot;
+        }
+    }
+
+    // value initialized, every count starts at 0
+    MetricsSlot *slot = new MetricsSlot();
+    slot->inUse.store(true);
+    slot->next = metricsSlots.load();
+    while (!metricsSlots.compare_exchange_weak(slot->next, slot))
+    {
+    }
+    return slot;
+}
+
+// hands the slot back when its thread exits, its counts stay in it
+struct MetricsSlotOwner
+{
+    MetricsSlot *slot;
+
+    MetricsSlotOwner() : slot(claimSlot()) {}
+    ~MetricsSlotOwner() { slot->inUse.store(false); }
+};
+
+static MetricsSlot *threadSlot()
+{
+    static thread_local MetricsSlotOwner owner;
+    return owner.slot;
+}
+
+// only the owning thread writes, so no read-modify-write is needed
+static void add(atomic<uint64_t> &value, uint64_t n)
+{
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void Metrics::count(Counter counter, uint64_t n)
+{
+    add(threadSlot()->counters[counter], n);
+}
+
+void Metrics::record(Timer timer, uint64_t nanoseconds)
+{
+    LiveHistogram &histogram = threadSlot()->timers[timer];
+
+    add(histogram.counts[Histogram::bucketOf(nanoseconds)], 1);
+    add(histogram.sum, nanoseconds);
+    if (nanoseconds > histogram.max.load(memory_order_relaxed))
+    {
+        histogram.max.store(nanoseconds, memory_order_relaxed);
+    }
+}
+
+void Metrics::error(const string &action, const string &object)
+{
+    MetricsSlot *slot = threadSlot();
+    int kinds = slot->errorKinds.load(memory_order_relaxed);
+
+    for (int i = 0; i < kinds; i++)
+    {
+        if (slot->errors[i].action == action &&
+            slot->errors[i].object == object)
+        {
+            add(slot->errors[i].count, 1);
+            return;
+        }
+    }
+
+    if (kinds == MAX_ERROR_KINDS)
+    {
+        add(slot->errors[kinds - 1].count, 1);
+        return;
+    }
+
+    // publish the new entry once its names are written
+    ErrorCount &entry = slot->errors[kinds];
+    entry.action = action;
+    entry.object = object;
+    add(entry.count, 1);
+    slot->errorKinds.store(kinds + 1, memory_order_release);
+}
+
+// label value with quotes and backslashes escaped
+static string labelValue(const string &value)
+{
+    string escaped;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '"' || value[i] == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += value[i] == '\n' ? ' ' : value[i];
+    }
+    return escaped;
+}
+
+static void putHeader(ostringstream &page, const char *name, const char *type,
+                      const char *help)
+{
+    page << "# HELP " << name << " " << help << "\n";
+    page << "# TYPE " << name << " " << type << "\n";
+}
+
+static void putCounter(ostringstream &page, const char *name,
+                       const char *help, uint64_t value)
+{
+    putHeader(page, name, "counter", help);
+    page << name << " " << value << "\n";
+}
+
+// latency histogram as a summary in seconds
+static void putSummary(ostringstream &page, const char *name,
+                       const char *help, const Histogram &histogram)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    putHeader(page, name, "summary", help);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    {
+        page << name << "{quantile=\"" << quantiles[i] << "\"} "
+             << histogram.percentile(quantiles[i]) / 1e9 << "\n";
+    }
+    page << name << "_sum " << histogram.sumValues() / 1e9 << "\n";
+    page << name << "_count " << histogram.count() << "\n";
+}
+
+string Metrics::render()
+{
+    uint64_t counters[COUNTER_COUNT] = {0};
+    vector<Histogram> timers(TIMER_COUNT);
+    map<pair<string, string>, uint64_t> errors;
+
+    for (MetricsSlot *slot = metricsSlots.load(); slot; slot = slot->next)
+    {
+        for (int i = 0; i < COUNTER_COUNT; i++)
+        {
+            counters[i] += slot->counters[i].load(memory_order_relaxed);
+        }
+
+        for (int i = 0; i < TIMER_COUNT; i++)
+        {
+            LiveHistogram &live = slot->timers[i];
+            for (int bucket = 0; bucket < Histogram::BUCKETS; bucket++)
+            {
+                uint64_t n = live.counts[bucket].load(memory_order_relaxed);
+                if (n != 0)
+                {
+                    timers[i].addBucket(bucket, n);
+                }
+            }
+            timers[i].addTotals(live.sum.load(memory_order_relaxed),
+                                live.max.load(memory_order_relaxed));
+        }
+
+        int kinds = slot->errorKinds.load(memory_order_acquire);
+        for (int i = 0; i < kinds; i++)
+        {
+            ErrorCount &entry = slot->errors[i];
+            errors[make_pair(entry.action, entry.object)] +=
+                entry.count.load(memory_order_relaxed);
+        }
+    }
+
+    ostringstream page;
+    putCounter(page, "treasure_connections_accepted_total",
+               "Connections accepted.", counters[CONNECTIONS_ACCEPTED]);
+    putCounter(page, "treasure_connections_rejected_total",
+               "Connections turned away by the session limit.",
+               counters[CONNECTIONS_REJECTED]);
+    putCounter(page, "treasure_connections_shed_total",
+               "Connections closed at once because descriptors ran out.",
+               counters[CONNECTIONS_SHED]);
+    putCounter(page, "treasure_sessions_total", "Sessions started.",
+               counters[SESSIONS_STARTED]);
+
+    // slots are read one after the other, never report a negative count
+    uint64_t active = 0;
+    if (counters[SESSIONS_STARTED] > counters[SESSIONS_CLOSED])
+    {
+        active = counters[SESSIONS_STARTED] - counters[SESSIONS_CLOSED];
+    }
+    putHeader(page, "treasure_sessions_active", "gauge",
+              "Sessions currently open.");
+    page << "treasure_sessions_active " << active << "\n";
+
+    putCounter(page, "treasure_sessions_expired_total",
+               "Sessions closed for missing a deadline.",
+               counters[SESSIONS_EXPIRED]);
+    putCounter(page, "treasure_games_finished_total",
+               "Games that found the treasure.", counters[GAMES_FINISHED]);
+    putCounter(page, "treasure_turns_total", "Guesses answered.",
+               counters[TURNS]);
+    putCounter(page, "treasure_received_bytes_total",
+               "Bytes received from clients.", counters[BYTES_RECEIVED]);
+    putCounter(page, "treasure_sent_bytes_total", "Bytes sent to clients.",
+               counters[BYTES_SENT]);
+    putCounter(page, "treasure_log_dropped_total",
+               "Log records dropped because the log ring was full.",
+               counters[LOG_RECORDS_DROPPED]);
+    putCounter(page, "treasure_journal_commits_total",
+               "Batches of finished games written and synced to the game "
+               "log.",
+               counters[JOURNAL_COMMITS]);
+    putCounter(page, "treasure_room_broadcasts_total",
+               "Room frames encoded once and queued on every member.",
+               counters[BROADCASTS]);
+    putCounter(page, "treasure_ring_sessions_total",
+               "Local sessions played over shared memory rings.",
+               counters[RING_SESSIONS]);
+    putCounter(page, "treasure_sessions_handed_off_total",
+               "Sessions passed to a new server process.",
+               counters[SESSIONS_HANDED_OFF]);
+    putCounter(page, "treasure_trace_chunks_total",
+               "Chunks of session traffic queued for the trace.",
+               counters[TRACE_CHUNKS_QUEUED]);
+    putCounter(page, "treasure_trace_dropped_total",
+               "Chunks of session traffic dropped because the trace "
+               "writer fell behind.",
+               counters[TRACE_CHUNKS_DROPPED]);
+
+    putHeader(page, "treasure_errors_total", "counter",
+              "Failures by action and what was being sent or received.");
+    map<pair<string, string>, uint64_t>::iterator it;
+    for (it = errors.begin(); it != errors.end(); ++it)
+    {
+        page << "treasure_errors_total{action=\""
+             << labelValue(it->first.first) << "\",stage=\""
+             << labelValue(it->first.second) << "\"} " << it->second << "\n";
+    }
+
+    putSummary(page, "treasure_turn_seconds",
+               "Time from parsing a guess to its reply being queued.",
+               timers[TURN_TIME]);
+    putSummary(page, "treasure_leaderboard_wait_seconds",
+               "Time spent recording a finished game on the leaderboard.",
+               timers[LEADERBOARD_WAIT]);
+
+    return page.str();
+}
+
+bool Metrics::start(unsigned short port, bool shared)
+{
+    adminSock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (adminSock < 0)
+    {
+        cerr << "Error creating admin socket" << endl;
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(adminSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (shared)
+    {
+        setsockopt(adminSock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+
+    // never reachable from other hosts
+    struct sockaddr_in adminAddr;
+    memset(&adminAddr, 0, sizeof(adminAddr));
+    adminAddr.sin_family = AF_INET;
+    adminAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    adminAddr.sin_port = htons(port);
+
+    if (bind(adminSock, (struct sockaddr *)&adminAddr, sizeof(adminAddr)) < 0 ||
+        listen(adminSock, 16) < 0)
+    {
+        cerr << "Error binding admin port " << port << endl;
+        close(adminSock);
+        return false;
+    }
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, adminMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating admin thread" << endl;
+        close(adminSock);
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+// answer every request on the admin port with the metrics page
+void *Metrics::adminMain(void *args)
+{
+    Metrics *self = (Metrics *)args;
+
+    while (true)
+    {
+        int clientSock = accept(self->adminSock, NULL, NULL);
+        if (clientSock < 0)
+        {
+            continue;
+        }
+
+        // one silent or stuck client must not hold up every later scrape
+        struct timeval timeout;
+        timeout.tv_sec = ADMIN_TIMEOUT_SECONDS;
+        timeout.tv_usec = 0;
+        setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+        setsockopt(clientSock, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                   sizeof(timeout));
+
+        // whatever was asked for, the request itself is not needed
+        char request[4096];
+        recv(clientSock, request, sizeof(request), 0);
+
+        string body = self->render();
+        string response = "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: " +
+                          to_string(body.size()) + "\r\n\r\n" + body;
+
+        const char *bp = response.data();
+        size_t bytesLeft = response.size();
+        while (bytesLeft > 0)
+        {
+            ssize_t bytesSent = send(clientSock, bp, bytesLeft, MSG_NOSIGNAL);
+            if (bytesSent <= 0)
+            {
+                break;
+            }
+            bp += bytesSent;
+            bytesLeft -= bytesSent;
+        }
+
+        close(clientSock);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,88 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Server metrics and admin endpoint
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// monotonically increasing counts
+enum Counter
+{
+    CONNECTIONS_ACCEPTED,
+    CONNECTIONS_REJECTED, // over the session limit
+    CONNECTIONS_SHED,     // closed at once for lack of descriptors
+    SESSIONS_STARTED,
+    SESSIONS_CLOSED,
+    GAMES_FINISHED,
+    TURNS,
+    BYTES_RECEIVED,
+    BYTES_SENT,
+    LOG_RECORDS_DROPPED,
+    SESSIONS_EXPIRED,
+    JOURNAL_COMMITS, // batches of games made durable
+    BROADCASTS,      // room frames encoded once for every member
+    RING_SESSIONS,   // local sessions moved onto shared memory rings
+    SESSIONS_HANDED_OFF, // passed to a new server process
+    TRACE_CHUNKS_QUEUED,  // session traffic chunks for the --record file
+    TRACE_CHUNKS_DROPPED, // chunks dropped with the trace writer behind
+    COUNTER_COUNT
+};
+
+// durations in nanoseconds
+enum Timer
+{
+    TURN_TIME,        // parsing a guess up to its reply being queued
+    LEADERBOARD_WAIT, // recording a finished game on the leaderboard
+    TIMER_COUNT
+};
+
+// current time for Timer measurements
+inline uint64_t metricsClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Counters and latency histograms of the whole server.
+
+   Every thread updates its own slot with plain relaxed stores, so the
+   session path never locks, never shares a cache line with another
+   thread and never does an atomic read-modify-write. Slots are reused
+   by later threads but never freed, which lets render() walk them while
+   they are being updated and sum them into one Prometheus text page.
+   The page is served on a port bound to localhost only. */
+class Metrics
+{
+public:
+    // serve the metrics on 127.0.0.1:port, false on failure; shared
+    // lets the next server process bind the port during a handoff
+    bool start(unsigned short port, bool shared = false);
+
+    void count(Counter counter, uint64_t n = 1);
+    void record(Timer timer, uint64_t nanoseconds);
+
+    // failure reported by printError(), counted by action and object
+    void error(const std::string &action, const std::string &object);
+
+    // every metric in Prometheus text format
+    std::string render();
+
+private:
+    static void *adminMain(void *args);
+
+    int adminSock;
+};
+
+extern Metrics metrics;
+
+#endif
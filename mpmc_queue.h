@@ -0,0 +1,129 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Bounded lock-free multi-producer multi-consumer queue
+*/
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/* Fixed size ring where every slot carries a sequence number, so
+   producers and consumers only race on one atomic index each and never
+   take a lock. tryPush() and tryPop() fail instead of waiting. */
+template <typename T>
+class MpmcQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit MpmcQueue(size_t capacity)
+        : cells(roundUp(capacity)), mask(cells.size() - 1), head(0), tail(0)
+    {
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return cells.size(); }
+
+    // rough number of queued items, exact when nobody is pushing or popping
+    size_t size() const
+    {
+        size_t pushed = tail.load(std::memory_order_relaxed);
+        size_t popped = head.load(std::memory_order_relaxed);
+        return pushed > popped ? pushed - popped : 0;
+    }
+
+    // false if the queue is full
+    bool tryPush(const T &value)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long)sequence - (long)pos;
+
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // slot still holds an item from the previous lap
+                return false;
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // false if the queue is empty
+    bool tryPop(T &value)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long)sequence - (long)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // nothing pushed in this slot yet
+                return false;
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUp(size_t value)
+    {
+        size_t result = 2;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    std::vector<Cell> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head; // next slot to pop
+    alignas(64) std::atomic<size_t> tail; // next slot to push
+};
+
+#endif
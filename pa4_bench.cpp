@@ -0,0 +1,520 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Microbenchmarks
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "game.h"
+#include "distance.h"
+#include "session.h"
+#include "leaderboard.h"
+#include "rank_index.h"
+#include "logger.h"
+#include "protocol.h"
+#include "frame_reader.h"
+#include "blocking_io.h"
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS ""
+#endif
+
+using namespace std;
+
+/* Times the functions every turn goes through and reports, per
+   operation, the time taken, the heap allocations made and the socket
+   syscalls made. Allocations are counted by replacing operator new;
+   syscalls by the linker wrapping send, recv, sendmsg and recvmsg (see
+   BENCH_WRAP in the Makefile), so futex waits inside the leaderboard
+   are not included. */
+
+// counted by every thread
+static atomic<long> allocations(0);
+static atomic<long> syscalls(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+extern "C"
+{
+ssize_t __real_send(int sock, const void *buf, size_t len, int flags);
+ssize_t __real_recv(int sock, void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int sock, const struct msghdr *msg, int flags);
+ssize_t __real_recvmsg(int sock, struct msghdr *msg, int flags);
+
+ssize_t __wrap_send(int sock, const void *buf, size_t len, int flags)
+{
+    syscalls.fetch_add(1, memory_order_relaxed);
+    return __real_send(sock, buf, len, flags);
+}
+
+ssize_t __wrap_recv(int sock, void *buf, size_t len, int flags)
+{
+    syscalls.fetch_add(1, memory_order_relaxed);
+    return __real_recv(sock, buf, len, flags);
+}
+
+ssize_t __wrap_sendmsg(int sock, const struct msghdr *msg, int flags)
+{
+    syscalls.fetch_add(1, memory_order_relaxed);
+    return __real_sendmsg(sock, msg, flags);
+}
+
+ssize_t __wrap_recvmsg(int sock, struct msghdr *msg, int flags)
+{
+    syscalls.fetch_add(1, memory_order_relaxed);
+    return __real_recvmsg(sock, msg, flags);
+}
+}
+
+// everything main() reads from the command line
+struct BenchConfig
+{
+    long iterations; // operations per benchmark, socket ones run a tenth
+    int threads;     // concurrent finishers for the leaderboard
+    string output;   // JSON results
+};
+
+struct BenchResult
+{
+    string name;
+    long iterations;
+    double nsPerOp;
+    double allocsPerOp;
+    double syscallsPerOp;
+};
+
+// keeps the compiler from dropping the measured work
+static volatile double sink;
+
+// monotonic clock in nanoseconds
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// run body once untimed to warm caches and pools, then measure it
+template <typename Body>
+static BenchResult measure(const string &name, long iterations, Body body)
+{
+    body(iterations / 10 + 1);
+
+    long allocsBefore = allocations.load();
+    long syscallsBefore = syscalls.load();
+    uint64_t start = nowNs();
+
+    body(iterations);
+
+    uint64_t elapsed = nowNs() - start;
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = (double)elapsed / iterations;
+    result.allocsPerOp =
+        (double)(allocations.load() - allocsBefore) / iterations;
+    result.syscallsPerOp =
+        (double)(syscalls.load() - syscallsBefore) / iterations;
+    return result;
+}
+
+// every point of the grid in turn, against a fixed treasure
+static void benchCalcDist(long iterations)
+{
+    double sum = 0;
+    long x = -100;
+    long y = -100;
+    for (long i = 0; i < iterations; i++)
+    {
+        sum += calcDist(37, -58, x, y);
+        if (++x > 100)
+        {
+            x = -100;
+            y = y == 100 ? -100 : y + 1;
+        }
+    }
+    sink = sum;
+}
+
+// the same points in batches, one op per guess
+static void benchCalcDistBatch(long iterations)
+{
+    static vector<GuessFrame> grid;
+    for (long y = -100; grid.empty() && y <= 100; y++)
+    {
+        for (long x = -100; x <= 100; x++)
+        {
+            GuessFrame guess;
+            guess.x = x;
+            guess.y = y;
+            grid.push_back(guess);
+        }
+    }
+
+    const size_t BATCH = 256;
+    vector<double> distances(BATCH);
+    double sum = 0;
+    size_t at = 0;
+    for (long done = 0; done < iterations; done += BATCH)
+    {
+        size_t count = min((long)BATCH, iterations - done);
+        if (at + count > grid.size())
+        {
+            at = 0;
+        }
+        calcDistBatch(37, -58, grid.data() + at, count, distances.data());
+        sum += distances[count - 1];
+        at += count;
+    }
+    sink = sum;
+}
+
+static void benchGenerateLong(long iterations)
+{
+    long sum = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        sum += generateLong();
+    }
+    sink = sum;
+}
+
+// a full leaderboard taking a new game every op
+static void benchUpdateBoard(long iterations)
+{
+    leaderBoard board;
+    player finished("bench", 0);
+    for (long i = 0; i < iterations; i++)
+    {
+        finished.tries = i % 50 + 1;
+        updateBoard(board, finished);
+    }
+    sink = board.players.size();
+}
+
+// count a finished game and read back its rank and percentile
+static void benchRanks(long iterations)
+{
+    uint64_t sum = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        uint32_t tries = i % 50 + 1;
+        ranks.add(tries);
+        sum += ranks.rank(tries) + ranks.slower(tries);
+    }
+    sink = sum;
+}
+
+struct FinisherArgs
+{
+    long games;
+};
+
+static void *finisherMain(void *args)
+{
+    long games = ((FinisherArgs *)args)->games;
+    player finished("bench", 0);
+    size_t seen = 0;
+    for (long i = 0; i < games; i++)
+    {
+        finished.tries = (i * 7919) % 1000 + 1;
+        seen += leaderboard.finish(finished).size();
+    }
+    sink = seen;
+    return NULL;
+}
+
+// threads finishing games at once, ns/op is wall time per game
+static void benchLeaderboardFinish(long iterations, int threads)
+{
+    vector<FinisherArgs> args(threads);
+    vector<pthread_t> threadIDs(threads);
+    for (int i = 0; i < threads; i++)
+    {
+        args[i].games = iterations / threads +
+                        (i < iterations % threads ? 1 : 0);
+        pthread_create(&threadIDs[i], NULL, finisherMain, &args[i]);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(threadIDs[i], NULL);
+    }
+}
+
+// one "Turn" message per op read back the way the client does
+static void benchReceive(long iterations)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0)
+    {
+        cerr << "Error creating socket pair" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    string turn;
+    putV1Message(turn, "\nTurn: 12\n");
+    FrameReader reader;
+    size_t total = 0;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        send(socks[0], turn.data(), turn.size(), 0);
+        Message message = receiveMessage(reader, socks[1],
+                                         receiveInt(reader, socks[1]));
+        if (message.data == NULL)
+        {
+            cerr << "Error receiving benchmark message" << endl;
+            exit(EXIT_FAILURE);
+        }
+        total += message.length;
+    }
+    sink = total;
+
+    close(socks[0]);
+    close(socks[1]);
+}
+
+// send everything the session queued, as the thread server does
+static bool flushSession(int sock, Session &session)
+{
+    while (session.pendingLength() > 0)
+    {
+        int bytesSent = send(sock, session.pendingData(),
+                             session.pendingLength(), MSG_NOSIGNAL);
+        if (bytesSent <= 0)
+        {
+            return false;
+        }
+        session.consumed(bytesSent);
+    }
+    return true;
+}
+
+// hand whatever the client sent to the session and answer it
+static bool serveOnce(int sock, Session &session)
+{
+    size_t room;
+    char *space = session.inputSpace(room);
+    int bytesRecv = room == 0 ? -1 : recv(sock, space, room, 0);
+    if (bytesRecv <= 0 || !session.onReceived(bytesRecv))
+    {
+        return false;
+    }
+    return flushSession(sock, session);
+}
+
+// one missed guess per op: the client's send, the server's recv,
+// distance and next turn queued and sent, and the client's recv
+static void benchPlayTurn(long iterations)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0)
+    {
+        cerr << "Error creating socket pair" << endl;
+        exit(EXIT_FAILURE);
+    }
+    int client = socks[0];
+    int server = socks[1];
+    char reply[4096];
+
+    Session session;
+    session.start();
+    string name;
+    putV1Message(name, "bench");
+    if (!flushSession(server, session) ||
+        send(client, name.data(), name.size(), 0) <= 0 ||
+        !serveOnce(server, session))
+    {
+        cerr << "Error starting benchmark session" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // the treasure is on the grid so this guess never ends the game
+    string guess;
+    putV1Int(guess, 1000);
+    putV1Int(guess, 1000);
+
+    for (long i = 0; i < iterations; i++)
+    {
+        recv(client, reply, sizeof(reply), 0);
+        send(client, guess.data(), guess.size(), 0);
+        if (!serveOnce(server, session))
+        {
+            cerr << "Error playing benchmark turn" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    recv(client, reply, sizeof(reply), 0);
+
+    close(client);
+    close(server);
+}
+
+// JSON string with the characters our names and flags can contain
+static string quoted(const string &text)
+{
+    string result = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+        {
+            result += '\\';
+        }
+        result += text[i];
+    }
+    return result + "\"";
+}
+
+static bool writeJson(const string &path, const vector<BenchResult> &results)
+{
+    ofstream out(path.c_str());
+    out << fixed << setprecision(3);
+    out << "{\n"
+        << "  \"compiler\": " << quoted(__VERSION__) << ",\n"
+        << "  \"flags\": " << quoted(BENCH_FLAGS) << ",\n"
+        << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        out << "    {\"name\": " << quoted(results[i].name)
+            << ", \"iterations\": " << results[i].iterations
+            << ", \"ns_per_op\": " << results[i].nsPerOp
+            << ", \"allocs_per_op\": " << results[i].allocsPerOp
+            << ", \"syscalls_per_op\": " << results[i].syscallsPerOp << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.good();
+}
+
+// prints usage and exits
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [options]\n"
+         << "  --iterations N  operations per benchmark, socket benchmarks "
+            "run N/10 (default: 1000000)\n"
+         << "  --threads N     concurrent leaderboard finishers (default: 4)\n"
+         << "  --output FILE   JSON results (default: bench.json)" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    config.iterations = 1000000;
+    config.threads = 4;
+    config.output = "bench.json";
+
+    static struct option options[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"threads", required_argument, NULL, 't'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            config.iterations = atol(optarg);
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'o':
+            config.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || config.iterations < 10 || config.threads < 1 ||
+        config.output.empty())
+    {
+        usage(argv[0]);
+    }
+
+    // the server's own setup, without the treasure log lines
+    if (!logger.start(LOG_WARN) || !ranks.create() || !leaderboard.start())
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    long socketIterations = config.iterations / 10;
+    int threads = config.threads;
+    vector<BenchResult> results;
+    results.push_back(measure("calcDist", config.iterations, benchCalcDist));
+    results.push_back(measure("calcDistBatch", config.iterations,
+                              benchCalcDistBatch));
+    results.push_back(measure("generateLong", config.iterations,
+                              benchGenerateLong));
+    results.push_back(measure("updateBoard", config.iterations,
+                              benchUpdateBoard));
+    results.push_back(measure("ranks.add+rank", config.iterations,
+                              benchRanks));
+    string finishName =
+        "leaderboard.finish/" + to_string(threads) + " threads";
+    auto finish = [threads](long iterations)
+    {
+        benchLeaderboardFinish(iterations, threads);
+    };
+    results.push_back(measure(finishName, config.iterations, finish));
+    results.push_back(measure("receiveInt+receiveMessage", socketIterations,
+                              benchReceive));
+    results.push_back(measure("playGame turn", socketIterations,
+                              benchPlayTurn));
+
+    cout << left << setw(34) << "benchmark" << right << setw(12) << "ns/op"
+         << setw(14) << "allocs/op" << setw(14) << "syscalls/op" << endl;
+    cout << fixed << setprecision(2);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        cout << left << setw(34) << results[i].name << right << setw(12)
+             << results[i].nsPerOp << setw(14) << results[i].allocsPerOp
+             << setw(14) << results[i].syscallsPerOp << endl;
+    }
+
+    if (!writeJson(config.output, results))
+    {
+        cerr << "Error writing " << config.output << endl;
+        exit(EXIT_FAILURE);
+    }
+    cout << "results written to " << config.output << endl;
+
+    return 0;
+}
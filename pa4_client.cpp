@@ -9,183 +9,266 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <unistd.h>
 #include <iostream>
 #include <cstring>
 #include <string.h>
-#include <cerrno>
 #include <vector>
 #include <climits>
 #include <iomanip>
+#include <getopt.h>
+
+#include "protocol.h"
+#include "treasure_client.h"
+#include "solver.h"
 
 using namespace std;
 
-struct player
+// prints appropriate error
+void printError(string action, string object)
 {
-    // data fields
-    string name;
-    int tries;
+    cout << "Failure to " << action << " " << object << endl;
+}
 
-    // Default constructor
-    player() : name(""), tries(0) {}
+// picks the guesses in --auto mode, NULL when the user types them
+TreasureSolver *solver = NULL;
 
-    // Parameterized constructor to initialize player with name and tries
-    player(char *name, int tries)
-    {
-        this->name = name;
-        this->tries = tries;
-    }
-};
+// --batch: send the solver's guesses several at a time
+bool batchMode = false;
 
-struct Message // struct to store received messages
+// read a guess from command line, false once input runs out
+bool readGuess(long &userX, long &userY)
 {
-    char *data;    // pointer to message data
-    size_t length; // length of the message
-};
+    if (solver != NULL)
+    {
+        GuessFrame guess = solver->nextGuess();
+        userX = guess.x;
+        userY = guess.y;
+        cout << userX << " " << userY << endl;
+        return true;
+    }
 
-// receive distance to treasure from server
-double receiveDistance(int sock)
-{
-    double bytesLeft = sizeof(double);
-    double hostDouble;
-    char *bp = reinterpret_cast<char *>(&hostDouble);
+    cin >> userX;
+    cin >> userY;
 
-    // receive 1 byte at a time
-    while (bytesLeft)
+    // check for valid input
+    while (cin.fail() ||
+           (-100 > userX || userX > 100) || ((-100 > userY || userY > 100)))
     {
-        int bytesRecv = recv(sock, bp, bytesLeft, 0);
+        if (cin.eof())
+        {
+            return false;
+        }
 
-        if (bytesRecv <= 0)
+        if (cin.fail())
+        {
+            cout << "Invalid input. Try again!\n";
+        }
+        else
         {
-            // return error value
-            return -1;
+            // guess is outside the grid
+            cout << "Coordinates out of bounds. Try again!" << endl;
         }
+        cout << "Enter a guess (x y) : ";
+
+        // Clear the fail state
+        cin.clear();
+
+        // Ignore the invalid input
+        cin.ignore(INT_MAX, '\n');
 
-        bytesLeft -= bytesRecv;
-        bp += bytesRecv; // advance pointer
+        // Attempt to read user input again
+        cin >> userX >> userY;
     }
 
-    return hostDouble;
+    return true;
 }
 
-// prints appropriate error
-void printError(string action, string object)
+// send the solver's next batch of guesses starting at turn
+void sendBatch(TreasureClient &client, uint32_t turn,
+               vector<GuessFrame> &batch)
 {
-    cout << "Failure to " << action << " " << object << endl;
+    batch = solver->nextBatch();
+
+    cout << "\nTurn: " << turn << "\n";
+    cout << "Guesses :";
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        cout << " (" << batch[i].x << ", " << batch[i].y << ")";
+    }
+    cout << endl;
+
+    client.guessBatch(batch);
 }
 
-// receive an integer from server
-long receiveInt(int sock)
+/* Plays the one game of this process on the terminal: prints what the
+   server says and answers with what the user, or the solver, picks.
+   Reading the terminal blocks the loop, which only runs this client. */
+class Terminal : public TreasureHandler
 {
-    int bytesLeft = sizeof(long);
-    long networkInt;
-
-    // char * used because char is 1 byte
-    char *bp = (char *)&networkInt;
+public:
+    Terminal(bool shm) : shm(shm), welcomed(false), ok(true) {}
 
-    // receive 1 byte at a time
-    while (bytesLeft)
+    void onWelcome(TreasureClient &client, const string &message)
     {
-        int bytesRecv = recv(sock, bp, bytesLeft, 0);
+        welcomed = true;
+        cout << message;
 
-        if (bytesRecv <= 0)
+        // read username from command line
+        string usrname;
+        cin >> usrname;
+
+        // everything after the offer goes through the rings
+        if (shm && !client.useRing())
         {
-            // error value
-            return LONG_MIN;
+            printError("set up", "shared memory rings");
+            client.close();
+            ok = false;
+            return;
         }
 
-        bytesLeft -= bytesRecv;
-        bp += bytesRecv; // advance pointer
+        client.sendName(usrname);
     }
 
-    // convert to host order before returning it
-    long hostInt = ntohl(networkInt);
-
-    return hostInt;
-};
-
-// receive a message from server
-Message receiveMessage(int sock, int hostInt)
-{
-    int msgLen = hostInt;
-    char *buffer = new char[msgLen];
-    char *bp = buffer;
-    Message result;
-
-    // Loop until the entire message is received
-    while (msgLen > 0)
+    void onTurn(TreasureClient &client, const TurnFrame &turn)
     {
-        int bytesRecv = recv(sock, bp, msgLen, 0);
+        // solver sends several guesses per round trip
+        if (batchMode)
+        {
+            sendBatch(client, turn.turn, batch);
+            return;
+        }
 
-        // Check for errors or connection closure
-        if (bytesRecv <= 0)
+        // no distance before the first guess
+        if (turn.distance >= 0)
         {
-            cerr << "Failure to receive a message" << endl;
+            cout << "Distance to treasure: " << fixed << setprecision(2)
+                 << turn.distance << " ft.\n";
 
-            // Free the allocated memory
-            delete[] buffer;
+            if (solver != NULL)
+            {
+                solver->observe(guess, turn.distance);
+            }
+        }
+        cout << "\nTurn: " << turn.turn << "\n";
+        cout << "Enter a guess (x y) : ";
 
-            // Return an "empty" message for failure
-            result.data = nullptr;
-            result.length = 0;
-            return result;
+        long userX;
+        long userY;
+        if (!readGuess(userX, userY))
+        {
+            client.close();
+            return;
         }
 
-        // Adjust pointers and remaining length
-        msgLen -= bytesRecv;
-        bp += bytesRecv;
+        guess.x = userX;
+        guess.y = userY;
+        client.guess(userX, userY);
     }
 
-    // Populate the result struct with received data
-    result.data = buffer;
-    result.length = hostInt;
+    void onDistances(TreasureClient &client, const DistancesFrame &reply)
+    {
+        if (reply.distances.size() > batch.size())
+        {
+            printError("receive", "distances to treasure");
+            client.close();
+            return;
+        }
 
-    return result;
-};
+        for (size_t i = 0; i < reply.distances.size(); i++)
+        {
+            solver->observe(batch[i], reply.distances[i]);
 
-// send an integer to the server
-bool sendInt(int sock, long hostInt)
-{
-    // Convert the long integer to network order
-    long networkInt = htonl(hostInt);
+            // the RESULT frame reports the hit
+            if (reply.distances[i] != 0)
+            {
+                cout << "Distance from (" << batch[i].x << ", "
+                     << batch[i].y << ") to treasure: " << fixed
+                     << setprecision(2) << reply.distances[i] << " ft.\n";
+            }
+        }
 
-    // Send the network-ordered integer to the specified socket
-    long bytesSent = send(sock, (void *)&networkInt, sizeof(long), 0);
+        if (reply.distances.back() != 0)
+        {
+            sendBatch(client, reply.turn, batch);
+        }
+    }
 
-    // Check if the entire message was sent successfully
-    return bytesSent == sizeof(long);
-}
+    void onFound(TreasureClient &, const FoundFrame &found)
+    {
+        cout << "\n" << found.name << " found the treasure in "
+             << found.tries << (found.tries == 1 ? " turn" : " turns")
+             << " (place " << found.place << ")" << endl;
+    }
 
-// send a message to the server
-bool sendMessage(int clientSock, const char *message)
-{
-    int bytesSent = send(clientSock, (void *)message, strlen(message), 0);
+    void onResult(TreasureClient &, const ResultFrame &result,
+                  bool standingsFollow)
+    {
+        cout << "Distance to treasure: 0 ft.\n\n";
+        cout << result.message << endl;
 
-    return bytesSent == strlen(message);
-}
+        // print leaderboard
+        cout << "\nLeader board:" << endl;
+        for (size_t i = 0; i < result.board.size(); i++)
+        {
+            cout << (i + 1) << ". " << result.board[i].name << " "
+                 << result.board[i].tries << endl;
+        }
 
-int main(int argc, char **argv)
-{
-    if (argc != 3)
-    {
-        // check if all arguments are provided
-        cerr << "Usage: " << argv[0] << " [IP address] [port number]" << endl;
-        exit(EXIT_FAILURE);
+        // the rest of the room is still hunting
+        if (standingsFollow)
+        {
+            cout << "\nWaiting for the other players..." << endl;
+        }
     }
 
-    // create a TCP socket
-    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    void onStandings(TreasureClient &, const StandingsFrame &standings)
+    {
+        cout << "\nRoom standings:" << endl;
+        for (size_t i = 0; i < standings.players.size(); i++)
+        {
+            cout << (i + 1) << ". " << standings.players[i].name << " "
+                 << standings.players[i].tries << endl;
+        }
+    }
 
-    if (sock < 0)
+    void onClosed(TreasureClient &client, bool finished)
     {
-        cerr << "Error creating socket: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
+        if (finished)
+        {
+            return;
+        }
+
+        if (!welcomed)
+        {
+            if (client.error() != 0)
+            {
+                cerr << "Error with connect: " << strerror(client.error())
+                     << endl;
+            }
+            else
+            {
+                printError("receive", "welcome message");
+            }
+            ok = false;
+            return;
+        }
+        printError("receive", "server reply");
     }
 
-    // read IP address and port number from command line
-    char *IPAddr = argv[1];
-    unsigned short servPort = (short)(stoi(argv[2]));
+    // false if the game could not start
+    bool succeeded() const { return ok && welcomed; }
 
+private:
+    bool shm;
+    bool welcomed;
+    bool ok;
+    GuessFrame guess;
+    vector<GuessFrame> batch; // guesses of the last GUESS_BATCH
+};
+
+// server address from the command line, exits if it is invalid
+struct sockaddr_in serverAddress(char *IPAddr, unsigned short servPort)
+{
     // Convert dotted decimal address to int
     unsigned long servIP;
     int status = inet_pton(AF_INET, IPAddr, (void *)&servIP);
@@ -204,191 +287,106 @@ int main(int argc, char **argv)
 
     // set the fields
     struct sockaddr_in servAddr;
+    memset(&servAddr, 0, sizeof(servAddr));
     servAddr.sin_family = AF_INET;
     servAddr.sin_addr.s_addr = servIP;
     servAddr.sin_port = htons(servPort);
 
-    // establish connection with the server
-    status = connect(sock, (struct sockaddr *)(&servAddr), sizeof(servAddr));
+    return servAddr;
+}
 
-    if (status < 0)
+int main(int argc, char **argv)
+{
+    int version = 2;
+    TreasureSolver autoSolver;
+    string unixPath;
+    bool shm = false;
+
+    static struct option options[] = {
+        {"v1", no_argument, NULL, '1'},
+        {"auto", no_argument, NULL, 'a'},
+        {"batch", no_argument, NULL, 'b'},
+        {"unix", required_argument, NULL, 'u'},
+        {"shm", no_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
     {
-        // print out an error message if unsuccessful
-        cerr << "Error with connect: " << strerror(errno) << endl;
-        close(sock);
-        exit(EXIT_FAILURE);
+        if (opt == '1')
+        {
+            // speak the original protocol, for servers without v2
+            version = 1;
+        }
+        else if (opt == 'a')
+        {
+            // let the solver pick every guess
+            solver = &autoSolver;
+        }
+        else if (opt == 'b')
+        {
+            // solver guesses go out in batches, v2 only
+            solver = &autoSolver;
+            batchMode = true;
+        }
+        else if (opt == 'u')
+        {
+            // server on this host, through its Unix domain socket
+            unixPath = optarg;
+        }
+        else if (opt == 's')
+        {
+            // play over shared memory rings, Unix domain socket only
+            shm = true;
+        }
+        else
+        {
+            argc = 0; // print usage below
+            break;
+        }
     }
 
-    // receive welcome message
-    long msgLength = receiveInt(sock);
-
-    if (msgLength == LONG_MIN)
+    if (argc - optind != (unixPath.empty() ? 2 : 0) ||
+        (batchMode && version == 1) || (shm && unixPath.empty()))
     {
-
-        printError("receive", "welcome message length");
-        close(sock);
+        // check if all arguments are provided
+        cerr << "Usage: " << argv[0]
+             << " [--v1] [--auto | --batch] [IP address] [port number]\n"
+             << "       " << argv[0]
+             << " [--v1] [--auto | --batch] --unix PATH [--shm]" << endl;
         exit(EXIT_FAILURE);
     }
 
-    Message receivedMessage = receiveMessage(sock, msgLength);
-
-    if (receivedMessage.data == nullptr)
+    ClientLoop loop;
+    if (!loop.open())
     {
-
-        printError("receive", "welcome message");
-        close(sock);
+        cerr << "Error creating epoll instance" << endl;
         exit(EXIT_FAILURE);
     }
-    cout << receivedMessage.data;
 
-    // read username from command line
-    string usrname;
-    cin >> usrname;
-
-    // send username length
-    char *username = new char[usrname.length()];
-    strcpy(username, usrname.c_str());
-    long usernameNInt = strlen(username);
-
-    if (!sendInt(sock, usernameNInt))
+    // read IP address and port number from command line
+    Terminal terminal(shm);
+    TreasureClient client(loop, terminal);
+    bool started;
+    if (unixPath.empty())
     {
-        printError("receive", "username length");
-        close(sock);
-        exit(EXIT_FAILURE);
+        started = client.connect(
+            serverAddress(argv[optind], (short)(stoi(argv[optind + 1]))),
+            version);
+    }
+    else
+    {
+        started = client.connectLocal(unixPath, version);
     }
 
-    // send actual username
-    if (!sendMessage(sock, username))
+    if (!started)
     {
-        printError("send", "username");
-        close(sock);
+        cerr << "Error with connect: " << strerror(client.error()) << endl;
         exit(EXIT_FAILURE);
     }
 
-    delete[] username; // free memory
-
-    long userX;
-    long userY;
+    // the whole game, the connection is closed when it ends
+    loop.run();
 
-    do
-    { /* keep playing while server is on
-      or guess is incorrect */
-
-        // receive number of turn(s)
-        msgLength = receiveInt(sock);
-        if(msgLength==LONG_MIN){
-            printError("receive", "number of turn(s) length");
-            break;
-        }
-
-        receivedMessage = receiveMessage(sock, msgLength);
-        if(receivedMessage.data==nullptr){
-            printError("receive", "number of turn(s)");
-            break;
-        }
-        cout << receivedMessage.data;
-
-        // receive "enter your guess" message
-        msgLength = receiveInt(sock);
-        receivedMessage = receiveMessage(sock, msgLength);
-        cout << receivedMessage.data;
-
-        // read guess from command line
-        cin >> userX;
-        cin >> userY;
-
-        // check for valid input
-        while (cin.fail())
-        {
-            cout << "Invalid input. Try again!\n";
-            cout << "Enter a guess (x y) : ";
-
-            // Clear the fail state
-            cin.clear();
-
-            // Ignore the invalid input
-            cin.ignore(INT_MAX, '\n');
-
-            // Attempt to read user input again
-            cin >> userX >> userY;
-        }
-
-        // check if guess is within the grid
-        while ((-100 > userX || userX > 100) || ((-100 > userY || userY > 100)))
-        {
-            cout << "Coordinates out of bounds. Try again!" << endl;
-            cout << "Enter a guess (x y) : ";
-
-            cin.clear();
-            cin.ignore(INT_MAX, '\n');
-
-            // Attempt to read user input again
-            cin >> userX >> userY;
-        }
-
-        // send valid guesses to server
-        sendInt(sock, userX);
-        sendInt(sock, userY);
-
-        // receive distance from treasure location
-        double distance = receiveDistance(sock);
-
-        if (distance == 0)
-        {
-            cout << "Distance to treasure: " << distance << " ft.\n\n";
-            msgLength = receiveInt(sock);
-            if(msgLength==LONG_MIN){
-                printError("receive","victory message length");
-                break;
-            }
-
-            // receive victory messagee
-            receivedMessage = receiveMessage(sock, msgLength);
-            if(receivedMessage.data==nullptr){
-                printError("receive","victory message");
-                break;
-            }
-            cout << receivedMessage.data << endl;
-
-            // receive leaderboard size
-            long boardSize = receiveInt(sock);
-
-            // print leaderboard
-            cout << "\nLeader board:" << endl;
-            for (int i = 0; i < boardSize; i++)
-            {
-                long nameLength = receiveInt(sock);
-                if(nameLength==LONG_MIN){
-                    printError("receive","player name length");
-                    break;
-                }
-
-                Message name = receiveMessage(sock, nameLength);
-                if(name.data==nullptr){
-                    printError("receive","player name");
-                    break;
-                }
-
-                long tries = receiveInt(sock);
-                if(tries==LONG_MIN){
-                    printError("receive","player tries");
-                    break;
-                }
-
-                cout << (i + 1) << ". " << name.data << " " << tries << endl;
-            }
-
-            break;
-        }
-
-        // else just print distance and start over
-        cout << "Distance to treasure: " << fixed << setprecision(2)
-             << distance << " ft.\n";
-
-    } while (true);
-
-    // close connection when done
-    close(sock);
-
-    return 0;
-}
\ No newline at end of file
+    return terminal.succeeded() ? 0 : EXIT_FAILURE;
+}
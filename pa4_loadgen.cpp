@@ -0,0 +1,872 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Load generator
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+#include "frame_reader.h"
+#include "blocking_io.h"
+#include "shm_ring.h"
+#include "histogram.h"
+#include "solver.h"
+
+using namespace std;
+
+// everything main() reads from the command line
+struct LoadConfig
+{
+    struct sockaddr_in servAddr;
+    struct sockaddr_un localAddr;
+    bool local;       // connect to localAddr instead of servAddr
+    bool shm;         // play over shared memory rings, one at a time
+    long sessions;    // sessions to play in total
+    int concurrency;  // sessions open at once, across all threads
+    int threads;
+    double rate;      // new connections per second, 0 for no limit
+    long thinkMs;     // pause before every guess
+    bool batch;       // send the solver's guesses in GUESS_BATCH frames
+};
+
+// per thread results, merged once every thread is done
+struct LoadStats
+{
+    Histogram connectToWelcome;
+    Histogram turnRtt;
+    long completed;
+    long failed;
+    long roundTrips;
+    long guesses;
+    long roomFrames; // FOUND and STANDINGS frames from rooms
+
+    LoadStats()
+        : completed(0), failed(0), roundTrips(0), guesses(0), roomFrames(0)
+    {
+    }
+};
+
+enum LoadState
+{
+    CONNECTING, // waiting for connect() to finish
+    WELCOME,    // waiting for the v1 welcome message
+    PLAYING,    // waiting for a TURN or RESULT frame
+    THINKING    // think time before the next guess
+};
+
+// one automated player
+struct LoadSession
+{
+    int sock;
+    LoadState state;
+    FrameReader in;
+    string out;
+    size_t outPos;
+    uint64_t connectStart;
+    uint64_t guessSent;
+    GuessFrame guess;
+    vector<GuessFrame> batch; // guesses of the last GUESS_BATCH
+    bool finished; // RESULT frame received, and STANDINGS in a room
+    TreasureSolver solver;
+};
+
+// arguments for load thread function
+struct LoadThread
+{
+    const LoadConfig *config;
+    long sessions;
+    int concurrency;
+    double rate;
+    LoadStats stats;
+};
+
+// monotonic clock in nanoseconds
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class LoadLoop
+{
+public:
+    LoadLoop(LoadThread *thread) : thread(thread), active(0), started(0) {}
+
+    void run();
+
+private:
+    void startSession();
+    void finishSession(LoadSession *session, bool ok);
+    bool flush(LoadSession *session);
+    bool readInput(LoadSession *session);
+    bool handleInput(LoadSession *session);
+    bool handleFrame(LoadSession *session, const FrameHeader &header,
+                     const char *payload);
+    void sendGuess(LoadSession *session);
+
+    LoadThread *thread;
+    int epfd;
+    long active;
+    long started;
+
+    // sessions in think time, earliest deadline first
+    typedef pair<uint64_t, LoadSession *> Timer;
+    priority_queue<Timer, vector<Timer>, greater<Timer> > thinking;
+};
+
+void LoadLoop::startSession()
+{
+    started++;
+
+    const LoadConfig *config = thread->config;
+    LoadSession *session = new LoadSession;
+    session->sock = socket(config->local ? AF_UNIX : AF_INET,
+                           SOCK_STREAM | SOCK_NONBLOCK, 0);
+    session->state = CONNECTING;
+    session->outPos = 0;
+    session->finished = false;
+    session->connectStart = nowNs();
+
+    if (session->sock < 0)
+    {
+        thread->stats.failed++;
+        delete session;
+        return;
+    }
+
+    int status;
+    if (config->local)
+    {
+        status = connect(session->sock,
+                         (struct sockaddr *)&config->localAddr,
+                         sizeof(config->localAddr));
+    }
+    else
+    {
+        int one = 1;
+        setsockopt(session->sock, IPPROTO_TCP, TCP_NODELAY, &one,
+                   sizeof(one));
+        status = connect(session->sock, (struct sockaddr *)&config->servAddr,
+                         sizeof(config->servAddr));
+    }
+    if (status < 0 && errno != EINPROGRESS)
+    {
+        close(session->sock);
+        thread->stats.failed++;
+        delete session;
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = session;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, session->sock, &event);
+    active++;
+}
+
+void LoadLoop::finishSession(LoadSession *session, bool ok)
+{
+    if (ok)
+    {
+        thread->stats.completed++;
+    }
+    else
+    {
+        thread->stats.failed++;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, session->sock, NULL);
+    close(session->sock);
+    delete session;
+    active--;
+}
+
+bool LoadLoop::flush(LoadSession *session)
+{
+    while (session->outPos < session->out.size())
+    {
+        ssize_t bytesSent = send(session->sock,
+                                 session->out.data() + session->outPos,
+                                 session->out.size() - session->outPos,
+                                 MSG_NOSIGNAL);
+        if (bytesSent < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        session->outPos += bytesSent;
+    }
+
+    session->out.clear();
+    session->outPos = 0;
+    return true;
+}
+
+void LoadLoop::sendGuess(LoadSession *session)
+{
+    if (thread->config->batch)
+    {
+        session->batch = session->solver.nextBatch();
+        encodeGuessBatch(session->out, session->batch);
+    }
+    else
+    {
+        session->guess = session->solver.nextGuess();
+        encodeFrame(session->out, session->guess);
+    }
+    session->guessSent = nowNs();
+    session->state = PLAYING;
+}
+
+bool LoadLoop::handleFrame(LoadSession *session, const FrameHeader &header,
+                           const char *payload)
+{
+    LoadStats &stats = thread->stats;
+
+    // other players of the room found the treasure
+    if (header.type == FRAME_FOUND)
+    {
+        stats.roomFrames++;
+        return true;
+    }
+    if (header.type == FRAME_STANDINGS)
+    {
+        stats.roomFrames++;
+        session->finished = true;
+        return false;
+    }
+
+    if (header.type == FRAME_RESULT)
+    {
+        // a batch reply already counted the round trip
+        if (!thread->config->batch)
+        {
+            stats.turnRtt.record(nowNs() - session->guessSent);
+            stats.roundTrips++;
+            stats.guesses++;
+        }
+
+        // a room player waits for the others
+        if (header.flags & RESULT_STANDINGS_FOLLOW)
+        {
+            return true;
+        }
+        session->finished = true;
+        return false;
+    }
+
+    if (header.type == FRAME_DISTANCES)
+    {
+        DistancesFrame reply;
+        if (!decodeDistances(payload, header.length, reply) ||
+            reply.distances.size() > session->batch.size())
+        {
+            return false;
+        }
+
+        stats.turnRtt.record(nowNs() - session->guessSent);
+        stats.roundTrips++;
+        stats.guesses += reply.distances.size();
+
+        for (size_t i = 0; i < reply.distances.size(); i++)
+        {
+            session->solver.observe(session->batch[i], reply.distances[i]);
+        }
+
+        // the RESULT frame follows a hit
+        if (reply.distances.back() == 0)
+        {
+            return true;
+        }
+    }
+    else
+    {
+        TurnFrame turn;
+        if (header.type != FRAME_TURN ||
+            !decodeFrame(payload, header.length, turn))
+        {
+            return false;
+        }
+
+        // no distance before the first guess
+        if (turn.distance >= 0)
+        {
+            stats.turnRtt.record(nowNs() - session->guessSent);
+            stats.roundTrips++;
+            stats.guesses++;
+            session->solver.observe(session->guess, turn.distance);
+        }
+    }
+
+    if (thread->config->thinkMs > 0)
+    {
+        session->state = THINKING;
+        thinking.push(Timer(nowNs() + thread->config->thinkMs * 1000000ULL,
+                            session));
+    }
+    else
+    {
+        sendGuess(session);
+    }
+
+    return true;
+}
+
+// parse everything buffered, false once the session is over
+bool LoadLoop::handleInput(LoadSession *session)
+{
+    FrameReader &in = session->in;
+    bool open = true;
+
+    while (open)
+    {
+        const char *data = in.data();
+        size_t available = in.size();
+
+        if (session->state == WELCOME)
+        {
+            if (available < V1_INT_SIZE)
+            {
+                break;
+            }
+            long length = getV1Int(data);
+            if (length < 0 || !in.reserve(V1_INT_SIZE + length))
+            {
+                return false;
+            }
+            if (available < V1_INT_SIZE + (size_t)length)
+            {
+                break;
+            }
+            in.consume(V1_INT_SIZE + length);
+
+            thread->stats.connectToWelcome.record(nowNs() -
+                                                  session->connectStart);
+
+            putV1Int(session->out, PROTOCOL_V2_MAGIC);
+            encodeName(session->out, "loadgen");
+            session->state = PLAYING;
+            continue;
+        }
+
+        // frames wait while the session is thinking
+        if (session->state != PLAYING)
+        {
+            break;
+        }
+
+        FrameHeader header;
+        string_view payload;
+        bool tooLarge = false;
+        if (!in.peekFrame(header, payload, tooLarge))
+        {
+            if (tooLarge)
+            {
+                return false;
+            }
+            break;
+        }
+        in.consume(FRAME_HEADER_SIZE + header.length);
+        open = handleFrame(session, header, payload.data());
+    }
+
+    in.releaseIfEmpty();
+    return open;
+}
+
+// false once the session is over
+bool LoadLoop::readInput(LoadSession *session)
+{
+    while (true)
+    {
+        ssize_t bytesRecv = session->in.fill(session->sock);
+        if (bytesRecv < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            return false;
+        }
+        if (bytesRecv == 0)
+        {
+            return false;
+        }
+
+        if (!handleInput(session))
+        {
+            return false;
+        }
+    }
+}
+
+void LoadLoop::run()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        cerr << "Error creating epoll instance" << endl;
+        return;
+    }
+
+    uint64_t interval = thread->rate > 0 ? (uint64_t)(1e9 / thread->rate) : 0;
+    uint64_t nextConnect = nowNs();
+    vector<struct epoll_event> events(256);
+
+    while (started < thread->sessions || active > 0)
+    {
+        uint64_t now = nowNs();
+
+        // open new sessions at the configured rate
+        while (active < thread->concurrency && started < thread->sessions &&
+               now >= nextConnect)
+        {
+            startSession();
+            nextConnect = interval ? nextConnect + interval : now;
+        }
+
+        // guesses whose think time is over
+        while (!thinking.empty() && thinking.top().first <= now)
+        {
+            LoadSession *session = thinking.top().second;
+            thinking.pop();
+            sendGuess(session);
+            if (!flush(session))
+            {
+                finishSession(session, false);
+            }
+        }
+
+        // sleep until the next connect or think deadline
+        uint64_t wakeAt = UINT64_MAX;
+        if (active < thread->concurrency && started < thread->sessions)
+        {
+            wakeAt = nextConnect;
+        }
+        if (!thinking.empty() && thinking.top().first < wakeAt)
+        {
+            wakeAt = thinking.top().first;
+        }
+        int timeout = -1;
+        if (wakeAt != UINT64_MAX)
+        {
+            timeout = wakeAt > now ? (int)((wakeAt - now + 999999) / 1000000)
+                                   : 0;
+        }
+
+        int count = epoll_wait(epfd, events.data(), events.size(), timeout);
+        for (int i = 0; i < count; i++)
+        {
+            LoadSession *session = (LoadSession *)events[i].data.ptr;
+            uint32_t ready = events[i].events;
+
+            if (session->state == CONNECTING)
+            {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(session->sock, SOL_SOCKET, SO_ERROR, &error,
+                           &length);
+                if (error != 0 || (ready & (EPOLLERR | EPOLLHUP)))
+                {
+                    finishSession(session, false);
+                    continue;
+                }
+                session->state = WELCOME;
+            }
+
+            bool open = true;
+            if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                open = readInput(session);
+            }
+            if (open)
+            {
+                open = flush(session);
+            }
+            if (!open)
+            {
+                finishSession(session, session->finished);
+            }
+        }
+    }
+
+    close(epfd);
+}
+
+// play one game over rings already offered to the server, blocking on
+// every reply; false if it failed
+static bool playRingGame(LoadThread *thread, ShmChannel &ring,
+                         FrameReader &in)
+{
+    const LoadConfig *config = thread->config;
+    LoadStats &stats = thread->stats;
+    TreasureSolver solver;
+    GuessFrame guess;
+    vector<GuessFrame> batch;
+    uint64_t guessSent = 0;
+
+    string out;
+    putV1Int(out, PROTOCOL_V2_MAGIC);
+    encodeName(out, "loadgen");
+
+    while (true)
+    {
+        if (!out.empty() && !sendAll(ring, out))
+        {
+            return false;
+        }
+        out.clear();
+
+        FrameHeader header;
+        string_view payload;
+        if (!receiveFrame(in, ring, header, payload))
+        {
+            return false;
+        }
+
+        if (header.type == FRAME_FOUND || header.type == FRAME_STANDINGS)
+        {
+            stats.roomFrames++;
+            if (header.type == FRAME_STANDINGS)
+            {
+                return true;
+            }
+            continue;
+        }
+
+        if (header.type == FRAME_RESULT)
+        {
+            if (!config->batch)
+            {
+                stats.turnRtt.record(nowNs() - guessSent);
+                stats.roundTrips++;
+                stats.guesses++;
+            }
+            if (header.flags & RESULT_STANDINGS_FOLLOW)
+            {
+                continue;
+            }
+            return true;
+        }
+
+        if (header.type == FRAME_DISTANCES)
+        {
+            DistancesFrame reply;
+            if (!decodeDistances(payload.data(), payload.size(), reply) ||
+                reply.distances.size() > batch.size())
+            {
+                return false;
+            }
+            stats.turnRtt.record(nowNs() - guessSent);
+            stats.roundTrips++;
+            stats.guesses += reply.distances.size();
+            for (size_t i = 0; i < reply.distances.size(); i++)
+            {
+                solver.observe(batch[i], reply.distances[i]);
+            }
+
+            // the RESULT frame follows a hit
+            if (reply.distances.back() == 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            TurnFrame turn;
+            if (header.type != FRAME_TURN ||
+                !decodeFrame(payload.data(), payload.size(), turn))
+            {
+                return false;
+            }
+            if (turn.distance >= 0)
+            {
+                stats.turnRtt.record(nowNs() - guessSent);
+                stats.roundTrips++;
+                stats.guesses++;
+                solver.observe(guess, turn.distance);
+            }
+        }
+
+        if (config->thinkMs > 0)
+        {
+            usleep(config->thinkMs * 1000);
+        }
+        if (config->batch)
+        {
+            batch = solver.nextBatch();
+            encodeGuessBatch(out, batch);
+        }
+        else
+        {
+            guess = solver.nextGuess();
+            encodeFrame(out, guess);
+        }
+        guessSent = nowNs();
+    }
+}
+
+// connect, switch to rings after the welcome message and play one game,
+// false if any of it failed
+static bool playRingSession(LoadThread *thread)
+{
+    const LoadConfig *config = thread->config;
+    uint64_t connectStart = nowNs();
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return false;
+    }
+    if (connect(sock, (struct sockaddr *)&config->localAddr,
+                sizeof(config->localAddr)) < 0)
+    {
+        close(sock);
+        return false;
+    }
+
+    FrameReader in;
+    ShmChannel ring;
+    long length = receiveInt(in, sock);
+    bool ok = length >= 0 && receiveMessage(in, sock, length).data != NULL;
+    if (ok)
+    {
+        thread->stats.connectToWelcome.record(nowNs() - connectStart);
+        ok = ring.create(sock) && offerRing(sock, ring.memfd()) &&
+             playRingGame(thread, ring, in);
+    }
+
+    ring.close();
+    close(sock);
+    return ok;
+}
+
+// ring sessions one after the other at the thread's rate
+static void runRingSessions(LoadThread *thread)
+{
+    uint64_t interval = thread->rate > 0 ? (uint64_t)(1e9 / thread->rate) : 0;
+    uint64_t nextConnect = nowNs();
+
+    for (long i = 0; i < thread->sessions; i++)
+    {
+        uint64_t now = nowNs();
+        if (interval && now < nextConnect)
+        {
+            usleep((nextConnect - now) / 1000);
+        }
+        nextConnect += interval;
+
+        if (playRingSession(thread))
+        {
+            thread->stats.completed++;
+        }
+        else
+        {
+            thread->stats.failed++;
+        }
+    }
+}
+
+// load thread function
+static void *loadMain(void *args)
+{
+    LoadThread *thread = (LoadThread *)args;
+    if (thread->config->shm)
+    {
+        runRingSessions(thread);
+        return NULL;
+    }
+
+    LoadLoop loop(thread);
+    loop.run();
+    return NULL;
+}
+
+// print one latency histogram in microseconds
+static void printLatency(const char *name, const Histogram &histogram)
+{
+    cout << name << " (us): p50 " << histogram.percentile(0.50) / 1000.0
+         << "  p99 " << histogram.percentile(0.99) / 1000.0
+         << "  p999 " << histogram.percentile(0.999) / 1000.0
+         << "  max " << histogram.max() / 1000.0
+         << "  mean " << histogram.mean() / 1000.0 << endl;
+}
+
+// prints usage and exits
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [options] [IP address] [port number]\n"
+         << "       " << prog << " [options] --unix PATH [--shm]\n"
+         << "  --sessions N     sessions to play (default: 1000)\n"
+         << "  --concurrency N  sessions open at once (default: 100)\n"
+         << "  --threads N      client threads (default: 1)\n"
+         << "  --rate N         new connections per second, 0 for no limit "
+            "(default: 0)\n"
+         << "  --think MS       pause before every guess (default: 0)\n"
+         << "  --batch          send several guesses per round trip\n"
+         << "  --unix PATH      connect to the server's Unix domain socket\n"
+         << "  --shm            play over shared memory rings, each thread "
+            "plays one\n"
+         << "                   session at a time (needs --unix)" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    LoadConfig config;
+    config.sessions = 1000;
+    config.concurrency = 100;
+    config.threads = 1;
+    config.rate = 0;
+    config.thinkMs = 0;
+    config.batch = false;
+    config.local = false;
+    config.shm = false;
+
+    static struct option options[] = {
+        {"sessions", required_argument, NULL, 'n'},
+        {"concurrency", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"rate", required_argument, NULL, 'r'},
+        {"think", required_argument, NULL, 'k'},
+        {"batch", no_argument, NULL, 'b'},
+        {"unix", required_argument, NULL, 'u'},
+        {"shm", no_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}};
+
+    string unixPath;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            config.sessions = atol(optarg);
+            break;
+        case 'c':
+            config.concurrency = atoi(optarg);
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'k':
+            config.thinkMs = atol(optarg);
+            break;
+        case 'b':
+            config.batch = true;
+            break;
+        case 'u':
+            config.local = true;
+            unixPath = optarg;
+            break;
+        case 's':
+            config.shm = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind != (config.local ? 0 : 2) || config.sessions < 1 ||
+        config.threads < 1 || config.concurrency < config.threads ||
+        config.rate < 0 || config.thinkMs < 0 ||
+        (config.shm && !config.local) ||
+        unixPath.size() >= sizeof(config.localAddr.sun_path))
+    {
+        usage(argv[0]);
+    }
+
+    memset(&config.localAddr, 0, sizeof(config.localAddr));
+    config.localAddr.sun_family = AF_UNIX;
+    strncpy(config.localAddr.sun_path, unixPath.c_str(),
+            sizeof(config.localAddr.sun_path) - 1);
+
+    // Convert dotted decimal address to int
+    memset(&config.servAddr, 0, sizeof(config.servAddr));
+    config.servAddr.sin_family = AF_INET;
+    if (!config.local)
+    {
+        config.servAddr.sin_port =
+            htons((unsigned short)stoi(argv[optind + 1]));
+        if (inet_pton(AF_INET, argv[optind], &config.servAddr.sin_addr) != 1)
+        {
+            cerr << "Invalid IP address" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // split sessions, concurrency and rate evenly across threads
+    vector<LoadThread> threads(config.threads);
+    vector<pthread_t> threadIDs(config.threads);
+    uint64_t start = nowNs();
+
+    for (int i = 0; i < config.threads; i++)
+    {
+        threads[i].config = &config;
+        threads[i].sessions = config.sessions / config.threads +
+                              (i < config.sessions % config.threads ? 1 : 0);
+        threads[i].concurrency = config.concurrency / config.threads;
+        threads[i].rate = config.rate / config.threads;
+
+        if (pthread_create(&threadIDs[i], NULL, loadMain, &threads[i]) != 0)
+        {
+            cerr << "Error creating load thread" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    LoadStats total;
+    for (int i = 0; i < config.threads; i++)
+    {
+        pthread_join(threadIDs[i], NULL);
+        total.connectToWelcome.merge(threads[i].stats.connectToWelcome);
+        total.turnRtt.merge(threads[i].stats.turnRtt);
+        total.completed += threads[i].stats.completed;
+        total.failed += threads[i].stats.failed;
+        total.roundTrips += threads[i].stats.roundTrips;
+        total.guesses += threads[i].stats.guesses;
+        total.roomFrames += threads[i].stats.roomFrames;
+    }
+
+    double seconds = (nowNs() - start) / 1e9;
+
+    cout << fixed << setprecision(1);
+    cout << "sessions: " << total.completed << " completed, " << total.failed
+         << " failed in " << seconds << " s ("
+         << total.completed / seconds << " sessions/s)" << endl;
+    double completed = total.completed ? total.completed : 1;
+    cout << "round trips: " << total.roundTrips << " ("
+         << total.roundTrips / completed << " per session), guesses: "
+         << total.guesses << " (" << total.guesses / completed
+         << " per session)" << endl;
+    if (total.roomFrames > 0)
+    {
+        cout << "room frames: " << total.roomFrames << " ("
+             << total.roomFrames / completed << " per session)" << endl;
+    }
+    printLatency("connect-to-welcome", total.connectToWelcome);
+    printLatency("turn round trip", total.turnRtt);
+
+    return total.failed == 0 ? 0 : 1;
+}
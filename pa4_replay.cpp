@@ -0,0 +1,664 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Traffic replay
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+#include "recorder.h"
+#include "histogram.h"
+
+using namespace std;
+
+// a session waiting this long for the server fails
+const uint64_t REPLY_TIMEOUT_NS = 30ULL * 1000000000;
+
+// one recorded event of a session
+struct ReplayEvent
+{
+    TraceEvent type;
+    uint64_t delta; // us since the session's previous event
+    size_t offset;  // into the session's client or server bytes
+    size_t length;
+};
+
+enum ReplayState
+{
+    PENDING,    // not started yet
+    CONNECTING, // waiting for connect() to finish
+    RUNNING,
+    DONE
+};
+
+// one recorded session and how far its replay got
+struct ReplaySession
+{
+    uint64_t id;
+    uint64_t startedAt; // us from the trace start
+    vector<ReplayEvent> events;
+    string fromClient; // bytes to send, in order
+    string toClient;   // bytes the server sent, in order
+
+    ReplayState state;
+    int sock;
+    size_t next;       // first event not replayed yet
+    string out;
+    size_t outPos;
+    size_t received;   // bytes from the server so far
+    size_t receivedAtSend; // received when the last client bytes went out
+    bool diverged;     // the server sent something else
+    uint64_t lastAt;   // ns, when the previous event was replayed
+    uint64_t lastSend; // ns, when the last client bytes went out
+    bool awaitingReply; // a reply to lastSend is still to come
+    uint64_t timeoutAt; // ns, when waiting on the server fails it
+};
+
+// everything main() reads from the command line
+struct ReplayConfig
+{
+    struct sockaddr_in servAddr;
+    struct sockaddr_un localAddr;
+    bool local; // connect to localAddr instead of servAddr
+    double speed; // 2 replays twice as fast
+};
+
+struct ReplayStats
+{
+    Histogram recordedReply; // request to reply inside the recorded server
+    Histogram replayedReply; // request to reply here, network included
+    long completed; // the server sent exactly what was recorded
+    long diverged;
+    long failed;
+
+    ReplayStats() : completed(0), diverged(0), failed(0) {}
+};
+
+// monotonic clock in nanoseconds
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// read the whole trace, exits if it is not one; a partial chunk at the
+// end, from a server that was killed while writing, is left out
+static vector<ReplaySession *> loadTrace(const char *path, uint32_t &flags,
+                                         uint64_t &seed)
+{
+    ifstream file(path, ios::binary);
+    if (!file)
+    {
+        cerr << "Error opening trace " << path << endl;
+        exit(EXIT_FAILURE);
+    }
+    stringstream contents;
+    contents << file.rdbuf();
+    string trace = contents.str();
+
+    if (trace.size() < TRACE_HEADER_SIZE ||
+        memcmp(trace.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        getU32(trace.data() + 8) != TRACE_VERSION)
+    {
+        cerr << "Error: " << path << " is not a trace from --record" << endl;
+        exit(EXIT_FAILURE);
+    }
+    flags = getU32(trace.data() + 12);
+    seed = getU64(trace.data() + 16);
+
+    // chunks of a session follow each other in order
+    map<uint64_t, ReplaySession *> byId;
+    size_t pos = TRACE_HEADER_SIZE;
+    while (trace.size() - pos >= TRACE_CHUNK_HEADER_SIZE)
+    {
+        const char *bp = trace.data() + pos;
+        uint64_t id = getU64(bp);
+        uint64_t startedAt = getU64(bp + 8);
+        size_t length = getU32(bp + 16);
+        if (trace.size() - pos - TRACE_CHUNK_HEADER_SIZE < length)
+        {
+            break;
+        }
+        pos += TRACE_CHUNK_HEADER_SIZE;
+
+        ReplaySession *&session = byId[id];
+        if (session == NULL)
+        {
+            session = new ReplaySession;
+            session->id = id;
+            session->startedAt = startedAt;
+        }
+
+        size_t end = pos + length;
+        while (end - pos >= TRACE_EVENT_HEADER_SIZE)
+        {
+            bp = trace.data() + pos;
+            ReplayEvent event;
+            event.type = (TraceEvent)(unsigned char)bp[0];
+            event.delta = getU32(bp + 1);
+            event.length = getU32(bp + 5);
+            pos += TRACE_EVENT_HEADER_SIZE;
+            if (end - pos < event.length || event.type > TRACE_CLOSED)
+            {
+                cerr << "Error: corrupt chunk in " << path << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            string &bytes = event.type == TRACE_RECEIVED
+                                ? session->fromClient
+                                : session->toClient;
+            event.offset = bytes.size();
+            bytes.append(trace.data() + pos, event.length);
+            pos += event.length;
+            session->events.push_back(event);
+        }
+        pos = end;
+    }
+    if (pos != trace.size())
+    {
+        cerr << "Warning: " << path << " ends in a partial chunk" << endl;
+    }
+
+    vector<ReplaySession *> sessions;
+    map<uint64_t, ReplaySession *>::iterator it;
+    for (it = byId.begin(); it != byId.end(); ++it)
+    {
+        sessions.push_back(it->second);
+    }
+    sort(sessions.begin(), sessions.end(),
+         [](const ReplaySession *a, const ReplaySession *b) {
+             return a->startedAt < b->startedAt;
+         });
+    return sessions;
+}
+
+/* Plays every session of a trace against a server from one epoll loop.
+
+   Sessions connect at their recorded start times, so as many are open
+   at once as when they were recorded. Within a session the client's
+   bytes go out once the server has sent everything recorded before
+   them, after the pause the client took then. The reply times of the
+   server under test are compared with the recorded ones. A session
+   whose server sends something else (another treasure, other ranks,
+   another build's messages) is counted as diverged, and from then on
+   each of its client sends only waits for some reply to the one before.
+   --speed divides every start time and pause. */
+class ReplayLoop
+{
+public:
+    ReplayLoop(const ReplayConfig &config, vector<ReplaySession *> &sessions)
+        : config(config), sessions(sessions), started(0), active(0)
+    {
+    }
+
+    void run();
+
+    ReplayStats stats;
+
+private:
+    void startSession(ReplaySession *session, uint64_t now);
+    void finishSession(ReplaySession *session, bool ok);
+    void advance(ReplaySession *session, uint64_t now);
+    bool flush(ReplaySession *session);
+    bool readInput(ReplaySession *session);
+    uint64_t scaled(uint64_t us) const
+    {
+        return (uint64_t)(us * 1000 / config.speed);
+    }
+
+    const ReplayConfig &config;
+    vector<ReplaySession *> &sessions;
+    int epfd;
+    size_t started;
+    long active;
+
+    // sessions to look at again, earliest first
+    typedef pair<uint64_t, ReplaySession *> Timer;
+    priority_queue<Timer, vector<Timer>, greater<Timer> > timers;
+};
+
+void ReplayLoop::startSession(ReplaySession *session, uint64_t now)
+{
+    session->state = CONNECTING;
+    session->next = 0;
+    session->outPos = 0;
+    session->received = 0;
+    session->receivedAtSend = 0;
+    session->diverged = false;
+    session->lastAt = now;
+    session->lastSend = now;
+    session->awaitingReply = false;
+    session->timeoutAt = now + REPLY_TIMEOUT_NS;
+    session->sock = socket(config.local ? AF_UNIX : AF_INET,
+                           SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (session->sock < 0)
+    {
+        session->state = DONE;
+        stats.failed++;
+        return;
+    }
+
+    int status;
+    if (config.local)
+    {
+        status = connect(session->sock, (struct sockaddr *)&config.localAddr,
+                         sizeof(config.localAddr));
+    }
+    else
+    {
+        int one = 1;
+        setsockopt(session->sock, IPPROTO_TCP, TCP_NODELAY, &one,
+                   sizeof(one));
+        status = connect(session->sock, (struct sockaddr *)&config.servAddr,
+                         sizeof(config.servAddr));
+    }
+    if (status < 0 && errno != EINPROGRESS)
+    {
+        close(session->sock);
+        session->state = DONE;
+        stats.failed++;
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = session;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, session->sock, &event);
+    active++;
+
+    // a server that never answers
+    timers.push(Timer(session->timeoutAt, session));
+}
+
+void ReplayLoop::finishSession(ReplaySession *session, bool ok)
+{
+    if (session->diverged)
+    {
+        stats.diverged++;
+    }
+    else if (ok)
+    {
+        stats.completed++;
+    }
+    else
+    {
+        stats.failed++;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, session->sock, NULL);
+    close(session->sock);
+    session->state = DONE;
+    session->out.clear();
+    active--;
+}
+
+// replay every event that is due
+void ReplayLoop::advance(ReplaySession *session, uint64_t now)
+{
+    while (session->next < session->events.size())
+    {
+        const ReplayEvent &event = session->events[session->next];
+
+        if (event.type == TRACE_SENT)
+        {
+            // wait for the server's bytes; a diverged server's replies
+            // have other lengths, any reply to the last send will do
+            bool arrived = session->diverged
+                               ? session->received > session->receivedAtSend
+                               : session->received >=
+                                     event.offset + event.length;
+            if (!arrived)
+            {
+                if (now >= session->lastAt + REPLY_TIMEOUT_NS)
+                {
+                    finishSession(session, false);
+                }
+                else if (session->timeoutAt != session->lastAt +
+                                                   REPLY_TIMEOUT_NS)
+                {
+                    session->timeoutAt = session->lastAt + REPLY_TIMEOUT_NS;
+                    timers.push(Timer(session->timeoutAt, session));
+                }
+                return;
+            }
+
+            if (session->awaitingReply && !session->diverged)
+            {
+                stats.recordedReply.record(event.delta * 1000);
+                stats.replayedReply.record(now - session->lastSend);
+            }
+            session->awaitingReply = false;
+            session->lastAt = now;
+            session->next++;
+            continue;
+        }
+
+        if (event.type == TRACE_CLOSED)
+        {
+            break;
+        }
+
+        // the client's next bytes, after its recorded pause
+        uint64_t due = session->lastAt + scaled(event.delta);
+        if (now < due)
+        {
+            timers.push(Timer(due, session));
+            return;
+        }
+
+        session->out.append(session->fromClient, event.offset, event.length);
+        session->receivedAtSend = session->received;
+        session->lastSend = now;
+        session->lastAt = now;
+        session->awaitingReply = true;
+        session->next++;
+        if (!flush(session))
+        {
+            finishSession(session, false);
+            return;
+        }
+    }
+
+    // everything was replayed, the recorded server closed here
+    finishSession(session, true);
+}
+
+bool ReplayLoop::flush(ReplaySession *session)
+{
+    while (session->outPos < session->out.size())
+    {
+        ssize_t bytesSent = send(session->sock,
+                                 session->out.data() + session->outPos,
+                                 session->out.size() - session->outPos,
+                                 MSG_NOSIGNAL);
+        if (bytesSent < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        session->outPos += bytesSent;
+    }
+
+    session->out.clear();
+    session->outPos = 0;
+    return true;
+}
+
+// false once the server closed or failed
+bool ReplayLoop::readInput(ReplaySession *session)
+{
+    char buffer[16384];
+
+    while (true)
+    {
+        ssize_t bytesRecv = recv(session->sock, buffer, sizeof(buffer), 0);
+        if (bytesRecv < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (bytesRecv == 0)
+        {
+            return false;
+        }
+
+        // compare with what the recorded server sent at the same point
+        const string &expected = session->toClient;
+        size_t at = session->received;
+        if (!session->diverged &&
+            (at + bytesRecv > expected.size() ||
+             memcmp(buffer, expected.data() + at, bytesRecv) != 0))
+        {
+            session->diverged = true;
+        }
+        session->received += bytesRecv;
+    }
+}
+
+void ReplayLoop::run()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        cerr << "Error creating epoll instance" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t origin = nowNs();
+    uint64_t first = sessions.empty() ? 0 : sessions[0]->startedAt;
+    for (size_t i = 0; i < sessions.size(); i++)
+    {
+        sessions[i]->state = PENDING;
+    }
+    vector<struct epoll_event> events(256);
+
+    while (started < sessions.size() || active > 0)
+    {
+        uint64_t now = nowNs();
+
+        // sessions whose recorded start time came
+        while (started < sessions.size() &&
+               origin + scaled(sessions[started]->startedAt - first) <= now)
+        {
+            startSession(sessions[started++], now);
+        }
+
+        // pauses that are over, and servers that may have timed out
+        while (!timers.empty() && timers.top().first <= now)
+        {
+            ReplaySession *session = timers.top().second;
+            timers.pop();
+            if (session->state == RUNNING)
+            {
+                advance(session, now);
+            }
+            else if (session->state == CONNECTING)
+            {
+                finishSession(session, false);
+            }
+        }
+
+        // sleep until the next start or timer
+        uint64_t wakeAt = UINT64_MAX;
+        if (started < sessions.size())
+        {
+            wakeAt = origin + scaled(sessions[started]->startedAt - first);
+        }
+        if (!timers.empty() && timers.top().first < wakeAt)
+        {
+            wakeAt = timers.top().first;
+        }
+        int timeout = -1;
+        if (wakeAt != UINT64_MAX)
+        {
+            timeout = wakeAt > now ? (int)((wakeAt - now + 999999) / 1000000)
+                                   : 0;
+        }
+
+        int count = epoll_wait(epfd, events.data(), events.size(), timeout);
+        now = nowNs();
+        for (int i = 0; i < count; i++)
+        {
+            ReplaySession *session = (ReplaySession *)events[i].data.ptr;
+            uint32_t ready = events[i].events;
+            if (session->state == DONE)
+            {
+                continue;
+            }
+
+            if (session->state == CONNECTING)
+            {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(session->sock, SOL_SOCKET, SO_ERROR, &error,
+                           &length);
+                if (error != 0 || (ready & (EPOLLERR | EPOLLHUP)))
+                {
+                    finishSession(session, false);
+                    continue;
+                }
+                session->state = RUNNING;
+            }
+
+            bool open = true;
+            if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                open = readInput(session);
+            }
+            if (open)
+            {
+                open = flush(session);
+            }
+            if (open)
+            {
+                advance(session, now);
+                continue;
+            }
+
+            // the server hung up, fine once it sent everything recorded
+            advance(session, now);
+            if (session->state != DONE)
+            {
+                finishSession(session,
+                              session->received == session->toClient.size());
+            }
+        }
+    }
+
+    close(epfd);
+}
+
+// print one latency histogram in microseconds
+static void printLatency(const char *name, const Histogram &histogram)
+{
+    cout << name << " (us): p50 " << histogram.percentile(0.50) / 1000.0
+         << "  p99 " << histogram.percentile(0.99) / 1000.0
+         << "  p999 " << histogram.percentile(0.999) / 1000.0
+         << "  max " << histogram.max() / 1000.0
+         << "  mean " << histogram.mean() / 1000.0 << endl;
+}
+
+// prints usage and exits
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [options] TRACE [IP address] "
+            "[port number]\n"
+         << "       " << prog << " [options] --unix PATH TRACE\n"
+         << "  --speed X        replay X times faster than recorded "
+            "(default: 1)\n"
+         << "  --unix PATH      connect to the server's Unix domain socket"
+         << endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    ReplayConfig config;
+    config.local = false;
+    config.speed = 1;
+
+    static struct option options[] = {
+        {"speed", required_argument, NULL, 'x'},
+        {"unix", required_argument, NULL, 'u'},
+        {NULL, 0, NULL, 0}};
+
+    string unixPath;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'x':
+            config.speed = atof(optarg);
+            break;
+        case 'u':
+            config.local = true;
+            unixPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind != (config.local ? 1 : 3) || !(config.speed > 0) ||
+        unixPath.size() >= sizeof(config.localAddr.sun_path))
+    {
+        usage(argv[0]);
+    }
+
+    memset(&config.localAddr, 0, sizeof(config.localAddr));
+    config.localAddr.sun_family = AF_UNIX;
+    strncpy(config.localAddr.sun_path, unixPath.c_str(),
+            sizeof(config.localAddr.sun_path) - 1);
+
+    // Convert dotted decimal address to int
+    memset(&config.servAddr, 0, sizeof(config.servAddr));
+    config.servAddr.sin_family = AF_INET;
+    if (!config.local)
+    {
+        config.servAddr.sin_port =
+            htons((unsigned short)stoi(argv[optind + 2]));
+        if (inet_pton(AF_INET, argv[optind + 1],
+                      &config.servAddr.sin_addr) != 1)
+        {
+            cerr << "Invalid IP address" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint32_t flags;
+    uint64_t seed;
+    vector<ReplaySession *> sessions = loadTrace(argv[optind], flags, seed);
+
+    // the same treasures need the same seed and the same session order
+    cout << "trace: " << sessions.size() << " sessions, ";
+    if (flags & TRACE_SEEDED)
+    {
+        cout << "recorded with --seed " << seed << endl;
+    }
+    else
+    {
+        cout << "recorded without --seed, treasures will differ" << endl;
+    }
+
+    ReplayLoop loop(config, sessions);
+    uint64_t start = nowNs();
+    loop.run();
+    double seconds = (nowNs() - start) / 1e9;
+
+    const ReplayStats &stats = loop.stats;
+    cout << fixed << setprecision(1);
+    cout << "sessions: " << stats.completed << " completed, "
+         << stats.diverged << " diverged, " << stats.failed << " failed in "
+         << seconds << " s" << endl;
+    cout << "replies: " << stats.replayedReply.count() << endl;
+    printLatency("recorded reply, server side", stats.recordedReply);
+    printLatency("replayed reply, client side", stats.replayedReply);
+
+    for (size_t i = 0; i < sessions.size(); i++)
+    {
+        delete sessions[i];
+    }
+
+    return stats.failed == 0 ? 0 : 1;
+}
@@ -7,504 +7,855 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <iostream>
 #include <cstring>
 #include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <cerrno>
-#include <random>
-#include <cmath>
-#include <vector>
-#include <algorithm>
 #include <climits>
+#include <algorithm>
+#include <string>
+#include <vector>
 
-using namespace std;
+#include "game.h"
+#include "session.h"
+#include "epoll_server.h"
+#include "uring_server.h"
+#include "worker_pool.h"
+#include "server_config.h"
+#include "treasure.h"
+#include "leaderboard.h"
+#include "journal.h"
+#include "metrics.h"
+#include "reaper.h"
+#include "admission.h"
+#include "room.h"
+#include "distance.h"
+#include "shared_board.h"
+#include "rank_index.h"
+#include "local_server.h"
+#include "handoff.h"
+#include "recorder.h"
 
-pthread_mutex_t mutex; // lock for critical sections
+using namespace std;
 
-struct Message // struct to store received messages
+// send everything the session queued, false on error
+static bool flushSession(int clientSock, Session &session)
 {
-    char *data;    // pointer to message data
-    size_t length; // length of the message
-};
+    while (session.pendingLength() > 0)
+    {
+        int bytesSent = send(clientSock, session.pendingData(),
+                             session.pendingLength(), MSG_NOSIGNAL);
+        if (bytesSent <= 0)
+        {
+            return false;
+        }
+        session.consumed(bytesSent);
+    }
 
-// prints appropriate error
-void printError(string action, string object)
-{
-    cout << "Failure to " << action << " " << object << endl;
+    return true;
 }
 
-// send a message to client
-bool sendMessage(int clientSock, const char *message)
+// run the session until it ends or fails, the reaper shuts the socket
+// down if the client misses a deadline
+static void playSession(int clientSock, Session &session, ReapEntry &entry)
 {
-    int bytesSent = send(clientSock, (void *)message, strlen(message), 0);
+    while (true)
+    {
+        reaper.arm(&entry, session.deadline());
+
+        if (!flushSession(clientSock, session))
+        {
+            printError("send", session.sending());
+            return;
+        }
+
+        // keep playing until user leaves or guess is correct
+        if (session.done())
+        {
+            return;
+        }
 
-    return bytesSent == strlen(message);
+        size_t room;
+        char *space = session.inputSpace(room);
+        int bytesRecv = room == 0 ? -1 : recv(clientSock, space, room, 0);
+        if (bytesRecv <= 0 || !session.onReceived(bytesRecv))
+        {
+            // print an error message and close connection with client
+            printError("receive", session.receiving());
+            return;
+        }
+    }
 }
 
-struct player
+// play the game
+void playGame(int clientSock)
 {
-    // data fields
-    string name;
-    int tries;
+    Session session;
+    ReapEntry entry(clientSock);
 
-    // Default constructor
-    player() : name(""), tries(0) {}
+    // Send welcome message to the client
+    session.start();
+    playSession(clientSock, session, entry);
 
-    // Parameterized constructor to initialize player with name and tries
-    player(char *name, int tries)
-    {
-        this->name = name;
-        this->tries = tries;
-    }
-};
+    // the socket is closed next and must not be shut down after that
+    reaper.cancel(&entry);
+    admission.release();
+}
 
-struct leaderBoard
+// arguments for thread function
+struct ThreadArgs
 {
-    vector<player> players;
+    int clientSock;
 };
 
-leaderBoard board; // leaderboard to store top 3 players
+// arguments for the thread of a handed over session
+struct AdoptArgs
+{
+    int clientSock;
+    string state;
+};
 
-struct treasureLocation // store treasure location
+// play a session the previous server handed over
+static void *adoptedMain(void *args)
 {
-    long x;
-    long y;
+    AdoptArgs *adoptArgs = (AdoptArgs *)args;
+    int clientSock = adoptArgs->clientSock;
 
-    // Parameterized constructor to initialize location with x and y
-    treasureLocation(long x, long y)
+    Session session;
+    if (session.importState(adoptArgs->state.data(),
+                            adoptArgs->state.size()))
     {
-        this->x = x;
-        this->y = y;
+        ReapEntry entry(clientSock);
+        playSession(clientSock, session, entry);
+        reaper.cancel(&entry);
     }
-};
+    else
+    {
+        printError("adopt", "handed over session");
+    }
+    delete adoptArgs;
+
+    admission.release();
+    close(clientSock);
+    return NULL;
+}
 
-// receive integer from client
-long receiveInt(int clientSock)
+// give a handed over session a thread of its own, in thread and pool
+// modes
+static void adoptSession(int clientSock, const string &state)
 {
-    int bytesLeft = sizeof(long);
-    long networkInt;
+    // the old server's event loop made the socket non-blocking
+    int flags = fcntl(clientSock, F_GETFL, 0);
+    if (flags >= 0)
+    {
+        fcntl(clientSock, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    admission.adopt();
 
-    // char * used because char is 1 byte
-    char *bp = (char *)&networkInt;
+    AdoptArgs *args = new AdoptArgs;
+    args->clientSock = clientSock;
+    args->state = state;
 
-    while (bytesLeft)
+    pthread_t threadID;
+    if (pthread_create(&threadID, NULL, adoptedMain, (void *)args) != 0)
     {
-        int bytesRecv = recv(clientSock, bp, bytesLeft, 0);
+        printError("create", "session thread");
+        delete args;
+        close(clientSock);
+        admission.release();
+        return;
+    }
+    pthread_detach(threadID);
+}
 
-        if (bytesRecv <= 0)
-        {
-            // return a value for failure
-            return LONG_MIN;
-        }
+// thread argument function
+void *threadMain(void *args)
+{
+    // Extract socket file descriptor from argument
+    struct ThreadArgs *threadArgs = (struct ThreadArgs *)args;
+    int clientSock = threadArgs->clientSock;
+    delete threadArgs;
 
-        bytesLeft -= bytesRecv;
-        bp += bytesRecv;
-    }
+    // Communicate with client
+    playGame(clientSock);
 
-    // convert int to host order before returning it
-    int hostInt = ntohl(networkInt);
+    // Reclaim ressources before finishing
+    pthread_detach(pthread_self());
+    close(clientSock);
 
-    return hostInt;
-};
+    return NULL;
+}
 
-// receive message from client
-Message receiveMessage(int clientSock, int hostInt)
+// prints usage and exits
+static void usage(const char *prog)
 {
-    int msgLen = hostInt;
-    char *buffer = new char[msgLen];
-    char *bp = buffer;
-    Message result;
+    cerr << "Usage: " << prog << " [options] [port number]\n"
+         << "  --mode thread|pool|epoll|uring\n"
+         << "                            thread per connection (default), "
+            "worker pool, event loops\n"
+         << "                            or io_uring event loops (falls back "
+            "to epoll)\n"
+         << "  --loops N                 event loop threads in epoll and "
+            "uring modes "
+            "(default: 1 per core)\n"
+         << "  --workers N               worker threads in pool mode "
+            "(default: 64)\n"
+         << "  --queue N                 accepted sockets waiting for a "
+            "worker (default: 1024)\n"
+         << "  --overflow shed|block     what to do when that queue is full "
+            "(default: block)\n"
+         << "  --stack KB                stack size of session threads\n"
+         << "  --pin                     pin pool workers to cpus\n"
+         << "  --treasure-pool N         pre-generated treasure locations "
+            "(default: 4096)\n"
+         << "  --seed N                  same treasure sequence on every run\n"
+         << "  --max-frame BYTES         largest name or frame a client may "
+            "send (default: " << DEFAULT_MAX_FRAME << ")\n"
+         << "  --admin-port N            serve metrics on 127.0.0.1:N\n"
+         << "  --log-level LEVEL         error, warn, info (default) or "
+            "debug\n"
+         << "  --handshake-timeout SEC   time to send the name (default: 30)\n"
+         << "  --turn-timeout SEC        time to send each guess "
+            "(default: 120)\n"
+         << "  --session-timeout SEC     longest session (default: 1800), "
+            "0 disables any of these\n"
+         << "  --backlog N               pending connections the kernel "
+            "queues (default: " << SOMAXCONN << ")\n"
+         << "  --max-sessions N          sessions at once, 0 for no limit "
+            "(default: 0)\n"
+         << "  --busy-reply              tell clients over the limit the "
+            "server is busy\n"
+         << "  --data-dir DIR            keep the leaderboard in DIR across "
+            "restarts\n"
+         << "  --room-size N             v2 players hunting one treasure "
+            "together, epoll and\n"
+         << "                            uring modes only, at most "
+         << MAX_ROOM_PLAYERS << " (default: 0,\n"
+         << "                            everyone alone)\n"
+         << "  --processes N             worker processes sharing the port "
+            "and leaderboard,\n"
+         << "                            limits and metrics are per "
+            "process, the first one\n"
+         << "                            serves the admin port (default: 1)\n"
+         << "  --unix PATH               also serve local clients on a Unix "
+            "domain socket,\n"
+         << "                            where they may switch to shared "
+            "memory rings\n"
+         << "  --handoff PATH            take over from the server waiting "
+            "on PATH without\n"
+         << "                            refusing a connect, then wait there "
+            "for the next one\n"
+         << "  --record FILE             write the traffic of every session "
+            "to FILE, with the\n"
+         << "                            treasure seed, for pa4_replay"
+         << endl;
+    exit(EXIT_FAILURE);
+}
 
-    while (msgLen > 0)
+// read the command line into config, exits on bad arguments
+static void parseArgs(int argc, char **argv, ServerConfig &config)
+{
+    static struct option options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"loops", required_argument, NULL, 'l'},
+        {"workers", required_argument, NULL, 'w'},
+        {"queue", required_argument, NULL, 'q'},
+        {"overflow", required_argument, NULL, 'o'},
+        {"stack", required_argument, NULL, 's'},
+        {"pin", no_argument, NULL, 'p'},
+        {"treasure-pool", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 'S'},
+        {"max-frame", required_argument, NULL, 'f'},
+        {"admin-port", required_argument, NULL, 'A'},
+        {"log-level", required_argument, NULL, 'L'},
+        {"handshake-timeout", required_argument, NULL, 'H'},
+        {"turn-timeout", required_argument, NULL, 'T'},
+        {"session-timeout", required_argument, NULL, 'D'},
+        {"backlog", required_argument, NULL, 'B'},
+        {"max-sessions", required_argument, NULL, 'M'},
+        {"busy-reply", no_argument, NULL, 'R'},
+        {"data-dir", required_argument, NULL, 'd'},
+        {"room-size", required_argument, NULL, 'r'},
+        {"processes", required_argument, NULL, 'P'},
+        {"unix", required_argument, NULL, 'U'},
+        {"handoff", required_argument, NULL, 'h'},
+        {"record", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}};
+
+    config.loops = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    string overflow = "block";
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
     {
-        int bytesRecv = recv(clientSock, bp, msgLen, 0);
-        if (bytesRecv <= 0)
+        switch (opt)
         {
-            // Free the allocated memory
-            delete[] buffer;
-
-            // Return an "empty" message for failure
-            result.data = nullptr;
-            result.length = 0;
-            return result;
+        case 'm':
+            config.mode = optarg;
+            break;
+        case 'l':
+            config.loops = atoi(optarg);
+            break;
+        case 'w':
+            config.pool.workers = atoi(optarg);
+            break;
+        case 'q':
+            config.pool.queueSize = atol(optarg);
+            break;
+        case 'o':
+            overflow = optarg;
+            break;
+        case 's':
+            config.pool.stackSize = atol(optarg) * 1024;
+            break;
+        case 'p':
+            config.pool.pin = true;
+            break;
+        case 't':
+            config.treasurePool = atol(optarg);
+            break;
+        case 'S':
+            config.seeded = true;
+            config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            config.maxFrame = atol(optarg);
+            break;
+        case 'A':
+            config.adminPort = (unsigned short)atoi(optarg);
+            break;
+        case 'L':
+            if (!Logger::parseLevel(optarg, config.logLevel))
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'H':
+            config.handshakeTimeout = atol(optarg);
+            break;
+        case 'T':
+            config.turnTimeout = atol(optarg);
+            break;
+        case 'D':
+            config.sessionTimeout = atol(optarg);
+            break;
+        case 'B':
+            config.backlog = atoi(optarg);
+            break;
+        case 'M':
+            config.maxSessions = atol(optarg);
+            break;
+        case 'R':
+            config.busyReply = true;
+            break;
+        case 'd':
+            config.dataDir = optarg;
+            break;
+        case 'r':
+            config.roomSize = atol(optarg);
+            break;
+        case 'P':
+            config.processes = atoi(optarg);
+            break;
+        case 'U':
+            config.unixPath = optarg;
+            break;
+        case 'h':
+            config.handoffPath = optarg;
+            break;
+        case 'c':
+            config.recordPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
         }
-        msgLen -= bytesRecv;
-        bp += bytesRecv;
     }
 
-    // return received message
-    result.data = buffer;
-    result.length = hostInt;
+    // check if all arguments are provided
+    if (argc - optind != 1 ||
+        (config.mode != "thread" && config.mode != "pool" &&
+         config.mode != "epoll" && config.mode != "uring") ||
+        (overflow != "shed" && overflow != "block") ||
+        config.loops < 1 || config.pool.workers < 1 ||
+        config.pool.queueSize < 1 || config.treasurePool < 1 ||
+        config.maxFrame < 2 * V1_INT_SIZE ||
+        config.maxFrame > DEFAULT_MAX_FRAME || config.handshakeTimeout < 0 ||
+        config.turnTimeout < 0 || config.sessionTimeout < 0 ||
+        config.backlog < 1 || config.maxSessions < 0 ||
+        config.roomSize < 0 || config.roomSize > (long)MAX_ROOM_PLAYERS ||
+        (config.roomSize > 0 && config.mode != "epoll" &&
+         config.mode != "uring") ||
+        config.processes < 1 ||
+        config.unixPath.size() >= sizeof(((sockaddr_un *)0)->sun_path) ||
+        config.handoffPath.size() >= sizeof(((sockaddr_un *)0)->sun_path))
+    {
+        usage(argv[0]);
+    }
 
-    return result;
-};
+    // one journal file cannot take appends from several processes
+    if (config.processes > 1 && !config.dataDir.empty())
+    {
+        cerr << "Error: --data-dir needs a single process" << endl;
+        exit(EXIT_FAILURE);
+    }
 
-// send int to client
-bool sendInt(int sock, long hostInt)
-{
-    // convert int to network order before sending
-    long networkInt = htonl(hostInt);
-    long bytesSent = send(sock, (void *)&networkInt, sizeof(long), 0);
+    // nor can one trace, whose session ids and clock are per process
+    if (config.processes > 1 && !config.recordPath.empty())
+    {
+        cerr << "Error: --record needs a single process" << endl;
+        exit(EXIT_FAILURE);
+    }
 
-    return bytesSent == sizeof(long);
-}
+    // only one process's listeners and event loops can be handed over,
+    // io_uring loops cannot give their accepts back
+    if (!config.handoffPath.empty() &&
+        (config.processes > 1 || config.mode == "uring"))
+    {
+        cerr << "Error: --handoff needs a single process outside uring mode"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
 
-// send distance to the treasure to client
-bool sendDistance(int sock, double hostDouble)
-{
-    // send the double to the specified socket
-    double bytesSent = send(sock, (void *)&hostDouble, sizeof(double), 0);
+    config.pool.overflow = overflow == "shed" ? SHED : BLOCK;
 
-    return bytesSent == sizeof(double);
+    // read port number from command line
+    config.port = (short)stoi(argv[optind]);
 }
 
-// calculate distance between treasure location and user guess
-double calcDist(long randomX, long randomY, long userX, long userY)
+// load the leaderboard kept in dir and log every game there from now on
+static bool startJournal(const string &dir)
 {
-    return sqrt(pow((randomX - userX), 2) + pow((randomY - userY), 2));
+    leaderBoard recovered;
+    unsigned long lastId = 0;
+    vector<uint64_t> finishedByTries;
+    if (!journal.start(dir, recovered, lastId, finishedByTries))
+    {
+        return false;
+    }
+    leaderboard.restore(recovered, lastId);
+    ranks.restore(finishedByTries);
+
+    return true;
 }
 
-// generate random int
-long generateLong()
+// hand every accepted socket to the worker pool
+static void runPoolServer(int sock, const WorkerPoolConfig &poolConfig)
 {
-    // Use a random_device to seed the random number generator
-    random_device rd;
-
-    // Use the random_device to seed the random engine
-    mt19937 gen(rd());
-
-    // Define the distribution for the range -100 to 100 (inclusive)
-    uniform_int_distribution<long> distribution(-100, 100);
+    WorkerPool pool(poolConfig, playGame);
+    if (!pool.start())
+    {
+        return;
+    }
 
-    // Generate a random number
-    long randomNumber = distribution(gen);
+    while (true)
+    {
+        // the sessions left finish before the process exits
+        int clientSock = admission.acceptSession(sock);
+        if (clientSock < 0)
+        {
+            handoff.waitForExit();
+        }
 
-    return randomNumber;
+        // every worker busy and queue full
+        if (!pool.submit(clientSock))
+        {
+            close(clientSock);
+            admission.release();
+        }
+    }
 }
 
-// update leaderboard
-void updateBoard(leaderBoard &board, const player newPlayer)
+// start the threads and state a serving process needs, exits on failure;
+// admin says whether this process serves the metrics port, localSock is
+// the Unix domain listener or -1
+static void startServices(const ServerConfig &config, bool admin,
+                          int localSock)
 {
-    // Add the new player to the leaderboard
-    board.players.push_back(newPlayer);
-
-    // Sort the players based on their number of tries in ascending order
-    sort(board.players.begin(), board.players.end(), [](const player &a, 
-    const player &b){ return a.tries < b.tries; });
+    // a handoff waits for the last session before exiting
+    if (!config.handoffPath.empty())
+    {
+        admission.trackSessions();
+    }
 
-    // Keep only the top 3 players
-    if (board.players.size() > 3)
+    // fill the treasure pool before the first session needs it
+    if (!logger.start(config.logLevel) ||
+        !treasures.start(config.treasurePool, config.seeded, config.seed) ||
+        (!config.recordPath.empty() &&
+         !recorder.start(config.recordPath, treasures.isSeeded(),
+                         treasures.getSeed())) ||
+        (!config.dataDir.empty() && !startJournal(config.dataDir)) ||
+        !leaderboard.start() ||
+        (admin && config.adminPort != 0 &&
+         !metrics.start(config.adminPort, !config.handoffPath.empty())) ||
+        ((config.mode == "thread" || config.mode == "pool" ||
+          localSock >= 0) &&
+         !reaper.start()) ||
+        !admission.start(config.maxSessions, config.busyReply) ||
+        (localSock >= 0 && !startLocalServer(localSock)))
     {
-        board.players.resize(3);
+        exit(EXIT_FAILURE);
     }
 }
 
-// play the game
-void playGame(int clientSock)
+// create, bind and listen on the game port, exits on failure
+static int openListener(const ServerConfig &config)
 {
-    // initialize lock
-    pthread_mutex_init(&mutex, NULL);
-
-    // Send welcome message to the client
-    const char *message = "Welcome to Treasure Hunt\nEnter your name: ";
+    // create a TCP socket
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
-    // length
-    if (!sendInt(clientSock, strlen(message)))
+    if (sock < 0)
     {
-        printError("send", "welcome message length");
-        return;
+        cerr << "Error creating server socket" << endl;
+        exit(EXIT_FAILURE);
     }
 
-    // message
-    if (!sendMessage(clientSock, message))
+    // worker processes each bind the port, the kernel spreads new
+    // connections across their listen queues
+    int reuse = 1;
+    if (config.processes > 1 &&
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
     {
-        printError("send", "welcome message");
-        return;
+        cerr << "Error setting SO_REUSEPORT" << endl;
+        close(sock);
+        exit(EXIT_FAILURE);
     }
 
-    long usrnameLength = receiveInt(clientSock);
-    if (usrnameLength == LONG_MIN)
+    // set the fields
+    struct sockaddr_in servAddr;
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servAddr.sin_port = htons(config.port);
+
+    // bind port to socket
+    int status = bind(sock, (struct sockaddr *)&servAddr, sizeof(servAddr));
+
+    if (status < 0)
     {
-        // print an error message and close connection with client
-        printError("receive", "username length");
-        return;
+        // print out an error message if unsuccessful
+        cerr << "Error with bind" << endl;
+        close(sock);
+        exit(EXIT_FAILURE);
     }
 
-    // receive username
-    Message msg = receiveMessage(clientSock, usrnameLength);
+    // set socket to listen
+    status = listen(sock, config.backlog);
 
-    if (msg.data == nullptr)
+    if (status < 0)
     {
-        printError("receive", "username");
-        return;
+        cerr << "Error with listen" << endl;
+        close(sock);
+        exit(EXIT_FAILURE);
     }
 
-    // initialize a new player
-    player newPlayer = player(msg.data, 0);
+    return sock;
+}
 
-    // generate random location
-    long randomX = generateLong();
-    long randomY = generateLong();
-    treasureLocation location = treasureLocation(randomX, randomY);
+// create, bind and listen on the Unix domain socket, replacing a file
+// left there by an earlier run; exits on failure
+static int openLocalListener(const ServerConfig &config)
+{
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
-    const char *playMsg = "Enter a guess (x y) : ";
+    if (sock < 0)
+    {
+        cerr << "Error creating local socket" << endl;
+        exit(EXIT_FAILURE);
+    }
 
-    long userX;
-    long userY;
+    struct sockaddr_un localAddr;
+    memset(&localAddr, 0, sizeof(localAddr));
+    localAddr.sun_family = AF_UNIX;
+    strncpy(localAddr.sun_path, config.unixPath.c_str(),
+            sizeof(localAddr.sun_path) - 1);
 
-    // print treasure location on the server console
-    cout << "Tresure is located at (" << randomX << ", " << randomY << ")\n";
+    unlink(config.unixPath.c_str());
+    if (bind(sock, (struct sockaddr *)&localAddr, sizeof(localAddr)) < 0)
+    {
+        cerr << "Error with bind on " << config.unixPath << endl;
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
-    do
-    { // keep playing until user leaves or guess is correct
+    if (listen(sock, config.backlog) < 0)
+    {
+        cerr << "Error with listen on " << config.unixPath << endl;
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
-        newPlayer.tries++;
+    return sock;
+}
 
-        // send "Turn (tries)" meassage to client
-        string turn = "\nTurn: " + to_string(newPlayer.tries) + "\n";
-        char *trn = new char[turn.length()];
-        strcpy(trn, turn.c_str());
+// take the listeners and the leaderboard over from the server waiting on
+// the handoff path; both sockets stay -1 on a cold start. Exits on
+// failure.
+static void takeOver(const ServerConfig &config, int &listenSock,
+                     int &localSock)
+{
+    if (!handoff.connect(config.handoffPath))
+    {
+        return;
+    }
 
-        if (!sendInt(clientSock, strlen(trn)))
-        {
-            printError("send", "number of turn(s) length");
-            return;
-        };
+    leaderBoard board;
+    unsigned long lastId = 0;
+    vector<uint64_t> finishedByTries;
+    if (!handoff.receiveListeners(listenSock, localSock, config.port) ||
+        !handoff.receiveState(board, lastId, finishedByTries))
+    {
+        exit(EXIT_FAILURE);
+    }
 
-        if (!sendMessage(clientSock, trn))
-        {
-            printError("send", "number of turns");
-            return;
-        };
+    // with a data directory the journal it flushed has the same games
+    if (config.dataDir.empty())
+    {
+        leaderboard.restore(board, lastId);
+        ranks.restore(finishedByTries);
+    }
 
-        // Ask user for a guess
-        if (!sendInt(clientSock, strlen(playMsg)))
-        {
-            printError("send", "\"enter guess\" length");
-            return;
-        };
+    // its Unix domain listener is only served if asked for
+    if (localSock >= 0 && config.unixPath.empty())
+    {
+        close(localSock);
+        localSock = -1;
+    }
+}
 
-        if (!sendMessage(clientSock, playMsg))
-        {
-            printError("send", "\"enter guess\"");
-            return;
-        };
+// let an acceptor give up waiting on sock when the server hands off
+static void makeNonBlocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        cerr << "Error making listening socket non-blocking" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
 
-        /* receive user guess
-        print error message and abort if guess not received*/
-        userX = receiveInt(clientSock);
-        if (userX == LONG_MIN)
+// serve the game port in the configured mode, exits on failure
+static void serve(ServerConfig &config, int sock)
+{
+    // the event loops time sessions out themselves
+    if (config.mode == "uring")
+    {
+        if (runUringServer(sock, config.loops))
         {
-            printError("receive", "user guess");
-            return;
+            close(sock);
+            exit(EXIT_FAILURE);
         }
+        cerr << "io_uring not available, using epoll" << endl;
+        config.mode = "epoll";
+    }
 
-        userY = receiveInt(clientSock);
-        if (userX == LONG_MIN)
-        {
-            printError("receive", "user guess");
-            return;
-        }
+    if (config.mode == "epoll")
+    {
+        runEpollServer(sock, config.loops);
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
-        // calculate and send distance to treasure
-        double distance = calcDist(randomX, randomY, userX, userY);
-        if(!sendDistance(clientSock, distance)){
-            printError("send","distance to treasure location");
-            return;
-        };
+    if (config.mode == "pool")
+    {
+        runPoolServer(sock, config.pool);
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
-        // free memory
-        delete[] trn;
+    // session threads get the configured stack size too
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (config.pool.stackSize > 0)
+    {
+        pthread_attr_setstacksize(&attr, max(config.pool.stackSize,
+                                             (size_t)PTHREAD_STACK_MIN));
+    }
 
-    } while ((randomX != userX) || (randomY != userY));
+    while (true)
+    {
+        // Accept connection from client, only fails after a handoff
+        int clientSock = admission.acceptSession(sock);
+        if (clientSock < 0)
+        {
+            break;
+        }
 
-    // locks before entering critical section
-    pthread_mutex_lock(&mutex);
-    updateBoard(board, newPlayer);
-    pthread_mutex_unlock(&mutex); // unlocks after critical section
+        // Create and initialize argument struct
+        ThreadArgs *args = new ThreadArgs;
+        args->clientSock = clientSock;
 
-    string cngratMsg =
-        "Congratulations! You found the treasure!\nIt took " +
-        to_string(newPlayer.tries) +
-        (newPlayer.tries == 1 ? " turn" : " turns") +
-        " to find the treasure.";
+        // Create Thread
+        pthread_t threadID;
 
-    // send congratulation message
-    char *congratMsg = new char[cngratMsg.length()];
-    strcpy(congratMsg, cngratMsg.c_str());
+        // let client play
+        int status = pthread_create(&threadID, &attr, threadMain, (void *)args);
+        if (status != 0)
+        {
+            // turn this client away and let running sessions finish
+            printError("create", "session thread");
+            delete args;
+            close(clientSock);
+            admission.release();
+            usleep(10 * 1000);
+        }
+    }
 
-    if (!sendInt(clientSock, strlen(congratMsg)))
-    {
-        printError("send","congratulation message length");
-        delete[] congratMsg; 
-        return;
-    };
+    // the sessions left finish before the process exits
+    handoff.waitForExit();
+}
 
-    if (!sendMessage(clientSock, congratMsg))
+// fork the worker processes and replace any that dies; a worker that
+// dies within its first second is taken as a startup failure. They all
+// accept from the one Unix domain listener localSock, if there is one.
+static void runWorkers(ServerConfig &config, int localSock)
+{
+    if (!sharedBoard.create())
     {
-        printError("send","congratulation message");
-        delete[] congratMsg; 
         return;
-    };
+    }
 
-    // send leaderboard size
-    long boardSize = board.players.size();
-    if(!sendInt(clientSock, boardSize)){
+    vector<pid_t> workers(config.processes, 0);
+    vector<time_t> started(config.processes, 0);
+    pid_t parent = getpid();
 
-        printError("send","leaderboard size");
-        delete[] congratMsg; 
-        return;
-    };
-
-    // send leaderboard info
-    for (int i = 0; i < boardSize; i++)
+    while (true)
     {
-        string Name = board.players[i].name;
-        char *name = new char[board.players[i].name.length()];
-        strcpy(name, Name.c_str());
-
-        // name
-        if (!sendInt(clientSock, strlen(name)))
+        for (int i = 0; i < config.processes; i++)
         {
-            printError("send","player name length");
-            delete[] name;
-            delete[] congratMsg; 
-            return;
+            if (workers[i] != 0)
+            {
+                continue;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                cerr << "Error forking worker process" << endl;
+                return;
+            }
+            if (pid == 0)
+            {
+                // go down with the parent instead of lingering
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+                if (getppid() != parent)
+                {
+                    exit(EXIT_FAILURE);
+                }
+
+                // a sequence of its own per worker, the same on every run;
+                // worker 0 keeps the seed as given
+                ServerConfig worker = config;
+                worker.seed ^= (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+
+                leaderboard.setWorker(i, config.processes);
+                startServices(worker, i == 0, localSock);
+                serve(worker, openListener(worker));
+                exit(EXIT_FAILURE);
+            }
+            workers[i] = pid;
+            started[i] = time(NULL);
         }
 
-        if (!sendMessage(clientSock, name))
+        int status;
+        pid_t dead = wait(&status);
+        if (dead < 0)
         {
-            printError("send","player name");
-            delete[] name;
-            delete[] congratMsg; 
+            if (errno == EINTR)
+            {
+                continue;
+            }
             return;
         }
 
-        // tries
-        if (!sendInt(clientSock, board.players[i].tries))
+        for (int i = 0; i < config.processes; i++)
         {
-            printError("send","player tries");
-            delete[] name; 
-            delete[] congratMsg; 
-            return;
+            if (workers[i] != dead)
+            {
+                continue;
+            }
+            workers[i] = 0;
+            sharedBoard.recover(dead);
+
+            if (time(NULL) - started[i] < 1)
+            {
+                cerr << "Error: worker " << i << " failed to start" << endl;
+                for (int j = 0; j < config.processes; j++)
+                {
+                    if (workers[j] != 0)
+                    {
+                        kill(workers[j], SIGTERM);
+                    }
+                }
+                return;
+            }
+            cerr << "Worker " << i << " exited, restarting it" << endl;
         }
-
-        delete[] name;
     }
-
-    // free ressources
-    delete[] congratMsg;
-    pthread_mutex_destroy(&mutex);
-
-    return;
-}
-
-// arguments for thread function
-struct ThreadArgs
-{
-    int clientSock;
-};
-
-// thread argument function
-void *threadMain(void *args)
-{
-    // Extract socket file descriptor from argument
-    struct ThreadArgs *threadArgs = (struct ThreadArgs *)args;
-    int clientSock = threadArgs->clientSock;
-    delete threadArgs;
-
-    // Communicate with client
-    playGame(clientSock);
-
-    // Reclaim ressources before finishing
-    pthread_detach(pthread_self());
-    close(clientSock);
-
-    return NULL;
 }
 
 int main(int argc, char **argv)
 {
+    ServerConfig config;
+    parseArgs(argc, argv, config);
 
-    if (argc != 2)
+    // mapped before any worker process is forked, so ranks stay global
+    if (!ranks.create())
     {
-        // check if all arguments are provided
-        cerr << "Usage: ./pa4_server [port number]" << endl;
         exit(EXIT_FAILURE);
     }
 
-    // create a TCP socket
-    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    Session::setMaxFrame(config.maxFrame);
+    Room::setSize(config.roomSize);
+    Session::setTimeouts(config.handshakeTimeout * 1000,
+                         config.turnTimeout * 1000,
+                         config.sessionTimeout * 1000);
 
-    if (sock < 0)
+    int listenSock = -1;
+    int localSock = -1;
+    if (!config.handoffPath.empty())
     {
-        cerr << "Error creating server socket" << endl;
-        exit(EXIT_FAILURE);
+        takeOver(config, listenSock, localSock);
     }
-
-    // read port number from command line
-    unsigned short servPort = (short)stoi(argv[1]);
-
-    // set the fields
-    struct sockaddr_in servAddr;
-    servAddr.sin_family = AF_INET;
-    servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servAddr.sin_port = htons(servPort);
-
-    // bind port to socket
-    int status = bind(sock, (struct sockaddr *)&servAddr, sizeof(servAddr));
-
-    if (status < 0)
+    if (!config.unixPath.empty() && localSock < 0)
     {
-        // print out an error message if unsuccessful
-        cerr << "Error with bind" << endl;
-        close(sock);
-        exit(EXIT_FAILURE);
+        localSock = openLocalListener(config);
     }
 
-    // set socket to listen
-    status = listen(sock, 5);
-
-    if (status < 0)
+    if (config.processes > 1)
     {
-        cerr << "Error with listen" << endl;
-        close(sock);
+        runWorkers(config, localSock);
         exit(EXIT_FAILURE);
     }
 
-    while (true)
+    if (listenSock < 0)
     {
-        int clientSock;
-
-        // Accept connection from client
-        struct sockaddr_in clientAddr;
-        socklen_t addrLen = sizeof(clientAddr);
-        clientSock = accept(sock, (struct sockaddr *)&clientAddr, &addrLen);
-
-        if (clientSock < 0)
-        {
-            cerr << "Error with accept" << endl;
-        }
-
-        // Create and initialize argument struct
-        ThreadArgs *args = new ThreadArgs;
-        args->clientSock = clientSock;
-
-        // Create Thread
-        pthread_t threadID;
-
-        // let client play
-        int status = pthread_create(&threadID, NULL, threadMain, (void *)args);
-        if (status != 0)
+        listenSock = openListener(config);
+    }
+    if (!config.handoffPath.empty())
+    {
+        makeNonBlocking(listenSock);
+        if (localSock >= 0)
         {
-            cerr << "Error creating thread " << threadID << endl;
-            exit(EXIT_FAILURE);
+            makeNonBlocking(localSock);
         }
     }
 
-    // Close sockets when done
-    close(sock);
-}
\ No newline at end of file
+    startServices(config, true, localSock);
+    if (!config.handoffPath.empty() &&
+        !handoff.start(listenSock, localSock,
+                       config.mode == "epoll" ? adoptEpollConnection
+                                              : adoptSession))
+    {
+        exit(EXIT_FAILURE);
+    }
+    serve(config, listenSock);
+}
@@ -0,0 +1,602 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Protocol v2 frame codec shared by client and server
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* Protocol v2
+
+   The server always opens with the v1 welcome message (length + body) so
+   old clients keep working. A v2 client answers with PROTOCOL_V2_MAGIC in
+   place of the v1 username length; from then on both sides only exchange
+   typed frames:
+
+       client                          server
+       NAME  (name)              ->
+                                 <-    TURN   (turn 1, no distance)
+       GUESS (x, y)              ->
+                                 <-    TURN   (turn 2, distance of guess)
+       ...
+       GUESS (x, y)              ->
+                                 <-    RESULT (tries, message, leaderboard)
+
+   A username is at most MAX_NAME bytes with either version; the server
+   closes the connection of a client sending a longer one.
+
+   In place of a GUESS a client may send a GUESS_BATCH of up to
+   MAX_BATCH_GUESSES guesses. Each guess costs one try. The server stops
+   at the first exact hit and answers with one DISTANCES frame carrying
+   the distance of every guess it looked at and the next turn number,
+   followed by the RESULT frame if the treasure was found.
+
+   A server running rooms puts several v2 players on the same treasure.
+   Each still plays its own turns, and whenever one of them finds the
+   treasure the others get a FOUND frame between their turns. The RESULT
+   frame of a room player carries the RESULT_STANDINGS_FOLLOW flag: the
+   connection stays open until every player of the room is done, then a
+   STANDINGS frame with the room's finishing order ends it.
+
+   On the server's Unix domain socket a client may also send
+   PROTOCOL_RING_MAGIC in place of the username length, with a memfd
+   holding a pair of shared memory rings attached as SCM_RIGHTS (see
+   shm_ring.h). Everything after that, the username length or v2 magic
+   included, goes through the rings instead of the socket.
+
+   Every frame is a 4 byte header (type, flags, big-endian payload length)
+   followed by the payload. Integers are fixed width and big-endian,
+   doubles are their IEEE 754 bits as a big-endian 64 bit integer. */
+
+// sent as a v1 int in place of the username length to select v2
+const long PROTOCOL_V2_MAGIC = 0x54480002;
+
+// sent as a v1 int with a ring memfd attached, Unix domain socket only
+const long PROTOCOL_RING_MAGIC = 0x54480003;
+
+const size_t FRAME_HEADER_SIZE = 4;
+const size_t MAX_FRAME_PAYLOAD = 0xffff;
+
+// longest username the server accepts, so that the names a RESULT or
+// STANDINGS frame carries cannot push it over MAX_FRAME_PAYLOAD
+const size_t MAX_NAME = 255;
+
+// tries, name length and the longest name of a leaderboard entry
+const size_t MAX_BOARD_ENTRY = 6 + MAX_NAME;
+
+// players in one room, as many as a STANDINGS frame can list
+const size_t MAX_ROOM_PLAYERS = (MAX_FRAME_PAYLOAD - 2) / MAX_BOARD_ENTRY;
+
+// guesses that fit in one GUESS_BATCH frame, and their distances in one
+// DISTANCES frame
+const size_t MAX_BATCH_GUESSES = (MAX_FRAME_PAYLOAD - 6) / 8;
+
+enum FrameType
+{
+    FRAME_NAME = 1,   // client: username
+    FRAME_GUESS = 2,  // client: one guess
+    FRAME_TURN = 3,   // server: turn number and distance of the last guess
+    FRAME_RESULT = 4,     // server: treasure found, tries and leaderboard
+    FRAME_GUESS_BATCH = 5, // client: several guesses at once
+    FRAME_DISTANCES = 6,   // server: distance of every guess in a batch
+    FRAME_FOUND = 7,       // server: another room player found the treasure
+    FRAME_STANDINGS = 8    // server: finishing order of the room
+};
+
+// RESULT flag: a STANDINGS frame follows once the whole room is done
+const uint8_t RESULT_STANDINGS_FOLLOW = 1;
+
+struct FrameHeader
+{
+    uint8_t type;
+    uint8_t flags;
+    uint16_t length; // payload bytes after the header
+};
+
+struct GuessFrame
+{
+    int32_t x;
+    int32_t y;
+};
+
+struct TurnFrame
+{
+    uint32_t turn;
+    double distance; // negative on the first turn
+};
+
+struct DistancesFrame
+{
+    uint32_t turn; // turn of the next guess, or of the hit
+    std::vector<double> distances;
+};
+
+struct BoardEntry
+{
+    std::string name;
+    uint32_t tries;
+};
+
+struct ResultFrame
+{
+    uint32_t tries;
+    std::string message;
+    std::vector<BoardEntry> board;
+};
+
+struct FoundFrame
+{
+    std::string name;
+    uint32_t tries;
+    uint16_t place; // 1 for the first player of the room to find it
+};
+
+struct StandingsFrame
+{
+    std::vector<BoardEntry> players; // in the order they found it
+};
+
+// fixed width big-endian encoding
+
+inline void storeU16(char *bp, uint16_t value)
+{
+    bp[0] = (char)(value >> 8);
+    bp[1] = (char)value;
+}
+
+inline void storeU32(char *bp, uint32_t value)
+{
+    bp[0] = (char)(value >> 24);
+    bp[1] = (char)(value >> 16);
+    bp[2] = (char)(value >> 8);
+    bp[3] = (char)value;
+}
+
+inline void storeU64(char *bp, uint64_t value)
+{
+    storeU32(bp, (uint32_t)(value >> 32));
+    storeU32(bp + 4, (uint32_t)value);
+}
+
+inline void storeF64(char *bp, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    storeU64(bp, bits);
+}
+
+inline void putU16(std::string &out, uint16_t value)
+{
+    char bytes[2];
+    storeU16(bytes, value);
+    out.append(bytes, 2);
+}
+
+inline void putU32(std::string &out, uint32_t value)
+{
+    char bytes[4];
+    storeU32(bytes, value);
+    out.append(bytes, 4);
+}
+
+inline void putU64(std::string &out, uint64_t value)
+{
+    char bytes[8];
+    storeU64(bytes, value);
+    out.append(bytes, 8);
+}
+
+inline void putF64(std::string &out, double value)
+{
+    char bytes[8];
+    storeF64(bytes, value);
+    out.append(bytes, 8);
+}
+
+inline void putString(std::string &out, const std::string &value)
+{
+    putU16(out, (uint16_t)value.length());
+    out.append(value, 0, (uint16_t)value.length());
+}
+
+inline uint16_t getU16(const char *bp)
+{
+    const unsigned char *p = (const unsigned char *)bp;
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline uint32_t getU32(const char *bp)
+{
+    const unsigned char *p = (const unsigned char *)bp;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline uint64_t getU64(const char *bp)
+{
+    return ((uint64_t)getU32(bp) << 32) | getU32(bp + 4);
+}
+
+inline double getF64(const char *bp)
+{
+    uint64_t bits = getU64(bp);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// protocol v1 fields, as sendInt(), sendMessage() and sendDistance()
+// put them on the wire
+
+const size_t V1_INT_SIZE = sizeof(long);
+
+inline void putV1Int(std::string &out, long hostInt)
+{
+    // convert int to network order before sending
+    long networkInt = htonl(hostInt);
+    out.append((const char *)&networkInt, sizeof(long));
+}
+
+inline void putV1Message(std::string &out, const std::string &message)
+{
+    putV1Int(out, message.length());
+    out.append(message);
+}
+
+inline void putV1Distance(std::string &out, double hostDouble)
+{
+    out.append((const char *)&hostDouble, sizeof(double));
+}
+
+// read a v1 int the way receiveInt() does, caller checks there is room
+inline long getV1Int(const char *bp)
+{
+    long networkInt;
+    memcpy(&networkInt, bp, sizeof(long));
+
+    // convert int to host order before returning it
+    int hostInt = ntohl(networkInt);
+
+    return hostInt;
+}
+
+// frame header and body
+
+// open a frame, returns where its header starts for endFrame()
+inline size_t beginFrame(std::string &out, FrameType type, uint8_t flags = 0)
+{
+    size_t start = out.size();
+    char header[FRAME_HEADER_SIZE] = {(char)type, (char)flags, 0, 0};
+    out.append(header, FRAME_HEADER_SIZE);
+    return start;
+}
+
+// patch the payload length into the header opened at start; a payload
+// the 16 bit length cannot describe is taken back out and false returned
+inline bool endFrame(std::string &out, size_t start)
+{
+    size_t length = out.size() - start - FRAME_HEADER_SIZE;
+    if (length > MAX_FRAME_PAYLOAD)
+    {
+        out.resize(start);
+        return false;
+    }
+    out[start + 2] = (char)(length >> 8);
+    out[start + 3] = (char)length;
+    return true;
+}
+
+inline FrameHeader parseHeader(const char *bp)
+{
+    FrameHeader header;
+    header.type = (uint8_t)bp[0];
+    header.flags = (uint8_t)bp[1];
+    header.length = getU16(bp + 2);
+    return header;
+}
+
+// true once data holds a complete frame, header is filled in either way
+// as soon as its 4 bytes are there
+inline bool frameComplete(const char *data, size_t available,
+                          FrameHeader &header)
+{
+    if (available < FRAME_HEADER_SIZE)
+    {
+        return false;
+    }
+    header = parseHeader(data);
+    return available >= FRAME_HEADER_SIZE + header.length;
+}
+
+// fixed-layout frames
+
+/* Frames whose payload never changes size have a FrameLayout
+   specialization giving their type, payload size and field layout.
+   encodeFrame() and decodeFrame() only exist for those types, so
+   encoding a frame without a layout, or decoding into the wrong struct,
+   does not compile. The frame is built in a stack buffer sized at
+   compile time and appended in one copy, with no length patching. */
+template <typename Frame>
+struct FrameLayout; // variable-size frames have their own encodeX()
+
+template <>
+struct FrameLayout<GuessFrame>
+{
+    static constexpr FrameType TYPE = FRAME_GUESS;
+    static constexpr size_t PAYLOAD = 8;
+
+    static void store(char *bp, const GuessFrame &guess)
+    {
+        storeU32(bp, (uint32_t)guess.x);
+        storeU32(bp + 4, (uint32_t)guess.y);
+    }
+
+    static void load(const char *bp, GuessFrame &guess)
+    {
+        guess.x = (int32_t)getU32(bp);
+        guess.y = (int32_t)getU32(bp + 4);
+    }
+};
+
+template <>
+struct FrameLayout<TurnFrame>
+{
+    static constexpr FrameType TYPE = FRAME_TURN;
+    static constexpr size_t PAYLOAD = 12;
+
+    static void store(char *bp, const TurnFrame &turn)
+    {
+        storeU32(bp, turn.turn);
+        storeF64(bp + 4, turn.distance);
+    }
+
+    static void load(const char *bp, TurnFrame &turn)
+    {
+        turn.turn = getU32(bp);
+        turn.distance = getF64(bp + 4);
+    }
+};
+
+template <typename Frame>
+inline void encodeFrame(std::string &out, const Frame &frame)
+{
+    typedef FrameLayout<Frame> Layout;
+    static_assert(Layout::PAYLOAD <= MAX_FRAME_PAYLOAD,
+                  "fixed frame payload over the frame limit");
+
+    char bytes[FRAME_HEADER_SIZE + Layout::PAYLOAD];
+    bytes[0] = (char)Layout::TYPE;
+    bytes[1] = 0;
+    storeU16(bytes + 2, (uint16_t)Layout::PAYLOAD);
+    Layout::store(bytes + FRAME_HEADER_SIZE, frame);
+    out.append(bytes, sizeof(bytes));
+}
+
+// false unless the payload has exactly the layout's size
+template <typename Frame>
+inline bool decodeFrame(const char *payload, size_t length, Frame &frame)
+{
+    if (length != FrameLayout<Frame>::PAYLOAD)
+    {
+        return false;
+    }
+    FrameLayout<Frame>::load(payload, frame);
+    return true;
+}
+
+// variable-size frames
+
+// a name over MAX_NAME is cut short, the server would refuse it
+inline void encodeName(std::string &out, const std::string &name)
+{
+    size_t start = beginFrame(out, FRAME_NAME);
+    out.append(name, 0, MAX_NAME);
+    endFrame(out, start);
+}
+
+inline void encodeGuessBatch(std::string &out,
+                             const std::vector<GuessFrame> &guesses)
+{
+    size_t start = beginFrame(out, FRAME_GUESS_BATCH);
+    size_t count = guesses.size() < MAX_BATCH_GUESSES ? guesses.size()
+                                                      : MAX_BATCH_GUESSES;
+    putU16(out, (uint16_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        putU32(out, (uint32_t)guesses[i].x);
+        putU32(out, (uint32_t)guesses[i].y);
+    }
+    endFrame(out, start);
+}
+
+inline void encodeDistances(std::string &out, const DistancesFrame &reply)
+{
+    size_t start = beginFrame(out, FRAME_DISTANCES);
+    putU32(out, reply.turn);
+    putU16(out, (uint16_t)reply.distances.size());
+    for (size_t i = 0; i < reply.distances.size(); i++)
+    {
+        putF64(out, reply.distances[i]);
+    }
+    endFrame(out, start);
+}
+
+// entry count, then tries and name of every entry
+inline void putBoard(std::string &out, const std::vector<BoardEntry> &board)
+{
+    putU16(out, (uint16_t)board.size());
+    for (size_t i = 0; i < board.size(); i++)
+    {
+        putU32(out, board[i].tries);
+        putString(out, board[i].name);
+    }
+}
+
+// false, with nothing appended, if the frame would go over
+// MAX_FRAME_PAYLOAD
+inline bool encodeResult(std::string &out, const ResultFrame &result,
+                         uint8_t flags = 0)
+{
+    size_t start = beginFrame(out, FRAME_RESULT, flags);
+    putU32(out, result.tries);
+    putString(out, result.message);
+    putBoard(out, result.board);
+    return endFrame(out, start);
+}
+
+inline bool encodeFound(std::string &out, const FoundFrame &found)
+{
+    size_t start = beginFrame(out, FRAME_FOUND);
+    putU32(out, found.tries);
+    putU16(out, found.place);
+    putString(out, found.name);
+    return endFrame(out, start);
+}
+
+static_assert(2 + MAX_ROOM_PLAYERS * MAX_BOARD_ENTRY <= MAX_FRAME_PAYLOAD,
+              "standings of a full room over the frame limit");
+
+inline bool encodeStandings(std::string &out, const StandingsFrame &standings)
+{
+    size_t start = beginFrame(out, FRAME_STANDINGS);
+    putBoard(out, standings.players);
+    return endFrame(out, start);
+}
+
+inline bool decodeGuessBatch(const char *payload, size_t length,
+                             std::vector<GuessFrame> &guesses)
+{
+    if (length < 2)
+    {
+        return false;
+    }
+    size_t count = getU16(payload);
+    if (count == 0 || length != 2 + count * 8)
+    {
+        return false;
+    }
+
+    guesses.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        guesses[i].x = (int32_t)getU32(payload + 2 + i * 8);
+        guesses[i].y = (int32_t)getU32(payload + 6 + i * 8);
+    }
+    return true;
+}
+
+inline bool decodeDistances(const char *payload, size_t length,
+                            DistancesFrame &reply)
+{
+    if (length < 6)
+    {
+        return false;
+    }
+    reply.turn = getU32(payload);
+    size_t count = getU16(payload + 4);
+    if (length != 6 + count * 8)
+    {
+        return false;
+    }
+
+    reply.distances.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        reply.distances[i] = getF64(payload + 6 + i * 8);
+    }
+    return true;
+}
+
+// read a u16 length-prefixed string, advancing pos
+inline bool decodeString(const char *payload, size_t length, size_t &pos,
+                         std::string &value)
+{
+    if (length - pos < 2)
+    {
+        return false;
+    }
+    size_t strLen = getU16(payload + pos);
+    pos += 2;
+    if (length - pos < strLen)
+    {
+        return false;
+    }
+    value.assign(payload + pos, strLen);
+    pos += strLen;
+    return true;
+}
+
+// read what putBoard() wrote, advancing pos
+inline bool decodeBoard(const char *payload, size_t length, size_t &pos,
+                        std::vector<BoardEntry> &board)
+{
+    if (length - pos < 2)
+    {
+        return false;
+    }
+    size_t count = getU16(payload + pos);
+    pos += 2;
+
+    board.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        BoardEntry entry;
+        if (length - pos < 4)
+        {
+            return false;
+        }
+        entry.tries = getU32(payload + pos);
+        pos += 4;
+        if (!decodeString(payload, length, pos, entry.name))
+        {
+            return false;
+        }
+        board.push_back(entry);
+    }
+    return true;
+}
+
+inline bool decodeResult(const char *payload, size_t length,
+                         ResultFrame &result)
+{
+    size_t pos = 0;
+    if (length < 4)
+    {
+        return false;
+    }
+    result.tries = getU32(payload);
+    pos += 4;
+
+    return decodeString(payload, length, pos, result.message) &&
+           decodeBoard(payload, length, pos, result.board) && pos == length;
+}
+
+inline bool decodeFound(const char *payload, size_t length, FoundFrame &found)
+{
+    size_t pos = 6;
+    if (length < pos)
+    {
+        return false;
+    }
+    found.tries = getU32(payload);
+    found.place = getU16(payload + 4);
+
+    return decodeString(payload, length, pos, found.name) && pos == length;
+}
+
+inline bool decodeStandings(const char *payload, size_t length,
+                            StandingsFrame &standings)
+{
+    size_t pos = 0;
+    return decodeBoard(payload, length, pos, standings.players) &&
+           pos == length;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Global rank of every finished game
+*/
+
+#include "rank_index.h"
+
+#include <sys/mman.h>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+RankIndex ranks;
+
+// shared with worker processes, so the counters must not be emulated
+// with a lock
+static_assert(atomic<uint64_t>::is_always_lock_free,
+              "rank counters must be lock-free");
+
+RankIndex::RankIndex() : tree(NULL)
+{
+}
+
+bool RankIndex::create()
+{
+    size_t bytes = (MAX_RANKED_TRIES + 1) * sizeof(atomic<uint64_t>);
+    void *mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        cerr << "Error mapping the rank index" << endl;
+        return false;
+    }
+
+    // anonymous mappings start zeroed
+    tree = new (mapping) atomic<uint64_t>[MAX_RANKED_TRIES + 1];
+    for (size_t i = 0; i <= MAX_RANKED_TRIES; i++)
+    {
+        tree[i].store(0, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+void RankIndex::restore(const vector<uint64_t> &byTries)
+{
+    for (size_t tries = 1; tries < byTries.size(); tries++)
+    {
+        if (byTries[tries] == 0)
+        {
+            continue;
+        }
+        for (size_t i = slotOf(tries); i <= MAX_RANKED_TRIES; i += i & -i)
+        {
+            tree[i].fetch_add(byTries[tries], memory_order_relaxed);
+        }
+    }
+}
+
+vector<uint64_t> RankIndex::counts() const
+{
+    vector<uint64_t> byTries(MAX_RANKED_TRIES + 1);
+    for (size_t i = 1; i <= MAX_RANKED_TRIES; i++)
+    {
+        byTries[i] = tree[i].load(memory_order_relaxed);
+    }
+
+    // undo the tree from the top, a node still holds its own sum when
+    // the one above it takes it back out
+    for (size_t i = MAX_RANKED_TRIES; i > 0; i--)
+    {
+        size_t parent = i + (i & -i);
+        if (parent <= MAX_RANKED_TRIES)
+        {
+            byTries[parent] -= byTries[i];
+        }
+    }
+
+    return byTries;
+}
+
+void RankIndex::add(uint32_t tries)
+{
+    for (size_t i = slotOf(tries); i <= MAX_RANKED_TRIES; i += i & -i)
+    {
+        tree[i].fetch_add(1, memory_order_relaxed);
+    }
+}
+
+uint64_t RankIndex::rank(uint32_t tries) const
+{
+    return prefix(slotOf(tries) - 1) + 1;
+}
+
+uint64_t RankIndex::slower(uint32_t tries) const
+{
+    // a game added between the two reads may only show up in the second
+    uint64_t all = total();
+    uint64_t atMost = prefix(slotOf(tries));
+    return all > atMost ? all - atMost : 0;
+}
+
+uint64_t RankIndex::total() const
+{
+    return prefix(MAX_RANKED_TRIES);
+}
+
+// tries 0 never finishes a game, it counts with 1
+size_t RankIndex::slotOf(uint32_t tries)
+{
+    if (tries == 0)
+    {
+        return 1;
+    }
+    return tries < MAX_RANKED_TRIES ? tries : MAX_RANKED_TRIES;
+}
+
+uint64_t RankIndex::prefix(size_t slot) const
+{
+    uint64_t count = 0;
+    for (size_t i = slot; i > 0; i -= i & -i)
+    {
+        count += tree[i].load(memory_order_relaxed);
+    }
+    return count;
+}
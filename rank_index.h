@@ -0,0 +1,64 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Global rank of every finished game
+*/
+
+#ifndef RANK_INDEX_H
+#define RANK_INDEX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// games finishing in more tries than this share the last slot
+const size_t MAX_RANKED_TRIES = 65536;
+
+/* Counts every finished game by its number of tries in a Fenwick tree,
+   so the rank and percentile of a game come out of O(log
+   MAX_RANKED_TRIES) node reads and nothing is ever sorted.
+
+   The nodes are atomics in a shared mapping: sessions on every thread,
+   and in every worker process forked after create(), add their game
+   with a few fetch_adds and never wait for one another. A query running
+   next to an add may count that game or not, which only moves a rank
+   by the games finishing at that moment. */
+class RankIndex
+{
+public:
+    RankIndex();
+
+    // map the tree, before forking workers, false on failure
+    bool create();
+
+    // count the games of a recovered game log, byTries[t] finished in t
+    // tries, before serving
+    void restore(const std::vector<uint64_t> &byTries);
+
+    // games per tries in the form restore() takes, for a new server
+    // process taking over
+    std::vector<uint64_t> counts() const;
+
+    // count a finished game
+    void add(uint32_t tries);
+
+    // 1 + games that took fewer tries, tied games share a rank
+    uint64_t rank(uint32_t tries) const;
+
+    // games that took more tries
+    uint64_t slower(uint32_t tries) const;
+
+    // games counted so far
+    uint64_t total() const;
+
+private:
+    static size_t slotOf(uint32_t tries);
+    uint64_t prefix(size_t slot) const; // games in slots 1..slot
+
+    std::atomic<uint64_t> *tree; // 1-based, NULL until created
+};
+
+extern RankIndex ranks;
+
+#endif
@@ -0,0 +1,83 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Session timeouts for blocking server modes
+*/
+
+#include "reaper.h"
+#include "metrics.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+SessionReaper reaper;
+
+SessionReaper::SessionReaper() : wheel(tickOf(monotonicMs()))
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+bool SessionReaper::start()
+{
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, reaperMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating session reaper thread" << endl;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+void SessionReaper::arm(ReapEntry *entry, uint64_t deadline)
+{
+    pthread_mutex_lock(&lock);
+    if (deadline == 0)
+    {
+        wheel.cancel(&entry->timer);
+    }
+    else
+    {
+        wheel.arm(&entry->timer, tickOf(deadline));
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void SessionReaper::cancel(ReapEntry *entry)
+{
+    pthread_mutex_lock(&lock);
+    wheel.cancel(&entry->timer);
+    pthread_mutex_unlock(&lock);
+}
+
+// reaper thread function
+void *SessionReaper::reaperMain(void *args)
+{
+    SessionReaper *self = (SessionReaper *)args;
+
+    while (true)
+    {
+        usleep(TIMER_TICK_MS * 1000);
+
+        pthread_mutex_lock(&self->lock);
+        self->wheel.advance(tickOf(monotonicMs()), self->expired);
+
+        // the owning thread sees end of stream and closes the socket
+        for (size_t i = 0; i < self->expired.size(); i++)
+        {
+            ReapEntry *entry = (ReapEntry *)self->expired[i]->owner;
+            shutdown(entry->sock, SHUT_RDWR);
+            metrics.count(SESSIONS_EXPIRED);
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        self->expired.clear();
+    }
+
+    return NULL;
+}
@@ -0,0 +1,58 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Session timeouts for blocking server modes
+*/
+
+#ifndef REAPER_H
+#define REAPER_H
+
+#include "timer_wheel.h"
+
+#include <pthread.h>
+#include <cstdint>
+#include <vector>
+
+// deadline of one session handled by a blocking thread
+struct ReapEntry
+{
+    TimerNode timer;
+    int sock;
+
+    explicit ReapEntry(int sock) : sock(sock)
+    {
+        timer.owner = this;
+    }
+};
+
+/* Wakes up threads blocked on a client that stopped talking.
+   Session threads arm their deadline in a shared timer wheel and a
+   reaper thread shuts the socket down when it passes, so the blocked
+   recv() or send() returns and the thread ends the session normally.
+   The wheel is guarded by a mutex, held for an O(1) link or unlink. A
+   session must cancel() before closing its socket so the reaper never
+   shuts down a descriptor number that was reused. */
+class SessionReaper
+{
+public:
+    SessionReaper();
+
+    // start the reaper thread, false on failure
+    bool start();
+
+    // (re)arm entry for deadline in monotonicMs(), 0 cancels it
+    void arm(ReapEntry *entry, uint64_t deadline);
+
+    void cancel(ReapEntry *entry);
+
+private:
+    static void *reaperMain(void *args);
+
+    pthread_mutex_t lock;
+    TimerWheel wheel;
+    std::vector<TimerNode *> expired; // reaper thread only
+};
+
+extern SessionReaper reaper;
+
+#endif
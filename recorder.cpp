@@ -0,0 +1,232 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Session traffic recorder
+*/
+
+#include "recorder.h"
+#include "protocol.h"
+#include "metrics.h"
+#include "game.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+TrafficRecorder recorder;
+
+// events a session keeps before handing them to the writer
+const size_t TRACE_CHUNK = 64 * 1024;
+
+// chunks waiting for the writer before new ones are dropped
+const size_t TRACE_BACKLOG = 64 * 1024 * 1024;
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+TrafficRecorder::TrafficRecorder()
+    : fd(-1), nextId(1), queued(0), handled(0), wakePending(false)
+{
+    pthread_mutex_init(&lock, NULL);
+    sem_init(&wake, 0, 0);
+}
+
+bool TrafficRecorder::start(const string &path, bool seeded, uint64_t seed)
+{
+    int traceFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                                           O_CLOEXEC, 0644);
+    if (traceFd < 0)
+    {
+        cerr << "Error creating trace file " << path << ": "
+             << strerror(errno) << endl;
+        return false;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+
+    string header(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    putU32(header, TRACE_VERSION);
+    putU32(header, seeded ? TRACE_SEEDED : 0);
+    putU64(header, seed);
+    putU64(header, (uint64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000);
+    if (!writeAll(traceFd, header.data(), header.size()))
+    {
+        cerr << "Error writing trace file " << path << ": "
+             << strerror(errno) << endl;
+        ::close(traceFd);
+        return false;
+    }
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, writerMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating trace writer thread" << endl;
+        ::close(traceFd);
+        return false;
+    }
+    pthread_detach(threadID);
+
+    fd = traceFd;
+    return true;
+}
+
+// us since recording began
+uint64_t TrafficRecorder::now() const
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - origin.tv_sec) * 1000000 +
+           (ts.tv_nsec - origin.tv_nsec) / 1000;
+}
+
+SessionTrace *TrafficRecorder::open()
+{
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    SessionTrace *trace = new SessionTrace;
+    trace->id = nextId.fetch_add(1, memory_order_relaxed);
+    trace->startedAt = now();
+    trace->lastAt = trace->startedAt;
+    return trace;
+}
+
+void TrafficRecorder::event(SessionTrace *trace, TraceEvent type,
+                            size_t length)
+{
+    if (trace->events.size() >= TRACE_CHUNK)
+    {
+        queue(trace);
+    }
+
+    uint64_t at = now();
+    uint64_t delta = at - trace->lastAt;
+    trace->lastAt = at;
+
+    trace->events.push_back((char)type);
+    putU32(trace->events, delta > UINT32_MAX ? UINT32_MAX : delta);
+    putU32(trace->events, length);
+}
+
+void TrafficRecorder::close(SessionTrace *trace)
+{
+    queue(trace);
+    delete trace;
+}
+
+// hand the session's events to the writer as one chunk
+void TrafficRecorder::queue(SessionTrace *trace)
+{
+    if (trace->events.empty())
+    {
+        return;
+    }
+
+    string chunk;
+    putU64(chunk, trace->id);
+    putU64(chunk, trace->startedAt);
+    putU32(chunk, trace->events.size());
+
+    bool dropped = false;
+    pthread_mutex_lock(&lock);
+    if (pending.size() >= TRACE_BACKLOG)
+    {
+        dropped = true;
+    }
+    else
+    {
+        pending += chunk;
+        pending += trace->events;
+        queued += chunk.size() + trace->events.size();
+    }
+    pthread_mutex_unlock(&lock);
+    trace->events.clear();
+
+    if (dropped)
+    {
+        metrics.count(TRACE_CHUNKS_DROPPED);
+        return;
+    }
+    metrics.count(TRACE_CHUNKS_QUEUED);
+
+    if (!wakePending.exchange(true))
+    {
+        sem_post(&wake);
+    }
+}
+
+void TrafficRecorder::flush()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    uint64_t target = queued;
+    pthread_mutex_unlock(&lock);
+
+    while (handled.load() < target)
+    {
+        usleep(1000);
+    }
+}
+
+// writer thread function
+void *TrafficRecorder::writerMain(void *args)
+{
+    TrafficRecorder *self = (TrafficRecorder *)args;
+    string batch;
+
+    while (true)
+    {
+        while (sem_wait(&self->wake) < 0 && errno == EINTR)
+        {
+        }
+        self->wakePending.store(false);
+
+        pthread_mutex_lock(&self->lock);
+        batch.swap(self->pending);
+        pthread_mutex_unlock(&self->lock);
+        if (batch.empty())
+        {
+            continue;
+        }
+
+        if (!writeAll(self->fd, batch.data(), batch.size()))
+        {
+            printError("write", "traffic trace");
+        }
+        self->handled.fetch_add(batch.size());
+        batch.clear();
+    }
+
+    return NULL;
+}
@@ -0,0 +1,108 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Session traffic recorder
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Trace file written by --record and read by pa4_replay, in the
+   big-endian encoding of protocol.h:
+
+   header
+     magic      8 bytes "PA4TRACE"
+     version    u32  TRACE_VERSION
+     flags      u32  TRACE_SEEDED if the server ran with --seed
+     seed       u64  treasure seed
+     startedAt  u64  wall clock ms when recording began
+   then chunks of one session's events, in the order they were written:
+     session    u64  id, sessions numbered from 1 in start order
+     startedAt  u64  us from the trace start to the session start
+     length     u32  bytes of events that follow
+     events     {type u8, delta u32 us since the session's last event,
+                 length u32, bytes} */
+const char TRACE_MAGIC[8] = {'P', 'A', '4', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_SEEDED = 1;
+
+const size_t TRACE_HEADER_SIZE = 32;
+const size_t TRACE_CHUNK_HEADER_SIZE = 20;
+const size_t TRACE_EVENT_HEADER_SIZE = 9;
+
+enum TraceEvent
+{
+    TRACE_RECEIVED = 0, // bytes from the client
+    TRACE_SENT = 1,     // bytes to the client
+    TRACE_CLOSED = 2    // the session ended here, no bytes
+};
+
+// events of one session not yet handed to the writer
+struct SessionTrace
+{
+    uint64_t id;
+    uint64_t startedAt; // us since the trace start
+    uint64_t lastAt;    // us of the last event
+    std::string events;
+};
+
+/* Keeps what every session received and sent, for pa4_replay.
+
+   A session appends its events to its own SessionTrace with no lock and
+   no system call besides reading the clock. Every TRACE_CHUNK bytes,
+   and when the session ends, the events go to a writer thread as one
+   chunk, which writes whatever piled up with one write(). If the writer
+   falls more than TRACE_BACKLOG bytes behind, chunks are dropped and
+   counted instead of growing without limit. */
+class TrafficRecorder
+{
+public:
+    TrafficRecorder();
+
+    // create path, write the header and start the writer thread, false
+    // on failure
+    bool start(const std::string &path, bool seeded, uint64_t seed);
+
+    bool enabled() const { return fd >= 0; }
+
+    // trace of a session starting now, NULL unless recording
+    SessionTrace *open();
+
+    // append an event of length bytes, the caller appends the bytes to
+    // trace->events right after
+    void event(SessionTrace *trace, TraceEvent type, size_t length);
+
+    // the session ended, its last events go to the writer
+    void close(SessionTrace *trace);
+
+    // wait until every chunk queued so far has been written
+    void flush();
+
+private:
+    static void *writerMain(void *args);
+    uint64_t now() const;
+    void queue(SessionTrace *trace);
+
+    int fd; // -1 unless recording
+    struct timespec origin;
+    std::atomic<uint64_t> nextId;
+
+    pthread_mutex_t lock;
+    std::string pending; // chunks waiting for the writer
+    uint64_t queued;     // bytes ever added to pending
+    std::atomic<uint64_t> handled; // of those, written or dropped
+    sem_t wake;
+    std::atomic<bool> wakePending;
+};
+
+extern TrafficRecorder recorder;
+
+#endif
@@ -0,0 +1,159 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Rooms of players sharing a treasure
+*/
+
+#include "room.h"
+#include "session.h"
+#include "treasure.h"
+#include "metrics.h"
+#include "logger.h"
+#include "protocol.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// players per room, 0 when rooms are off
+static size_t roomSize = 0;
+
+// room of this thread still taking players
+static thread_local Room *openRoom = NULL;
+
+void Room::setSize(size_t players)
+{
+    roomSize = players;
+}
+
+bool Room::enabled()
+{
+    return roomSize > 0;
+}
+
+Room::Room() : joined(0), hunting(0)
+{
+    // one treasure for the whole room
+    treasure = treasures.next();
+    logger.treasure(treasure.x, treasure.y);
+}
+
+Room *Room::join(Session *member)
+{
+    if (openRoom == NULL)
+    {
+        openRoom = new Room;
+    }
+    Room *room = openRoom;
+
+    Member joining;
+    joining.session = member;
+    joining.finished = false;
+    room->members.push_back(joining);
+    room->joined++;
+    room->hunting++;
+    if (room->joined >= roomSize)
+    {
+        openRoom = NULL;
+    }
+
+    return room;
+}
+
+void Room::finished(Session *member, const player &game)
+{
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (members[i].session == member)
+        {
+            members[i].finished = true;
+        }
+    }
+    standings.push_back(game);
+    hunting--;
+
+    // latecomers would start behind, send them to a new room
+    if (openRoom == this)
+    {
+        openRoom = NULL;
+    }
+
+    FoundFrame found;
+    found.name = game.name;
+    found.tries = game.tries;
+    found.place = min(standings.size(), (size_t)UINT16_MAX);
+
+    SharedBuffer *buffer = new SharedBuffer;
+    encodeFound(buffer->data, found);
+    broadcast(buffer, member, false);
+
+    if (hunting == 0)
+    {
+        sendStandings();
+    }
+}
+
+void Room::leave(Session *member)
+{
+    bool hasFinished = false;
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (members[i].session == member)
+        {
+            hasFinished = members[i].finished;
+            members.erase(members.begin() + i);
+            break;
+        }
+    }
+
+    if (members.empty())
+    {
+        if (openRoom == this)
+        {
+            openRoom = NULL;
+        }
+        delete this;
+        return;
+    }
+
+    // the others may have been waiting on this player only
+    if (!hasFinished && --hunting == 0 && !standings.empty())
+    {
+        sendStandings();
+    }
+}
+
+// end every member's session with the finishing order
+void Room::sendStandings()
+{
+    StandingsFrame final;
+    for (size_t i = 0; i < standings.size(); i++)
+    {
+        BoardEntry entry;
+        entry.name = standings[i].name;
+        entry.tries = standings[i].tries;
+        final.players.push_back(entry);
+    }
+
+    SharedBuffer *buffer = new SharedBuffer;
+    // always fits, rooms hold at most MAX_ROOM_PLAYERS
+    encodeStandings(buffer->data, final);
+    broadcast(buffer, NULL, true);
+}
+
+// queue buffer on every member but except, dropping the creator's
+// reference
+void Room::broadcast(SharedBuffer *buffer, Session *except, bool last)
+{
+    metrics.count(BROADCASTS);
+
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (members[i].session != except)
+        {
+            members[i].session->deliver(buffer, last);
+        }
+    }
+    releaseBuffer(buffer);
+}
@@ -0,0 +1,66 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Rooms of players sharing a treasure
+*/
+
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "game.h"
+#include "shared_buffer.h"
+
+#include <cstddef>
+#include <vector>
+
+class Session;
+
+/* Players hunting the same treasure at the same time.
+
+   Each event loop fills one open room at a time with the v2 players it
+   accepts, so a room and all of its sessions belong to one thread and
+   need no locking. The room stops taking players once it is full or its
+   treasure has been found.
+
+   Every player plays its own turns. When one finds the treasure, the
+   FOUND frame is encoded once into a SharedBuffer and queued on every
+   other member; once nobody is left hunting, the STANDINGS frame goes
+   out the same way and ends every member's session. */
+class Room
+{
+public:
+    // players per room, 0 to give every player a treasure of its own
+    static void setSize(size_t players);
+    static bool enabled();
+
+    // room of this thread the player joins, opening one if needed
+    static Room *join(Session *member);
+
+    treasureLocation getTreasure() const { return treasure; }
+
+    // member found the treasure, game holds its name and tries
+    void finished(Session *member, const player &game);
+
+    // member's session ended, the room is freed with its last member
+    void leave(Session *member);
+
+private:
+    struct Member
+    {
+        Session *session;
+        bool finished;
+    };
+
+    Room();
+
+    void sendStandings();
+    void broadcast(SharedBuffer *buffer, Session *except, bool last);
+
+    treasureLocation treasure;
+    std::vector<Member> members;   // sessions still open
+    std::vector<player> standings;  // in the order they found it
+    size_t joined;
+    size_t hunting; // members that have not found it yet
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Server command line settings
+*/
+
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include "worker_pool.h"
+#include "frame_reader.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <cstdint>
+#include <string>
+
+// everything main() reads from the command line
+struct ServerConfig
+{
+    std::string mode;     // thread, pool, epoll or uring
+    unsigned short port;
+    int loops;            // event loop threads in epoll and uring modes
+    WorkerPoolConfig pool; // worker pool settings, stack size also
+                           // applies to thread mode
+    size_t treasurePool;  // pre-generated treasure locations
+    bool seeded;          // replay the treasure sequence of seed
+    uint64_t seed;
+    size_t maxFrame;      // largest name or frame a client may send
+    unsigned short adminPort; // metrics on localhost, 0 for none
+    std::string dataDir;  // where the leaderboard is kept, empty to keep
+                          // it in memory only
+    LogLevel logLevel;    // most verbose records printed
+    long handshakeTimeout; // seconds to send the name, 0 for none
+    long turnTimeout;      // seconds to send each guess, 0 for none
+    long sessionTimeout;   // seconds a session may last, 0 for none
+    int backlog;          // connections the kernel queues before accept()
+    long maxSessions;     // sessions at once, 0 for no limit
+    bool busyReply;       // tell clients over the limit the server is busy
+    long roomSize;        // players sharing a treasure, 0 for none
+    int processes;        // worker processes sharing the port, 1 to serve
+                          // from this process
+    std::string unixPath; // Unix domain socket for local clients, empty
+                          // for none
+    std::string handoffPath; // where a running server hands over to its
+                             // successor, empty for plain restarts
+    std::string recordPath;  // trace of every session, empty for none
+
+    ServerConfig()
+        : mode("thread"), port(0), loops(1), treasurePool(4096),
+          seeded(false), seed(0), maxFrame(DEFAULT_MAX_FRAME),
+          adminPort(0), logLevel(LOG_INFO), handshakeTimeout(30),
+          turnTimeout(120), sessionTimeout(1800), backlog(SOMAXCONN),
+          maxSessions(0), busyReply(false), roomSize(0), processes(1)
+    {
+        pool.workers = 64;
+        pool.queueSize = 1024;
+        pool.stackSize = 0;
+        pool.pin = false;
+        pool.overflow = BLOCK;
+    }
+};
+
+#endif
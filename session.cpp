@@ -0,0 +1,738 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Per-session game state machine
+*/
+
+#include "session.h"
+#include "treasure.h"
+#include "leaderboard.h"
+#include "metrics.h"
+#include "logger.h"
+#include "timer_wheel.h"
+#include "room.h"
+#include "distance.h"
+#include "rank_index.h"
+#include "handoff.h"
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+static const char *welcomeMsg = "Welcome to Treasure Hunt\nEnter your name: ";
+static const char *playMsg = "Enter a guess (x y) : ";
+
+// largest name or frame a client may send
+static size_t maxFrame = DEFAULT_MAX_FRAME;
+
+void Session::setMaxFrame(size_t bytes)
+{
+    maxFrame = bytes;
+}
+
+// time limits in ms, 0 for none
+static uint64_t handshakeTimeout = 0;
+static uint64_t turnTimeout = 0;
+static uint64_t sessionTimeout = 0;
+
+void Session::setTimeouts(uint64_t handshake, uint64_t turn, uint64_t total)
+{
+    handshakeTimeout = handshake;
+    turnTimeout = turn;
+    sessionTimeout = total;
+}
+
+// sessions of this thread with output from deliver() to flush
+static thread_local vector<Session *> wokenSessions;
+
+Session::Session()
+    : state(WELCOME), version(1), in(maxFrame), outPos(0),
+      sendStage("welcome message"), startedAt(monotonicMs()),
+      waitingSince(startedAt), nameLength(-1), room(NULL), solo(false),
+      trace(NULL), owner(NULL), woken(false)
+{
+    metrics.count(SESSIONS_STARTED);
+}
+
+Session::~Session()
+{
+    for (size_t i = 0; i < shared.size(); i++)
+    {
+        releaseBuffer(shared[i].buffer);
+    }
+    if (woken)
+    {
+        wokenSessions.erase(
+            find(wokenSessions.begin(), wokenSessions.end(), this));
+    }
+
+    // may hand the others their standings
+    if (room != NULL)
+    {
+        room->leave(this);
+    }
+
+    if (trace != NULL)
+    {
+        recorder.event(trace, TRACE_CLOSED, 0);
+        recorder.close(trace);
+    }
+
+    metrics.count(SESSIONS_CLOSED);
+}
+
+void Session::start()
+{
+    trace = recorder.open();
+    sendStage = "welcome message";
+    putV1Message(out, welcomeMsg);
+    state = NAME;
+}
+
+/* Session state handed to a new server process:
+     state      u8   NAME or GUESS
+     version    u8
+     nameLength u64  as signed, -1 until known
+     tries      u32
+     treasure   x u64, y u64, as signed
+     startedAt  u64  monotonicMs(), the same clock in every process
+     waiting    u64  waitingSince
+     name       u32 length, then the bytes
+     input      u32 length, then the bytes received but not parsed */
+const size_t SESSION_STATE_SIZE = 2 + 8 + 4 + 4 * 8 + 4 + 4;
+
+bool Session::canHandOff() const
+{
+    return (state == NAME || state == GUESS) && room == NULL &&
+           shared.empty() && pendingLength() == 0;
+}
+
+void Session::exportState(string &out) const
+{
+    out.push_back((char)state);
+    out.push_back((char)version);
+    putU64(out, (uint64_t)nameLength);
+    putU32(out, newPlayer.tries);
+    putU64(out, (uint64_t)location.x);
+    putU64(out, (uint64_t)location.y);
+    putU64(out, startedAt);
+    putU64(out, waitingSince);
+    putU32(out, newPlayer.name.size());
+    out += newPlayer.name;
+    putU32(out, in.size());
+    out.append(in.data(), in.size());
+}
+
+bool Session::importState(const char *data, size_t length)
+{
+    if (length < SESSION_STATE_SIZE)
+    {
+        return false;
+    }
+
+    SessionState savedState = (SessionState)data[0];
+    int savedVersion = data[1];
+    long savedLength = (long)getU64(data + 2);
+    uint32_t tries = getU32(data + 10);
+    size_t nameSize = getU32(data + 46);
+    if ((savedState != NAME && savedState != GUESS) ||
+        (savedVersion != 1 && savedVersion != 2) ||
+        nameSize > MAX_NAME || length - SESSION_STATE_SIZE < nameSize)
+    {
+        return false;
+    }
+    const char *name = data + 50;
+    size_t inputSize = getU32(name + nameSize);
+    const char *input = name + nameSize + 4;
+    if (length - SESSION_STATE_SIZE - nameSize != inputSize)
+    {
+        return false;
+    }
+
+    // a v1 name still being received must fit once it is all there
+    size_t needed = inputSize;
+    if (savedVersion == 1 && savedState == NAME && savedLength >= 0)
+    {
+        needed = max(needed, (size_t)savedLength);
+    }
+    if (needed > 0 && !in.reserve(needed))
+    {
+        return false;
+    }
+
+    state = savedState;
+    version = savedVersion;
+    nameLength = savedLength;
+    newPlayer = player(string(name, nameSize), tries);
+    location = treasureLocation((long)getU64(data + 14),
+                                (long)getU64(data + 22));
+    startedAt = getU64(data + 30);
+    waitingSince = getU64(data + 38);
+    sendStage = state == NAME ? "welcome message" : "number of turns";
+
+    if (inputSize > 0)
+    {
+        size_t room;
+        memcpy(inputSpace(room), input, inputSize);
+        in.produced(inputSize);
+    }
+
+    return true;
+}
+
+const char *Session::pendingData() const
+{
+    if (!shared.empty() && shared.front().at == outPos)
+    {
+        return shared.front().buffer->data.data() + shared.front().offset;
+    }
+    return out.data() + outPos;
+}
+
+size_t Session::pendingLength() const
+{
+    if (shared.empty())
+    {
+        return out.size() - outPos;
+    }
+
+    const SharedSlice &slice = shared.front();
+    if (slice.at == outPos)
+    {
+        return slice.buffer->data.size() - slice.offset;
+    }
+    return slice.at - outPos;
+}
+
+size_t Session::pendingIov(struct iovec *iov, size_t max) const
+{
+    size_t count = 0;
+    size_t pos = outPos;
+
+    // own bytes up to each shared slice, then the slice
+    for (size_t i = 0; i <= shared.size() && count < max; i++)
+    {
+        size_t end = i < shared.size() ? shared[i].at : out.size();
+        if (end > pos)
+        {
+            iov[count].iov_base = (void *)(out.data() + pos);
+            iov[count].iov_len = end - pos;
+            count++;
+            pos = end;
+        }
+
+        if (i < shared.size() && count < max)
+        {
+            const SharedSlice &slice = shared[i];
+            iov[count].iov_base =
+                (void *)(slice.buffer->data.data() + slice.offset);
+            iov[count].iov_len = slice.buffer->data.size() - slice.offset;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void Session::consumed(size_t count)
+{
+    metrics.count(BYTES_SENT, count);
+    if (trace != NULL)
+    {
+        recorder.event(trace, TRACE_SENT, count);
+    }
+
+    // a gathered send may cover several pieces
+    while (count > 0)
+    {
+        size_t used = min(count, pendingLength());
+        count -= used;
+        if (trace != NULL)
+        {
+            trace->events.append(pendingData(), used);
+        }
+
+        if (!shared.empty() && shared.front().at == outPos)
+        {
+            SharedSlice &slice = shared.front();
+            slice.offset += used;
+            if (slice.offset == slice.buffer->data.size())
+            {
+                releaseBuffer(slice.buffer);
+                shared.pop_front();
+            }
+        }
+        else
+        {
+            outPos += used;
+        }
+    }
+
+    // rewind once everything queued so far is out
+    if (outPos == out.size() && shared.empty())
+    {
+        out.clear();
+        outPos = 0;
+    }
+}
+
+void Session::deliver(SharedBuffer *buffer, bool last)
+{
+    // a session being closed for an error gets nothing more
+    if (state == CLOSED)
+    {
+        return;
+    }
+
+    SharedSlice slice;
+    slice.buffer = retainBuffer(buffer);
+    slice.offset = 0;
+    slice.at = out.size();
+    shared.push_back(slice);
+
+    sendStage = "room update";
+    if (last)
+    {
+        state = CLOSED;
+        waitingSince = monotonicMs();
+    }
+
+    if (!woken)
+    {
+        woken = true;
+        wokenSessions.push_back(this);
+    }
+}
+
+bool Session::takeWoken(vector<Session *> &sessions)
+{
+    sessions.swap(wokenSessions);
+    wokenSessions.clear();
+    for (size_t i = 0; i < sessions.size(); i++)
+    {
+        sessions[i]->woken = false;
+    }
+
+    return !sessions.empty();
+}
+
+uint64_t Session::deadline() const
+{
+    // the name is due after the handshake timeout, every later step
+    // after the turn timeout; waiting on the rest of a room is not the
+    // client's fault
+    uint64_t limit = state == WELCOME || state == NAME ? handshakeTimeout
+                                                       : turnTimeout;
+    if (state == WAITING)
+    {
+        limit = 0;
+    }
+    uint64_t due = limit != 0 ? waitingSince + limit : 0;
+
+    if (sessionTimeout != 0 &&
+        (due == 0 || startedAt + sessionTimeout < due))
+    {
+        due = startedAt + sessionTimeout;
+    }
+    return due;
+}
+
+const char *Session::receiving() const
+{
+    switch (state)
+    {
+    case NAME:
+        return nameLength < 0 && version == 1 ? "username length"
+                                              : "username";
+    case GUESS:
+        return "user guess";
+    default:
+        return "request";
+    }
+}
+
+bool Session::onInput(const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t room;
+        char *space = inputSpace(room);
+        if (room == 0)
+        {
+            return false;
+        }
+        if (room > length)
+        {
+            room = length;
+        }
+        memcpy(space, data, room);
+        data += room;
+        length -= room;
+
+        if (!onReceived(room))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Session::onReceived(size_t count)
+{
+    in.produced(count);
+    metrics.count(BYTES_RECEIVED, count);
+    if (trace != NULL)
+    {
+        recorder.event(trace, TRACE_RECEIVED, count);
+        trace->events.append(in.data() + in.size() - count, count);
+    }
+
+    // nothing more is expected once the game is over
+    if (state == CLOSED)
+    {
+        in.consume(in.size());
+        in.releaseIfEmpty();
+        return true;
+    }
+
+    bool ok = advance();
+
+    // idle sessions hold no input buffer
+    in.releaseIfEmpty();
+
+    return ok;
+}
+
+bool Session::advance()
+{
+    while (true)
+    {
+        size_t available = in.size();
+
+        if (version == 2)
+        {
+            bool ok = true;
+            if (!advanceFrame(ok))
+            {
+                return ok;
+            }
+        }
+        else if (state == NAME && nameLength < 0)
+        {
+            if (available < V1_INT_SIZE)
+            {
+                return true;
+            }
+            nameLength = getV1Int(in.data());
+            in.consume(V1_INT_SIZE);
+
+            // the rest of the session speaks protocol v2
+            if (nameLength == PROTOCOL_V2_MAGIC)
+            {
+                version = 2;
+                continue;
+            }
+
+            // never buffer more than the frame limit for a name
+            if (nameLength < 0 || (size_t)nameLength > MAX_NAME ||
+                !in.reserve(nameLength))
+            {
+                state = CLOSED;
+                return false;
+            }
+        }
+        else if (state == NAME)
+        {
+            if (available < (size_t)nameLength)
+            {
+                return true;
+            }
+            string name(in.data(), nameLength);
+            in.consume(nameLength);
+
+            startGame(name);
+        }
+        else if (state == GUESS)
+        {
+            if (available < 2 * V1_INT_SIZE)
+            {
+                return true;
+            }
+            uint64_t begin = metricsClock();
+            long userX = getV1Int(in.data());
+            long userY = getV1Int(in.data() + V1_INT_SIZE);
+            in.consume(2 * V1_INT_SIZE);
+
+            queueGuessResult(userX, userY);
+            metrics.record(TURN_TIME, metricsClock() - begin);
+        }
+        else
+        {
+            // client sent something while nothing was asked
+            in.consume(available);
+            return true;
+        }
+    }
+}
+
+// handle one v2 frame, false if there was none to handle; ok is cleared
+// when the frame was unexpected, malformed or over the frame limit
+bool Session::advanceFrame(bool &ok)
+{
+    FrameHeader header;
+    string_view payload;
+    bool tooLarge;
+
+    if (state == CLOSED)
+    {
+        in.consume(in.size());
+        return false;
+    }
+    if (!in.peekFrame(header, payload, tooLarge))
+    {
+        if (tooLarge)
+        {
+            state = CLOSED;
+            ok = false;
+        }
+        return false;
+    }
+
+    uint64_t begin = metricsClock();
+    GuessFrame guess;
+    vector<GuessFrame> guesses;
+    if (state == NAME && header.type == FRAME_NAME &&
+        payload.size() <= MAX_NAME)
+    {
+        startGame(string(payload));
+    }
+    else if (state == GUESS && header.type == FRAME_GUESS &&
+             decodeFrame(payload.data(), payload.size(), guess))
+    {
+        queueGuessResult(guess.x, guess.y);
+        metrics.record(TURN_TIME, metricsClock() - begin);
+    }
+    else if (state == GUESS && header.type == FRAME_GUESS_BATCH &&
+             decodeGuessBatch(payload.data(), payload.size(), guesses))
+    {
+        queueBatchResult(guesses);
+        metrics.record(TURN_TIME, metricsClock() - begin);
+    }
+    else
+    {
+        // unexpected or malformed frame
+        state = CLOSED;
+        ok = false;
+        return false;
+    }
+    in.consume(FRAME_HEADER_SIZE + header.length);
+
+    return true;
+}
+
+// create the player and hide the treasure
+void Session::startGame(const string &name)
+{
+    // initialize a new player
+    newPlayer = player(name, 0);
+
+    // v1 has no frames to tell a player about the others
+    if (version == 2 && Room::enabled() && !solo)
+    {
+        room = Room::join(this);
+        location = room->getTreasure();
+    }
+    else
+    {
+        // take a random location from the pool
+        location = treasures.next();
+
+        // print treasure location on the server console
+        logger.treasure(location.x, location.y);
+    }
+
+    queueTurn(-1);
+}
+
+// send "Turn (tries)" and ask user for a guess, v2 carries the distance
+// of the previous guess in the same frame
+void Session::queueTurn(double distance)
+{
+    state = TURN;
+    sendStage = "number of turns";
+
+    newPlayer.tries++;
+    if (version == 2)
+    {
+        TurnFrame turn;
+        turn.turn = newPlayer.tries;
+        turn.distance = distance;
+        encodeFrame(out, turn);
+    }
+    else
+    {
+        putV1Message(out, "\nTurn: " + to_string(newPlayer.tries) + "\n");
+        putV1Message(out, playMsg);
+    }
+
+    state = GUESS;
+    waitingSince = monotonicMs();
+}
+
+// send distance to treasure, then either the next turn or the results
+void Session::queueGuessResult(long userX, long userY)
+{
+    sendStage = "distance to treasure location";
+    metrics.count(TURNS);
+
+    double distance = calcDist(location.x, location.y, userX, userY);
+    logger.guess(userX, userY, distance);
+    if (version == 1)
+    {
+        putV1Distance(out, distance);
+    }
+
+    if ((location.x != userX) || (location.y != userY))
+    {
+        queueTurn(distance);
+        return;
+    }
+
+    queueResult();
+}
+
+// answer a batch of guesses with one DISTANCES frame, stopping at the
+// first exact hit, every guess costs a try
+void Session::queueBatchResult(const vector<GuessFrame> &guesses)
+{
+    sendStage = "distances to treasure location";
+
+    DistancesFrame reply;
+    reply.distances.resize(guesses.size());
+    calcDistBatch(location.x, location.y, guesses.data(), guesses.size(),
+                  reply.distances.data());
+
+    bool found = false;
+    size_t answered = 0;
+    while (answered < guesses.size() && !found)
+    {
+        // the first guess uses the try of the current turn
+        if (answered > 0)
+        {
+            newPlayer.tries++;
+        }
+        const GuessFrame &guess = guesses[answered];
+        logger.guess(guess.x, guess.y, reply.distances[answered]);
+        found = location.x == guess.x && location.y == guess.y;
+        answered++;
+    }
+    reply.distances.resize(answered);
+
+    if (!found)
+    {
+        newPlayer.tries++;
+    }
+    reply.turn = newPlayer.tries;
+    encodeDistances(out, reply);
+    metrics.count(TURNS, reply.distances.size());
+
+    if (found)
+    {
+        queueResult();
+        return;
+    }
+
+    state = GUESS;
+    waitingSince = monotonicMs();
+}
+
+// global rank of a game that just finished in tries, and the share of
+// games that took longer; a game another process counts is only
+// counted here for the message
+static string rankMessage(int tries, bool counted)
+{
+    if (counted)
+    {
+        ranks.add(tries);
+    }
+    uint64_t total = ranks.total() + (counted ? 0 : 1);
+    uint64_t slower = ranks.slower(tries);
+    uint64_t tenths = total == 0 ? 0 : slower * 1000 / total;
+
+    return "Global rank: " + to_string(ranks.rank(tries)) + " of " +
+           to_string(max(total, (uint64_t)1)) + " games, better than " +
+           to_string(tenths / 10) + "." + to_string(tenths % 10) +
+           "% of them.";
+}
+
+void Session::queueResult()
+{
+    state = RESULT;
+    sendStage = "congratulation message";
+
+    // record the game, never waits for other games finishing; while the
+    // server hands off, the new process records it instead
+    uint64_t begin = metricsClock();
+    bool forward = handoff.beginGame();
+    vector<player> players = leaderboard.finish(newPlayer, !forward);
+    string rankMsg = rankMessage(newPlayer.tries, !forward);
+    handoff.endGame(newPlayer, forward);
+    metrics.record(LEADERBOARD_WAIT, metricsClock() - begin);
+    metrics.count(GAMES_FINISHED);
+
+    string cngratMsg =
+        "Congratulations! You found the treasure!\nIt took " +
+        to_string(newPlayer.tries) +
+        (newPlayer.tries == 1 ? " turn" : " turns") +
+        " to find the treasure.\n" + rankMsg;
+    state = LEADERBOARD;
+    sendStage = "leaderboard";
+
+    if (version == 2)
+    {
+        ResultFrame result;
+        result.tries = newPlayer.tries;
+        result.message = cngratMsg;
+        for (size_t i = 0; i < players.size(); i++)
+        {
+            BoardEntry entry;
+            entry.name = players[i].name;
+            entry.tries = players[i].tries;
+            result.board.push_back(entry);
+        }
+        uint8_t flags = room == NULL ? 0 : RESULT_STANDINGS_FOLLOW;
+        if (!encodeResult(out, result, flags))
+        {
+            // too large for one frame, the session ends without it
+            printError("encode", "result frame");
+            state = CLOSED;
+            return;
+        }
+        if (room == NULL)
+        {
+            state = CLOSED;
+            return;
+        }
+
+        // the standings from the room close the session
+        state = WAITING;
+        waitingSince = monotonicMs();
+        room->finished(this, newPlayer);
+        return;
+    }
+
+    putV1Message(out, cngratMsg);
+
+    // leaderboard size, then name and tries of every player
+    putV1Int(out, players.size());
+    for (size_t i = 0; i < players.size(); i++)
+    {
+        putV1Message(out, players[i].name);
+        putV1Int(out, players[i].tries);
+    }
+
+    state = CLOSED;
+}
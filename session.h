@@ -0,0 +1,166 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Per-session game state machine
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "game.h"
+#include "protocol.h"
+#include "frame_reader.h"
+#include "shared_buffer.h"
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+class Room;
+struct SessionTrace;
+
+// steps of one game, in the order playGame() used to walk through them
+enum SessionState
+{
+    WELCOME,     // welcome message queued, nothing received yet
+    NAME,        // waiting for the username length and body
+    TURN,        // turn and prompt messages being queued
+    GUESS,       // waiting for the (x, y) guess
+    RESULT,      // congratulation message being queued
+    LEADERBOARD, // leaderboard being queued
+    WAITING,     // room player done, waiting for the room's standings
+    CLOSED       // game over or protocol error
+};
+
+/* One game of Treasure Hunt with no I/O of its own.
+   Bytes received from the client go in through onInput() and the bytes
+   to send back accumulate in the output buffer, so the same session can
+   be driven by a blocking thread or by a non-blocking event loop.
+   A room can also queue output on a session while another session of
+   the same thread is being handled; the driver finds such sessions with
+   takeWoken() and flushes them. */
+class Session
+{
+public:
+    Session();
+    ~Session();
+
+    // queue the welcome message, from here on the session is recorded
+    // with --record
+    void start();
+
+    // play alone even with rooms enabled, for a driver that never takes
+    // woken sessions; call before start()
+    void stayOutOfRooms() { solo = true; }
+
+    // largest name or frame accepted from any client
+    static void setMaxFrame(size_t bytes);
+
+    // time limits in ms for the name, each guess and the whole session,
+    // 0 for none
+    static void setTimeouts(uint64_t handshake, uint64_t turn,
+                            uint64_t total);
+
+    // monotonicMs() by which the session must be closed unless the client
+    // makes progress, 0 if there is no limit
+    uint64_t deadline() const;
+
+    // consume bytes from the client, false on a malformed request
+    bool onInput(const char *data, size_t length);
+
+    // room to recv() into directly, length is 0 if the buffer is full
+    char *inputSpace(size_t &length) { return in.space(length); }
+
+    // count bytes were received into inputSpace(), false on a malformed
+    // request
+    bool onReceived(size_t count);
+
+    // next bytes to send to the client, send them until the length is 0
+    const char *pendingData() const;
+    size_t pendingLength() const;
+
+    // up to max pending pieces in send order for sendmsg(), their count
+    size_t pendingIov(struct iovec *iov, size_t max) const;
+
+    // drop the first count pending bytes once they have been sent
+    void consumed(size_t count);
+
+    // queue a buffer shared with other sessions, last ends the session
+    // once it is sent
+    void deliver(SharedBuffer *buffer, bool last);
+
+    // what the driver keeps for this session, for takeWoken()
+    void setOwner(void *owner) { this->owner = owner; }
+    void *getOwner() const { return owner; }
+
+    // sessions of this thread that got output through deliver() since
+    // the last call, false if there are none
+    static bool takeWoken(std::vector<Session *> &sessions);
+
+    // game finished and nothing left to send
+    bool done() const { return state == CLOSED && pendingLength() == 0; }
+
+    SessionState getState() const { return state; }
+
+    // 1 until the client asks for protocol v2
+    int getVersion() const { return version; }
+
+    // waiting for the client with nothing to send and no room, so the
+    // session can move to another server process
+    bool canHandOff() const;
+
+    // append everything a new server process needs to go on with the
+    // session, and restore it there; importState() is false if the
+    // state is malformed, call it instead of start()
+    void exportState(std::string &out) const;
+    bool importState(const char *data, size_t length);
+
+    // what is being received or sent right now, for printError()
+    const char *receiving() const;
+    const char *sending() const { return sendStage; }
+
+private:
+    // parse as much buffered input as the current state allows
+    bool advance();
+    bool advanceFrame(bool &ok);
+
+    void startGame(const std::string &name);
+    void queueTurn(double distance);
+    void queueGuessResult(long userX, long userY);
+    void queueBatchResult(const std::vector<GuessFrame> &guesses);
+    void queueResult();
+
+    // bytes of a shared buffer still to send, queued before out[at]
+    struct SharedSlice
+    {
+        SharedBuffer *buffer;
+        size_t offset;
+        size_t at;
+    };
+
+    SessionState state;
+    int version;
+    FrameReader in;  // received bytes not yet parsed
+    std::string out; // bytes not yet sent
+    size_t outPos;
+    std::deque<SharedSlice> shared; // room output, in order with out
+    const char *sendStage;
+
+    uint64_t startedAt;    // monotonicMs()
+    uint64_t waitingSince; // last time the client was asked for input
+
+    long nameLength; // -1 until the username length is known
+    player newPlayer;
+    treasureLocation location;
+
+    Room *room; // NULL unless playing in a room
+    bool solo;  // never joins a room
+    SessionTrace *trace; // NULL unless recording
+    void *owner;
+    bool woken; // already returned by the next takeWoken()
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Leaderboard shared by worker processes
+*/
+
+#include "shared_board.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sched.h>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+SharedBoard sharedBoard;
+
+// the page is shared between processes, so its atomics must not fall
+// back to a lock inside one process
+static_assert(atomic<uint64_t>::is_always_lock_free &&
+                  atomic<pid_t>::is_always_lock_free,
+              "shared board atomics must be lock-free");
+
+// tries before a reader or writer gives up on a locked page
+static const int READ_ATTEMPTS = 1000;
+static const int LOCK_ATTEMPTS = 10000;
+
+// true if board holds the game with this id
+static bool contains(const leaderBoard &board, unsigned long id)
+{
+    for (size_t i = 0; i < board.players.size(); i++)
+    {
+        if (board.players[i].id == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+SharedBoard::SharedBoard() : page(NULL)
+{
+}
+
+bool SharedBoard::create()
+{
+    void *mapping = mmap(NULL, sizeof(Page), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        cerr << "Error mapping the shared leaderboard" << endl;
+        return false;
+    }
+
+    // anonymous mappings start zeroed: sequence 0 and no entries
+    page = new (mapping) Page;
+    page->sequence.store(0);
+    page->writer.store(0);
+    page->count = 0;
+
+    return true;
+}
+
+// the player an entry holds, its name kept within the entry
+player SharedBoard::entryPlayer(const Entry &entry)
+{
+    player copy;
+    copy.id = entry.id;
+    copy.tries = entry.tries;
+    copy.name.assign(entry.name,
+                     min<size_t>(entry.nameLength, sizeof(entry.name)));
+    return copy;
+}
+
+bool SharedBoard::read(leaderBoard &board) const
+{
+    for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+    {
+        uint64_t before = page->sequence.load(memory_order_acquire);
+        if (before & 1)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // a torn copy is thrown away below, only keep it in bounds
+        board.players.clear();
+        size_t count = min((size_t)page->count, LEADERBOARD_SIZE);
+        for (size_t i = 0; i < count; i++)
+        {
+            board.players.push_back(entryPlayer(page->entries[i]));
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (page->sequence.load(memory_order_relaxed) == before)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SharedBoard::merge(const vector<player> &games)
+{
+    // take the page by making the sequence odd
+    uint64_t sequence = page->sequence.load(memory_order_relaxed);
+    int attempt = 0;
+    while ((sequence & 1) ||
+           !page->sequence.compare_exchange_weak(sequence, sequence + 1,
+                                                 memory_order_acquire))
+    {
+        if (++attempt == LOCK_ATTEMPTS)
+        {
+            return false;
+        }
+        sched_yield();
+        sequence = page->sequence.load(memory_order_relaxed);
+    }
+    page->writer.store(getpid(), memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    leaderBoard board;
+    size_t count = min((size_t)page->count, LEADERBOARD_SIZE);
+    for (size_t i = 0; i < count; i++)
+    {
+        board.players.push_back(entryPlayer(page->entries[i]));
+    }
+    for (size_t i = 0; i < games.size(); i++)
+    {
+        if (!contains(board, games[i].id))
+        {
+            updateBoard(board, games[i]);
+        }
+    }
+
+    page->count = board.players.size();
+    for (size_t i = 0; i < board.players.size(); i++)
+    {
+        Entry &entry = page->entries[i];
+        const player &ranked = board.players[i];
+        entry.id = ranked.id;
+        entry.tries = ranked.tries;
+        entry.nameLength = min<size_t>(ranked.name.size(), sizeof(entry.name));
+        memcpy(entry.name, ranked.name.data(), entry.nameLength);
+    }
+
+    page->writer.store(0, memory_order_relaxed);
+    page->sequence.store(sequence + 2, memory_order_release);
+
+    return true;
+}
+
+void SharedBoard::recover(pid_t dead)
+{
+    if (page == NULL || page->writer.load() != dead)
+    {
+        return;
+    }
+
+    // the entries may be half written but stay within bounds
+    uint64_t sequence = page->sequence.load();
+    if (page->count > LEADERBOARD_SIZE)
+    {
+        page->count = 0;
+    }
+    for (size_t i = 0; i < LEADERBOARD_SIZE; i++)
+    {
+        Entry &entry = page->entries[i];
+        entry.nameLength = min<size_t>(entry.nameLength, sizeof(entry.name));
+    }
+    page->writer.store(0);
+    if (sequence & 1)
+    {
+        page->sequence.store(sequence + 1, memory_order_release);
+    }
+}
@@ -0,0 +1,75 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Leaderboard shared by worker processes
+*/
+
+#ifndef SHARED_BOARD_H
+#define SHARED_BOARD_H
+
+#include "game.h"
+#include "frame_reader.h"
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/* Global top-K of every worker process in one shared memory mapping.
+
+   The page is a seqlock: a writer makes the sequence odd, updates the
+   entries and makes it even again; a reader copies the entries and
+   keeps the copy only if the sequence was the same even value before
+   and after. Reading never blocks a writer or another reader.
+
+   Only the leaderboard merger threads write, and only when a game
+   enters their process's top-K, so the compare-and-swap on the
+   sequence that keeps writers apart is off the turn path. A worker that
+   dies inside a write leaves the sequence odd; readers then fall back to
+   their process's own board after a bounded number of attempts until
+   the parent calls recover(). */
+class SharedBoard
+{
+public:
+    SharedBoard();
+
+    // map the page, before forking the workers, false on failure
+    bool create();
+
+    bool enabled() const { return page != NULL; }
+
+    // copy the board, false if it was being written the whole time
+    bool read(leaderBoard &board) const;
+
+    // fold games into the board, those already on it are skipped by id,
+    // false if the page stayed locked
+    bool merge(const std::vector<player> &games);
+
+    // release the page if the dead worker was writing it
+    void recover(pid_t dead);
+
+private:
+    struct Entry
+    {
+        uint64_t id;
+        uint32_t tries;
+        uint32_t nameLength;
+        char name[DEFAULT_MAX_FRAME]; // longest name a session accepts
+    };
+
+    struct Page
+    {
+        std::atomic<uint64_t> sequence; // odd while a writer is inside
+        std::atomic<pid_t> writer;      // worker inside, for recover()
+        uint32_t count;
+        Entry entries[LEADERBOARD_SIZE];
+    };
+
+    static player entryPlayer(const Entry &entry);
+
+    Page *page; // NULL unless created
+};
+
+extern SharedBoard sharedBoard;
+
+#endif
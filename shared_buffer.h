@@ -0,0 +1,38 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Reference-counted output buffer
+*/
+
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <atomic>
+#include <string>
+
+/* Bytes encoded once and queued on many sessions.
+   Every session that queued the buffer holds one reference and drops it
+   once the bytes are sent; the last release frees it. */
+struct SharedBuffer
+{
+    std::string data;
+    std::atomic<long> refs; // the creator holds one reference
+
+    SharedBuffer() : refs(1) {}
+};
+
+inline SharedBuffer *retainBuffer(SharedBuffer *buffer)
+{
+    buffer->refs.fetch_add(1, std::memory_order_relaxed);
+    return buffer;
+}
+
+inline void releaseBuffer(SharedBuffer *buffer)
+{
+    if (buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete buffer;
+    }
+}
+
+#endif
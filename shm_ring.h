@@ -0,0 +1,463 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Shared memory rings between local processes
+*/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include "protocol.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+/* A byte stream between two processes of one host, made of two single
+   producer single consumer rings in a memfd: one carries the client's
+   bytes to the server, the other the server's bytes back. The same
+   framing code runs over it as over a socket, through readStream() and
+   writeStream().
+
+   Positions are free running byte counts, each written by one side
+   only, so a read or a write is a copy and one store. A side that finds
+   its ring empty, or full, spins for a moment if there is a spare cpu
+   and then sleeps on a futex in the shared page; the other side only
+   makes the futex call when it sees someone asleep.
+
+   The Unix domain socket the memfd came over stays open next to the
+   rings. Nothing is sent on it any more, so a sleeper that finds it
+   readable or hung up knows the peer is gone, or on the server that the
+   reaper shut the session down. The memfd is sealed against resizing
+   before it is offered, so the peer can never make the mapping fault. */
+
+// bytes in each direction, a power of two
+const uint32_t RING_CAPACITY = 64 * 1024;
+
+// capacities a server accepts from an offered ring
+const uint32_t MIN_RING_CAPACITY = 4096;
+const uint32_t MAX_RING_CAPACITY = 16 * 1024 * 1024;
+
+class ShmChannel
+{
+public:
+    ShmChannel()
+        : layout(NULL), in(NULL), out(NULL), inData(NULL), outData(NULL),
+          capacity(0), mapped(0), sock(-1), fd(-1)
+    {
+    }
+
+    ~ShmChannel() { close(); }
+
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+
+    // client: a new sealed memfd with empty rings, memfd() is what to
+    // offer over sock, false on failure
+    bool create(int sock)
+    {
+        size_t size = sizeof(Layout) + 2 * (size_t)RING_CAPACITY;
+        int memfd = memfd_create("pa4-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0)
+        {
+            return false;
+        }
+        if (ftruncate(memfd, size) < 0 ||
+            fcntl(memfd, F_ADD_SEALS,
+                  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+            !map(memfd, size))
+        {
+            ::close(memfd);
+            return false;
+        }
+
+        // a new memfd is zeroed: both rings empty and open
+        new (layout) Layout;
+        memcpy(layout->magic, RING_MAGIC, sizeof(layout->magic));
+        layout->capacity = RING_CAPACITY;
+        setEnds(RING_CAPACITY, false);
+        this->sock = sock;
+        return true;
+    }
+
+    // server: map the rings of a memfd offered over sock, the channel
+    // owns it from then on; false if it is not a sealed, valid ring
+    bool attach(int sock, int memfd)
+    {
+        fd = memfd;
+
+        struct stat info;
+        int seals = fcntl(memfd, F_GET_SEALS);
+        if (seals < 0 ||
+            (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) !=
+                (F_SEAL_SHRINK | F_SEAL_GROW) ||
+            fstat(memfd, &info) < 0 ||
+            info.st_size < (off_t)sizeof(Layout) ||
+            info.st_size >
+                (off_t)(sizeof(Layout) + 2 * (size_t)MAX_RING_CAPACITY) ||
+            !map(memfd, info.st_size))
+        {
+            close();
+            return false;
+        }
+
+        // the capacity is read once, the client may change it later
+        uint32_t offered = layout->capacity;
+        if (memcmp(layout->magic, RING_MAGIC, sizeof(layout->magic)) != 0 ||
+            offered < MIN_RING_CAPACITY || offered > MAX_RING_CAPACITY ||
+            (offered & (offered - 1)) != 0 ||
+            (size_t)info.st_size != sizeof(Layout) + 2 * (size_t)offered)
+        {
+            close();
+            return false;
+        }
+
+        setEnds(offered, true);
+        this->sock = sock;
+        return true;
+    }
+
+    int memfd() const { return fd; }
+
+    // wait for at least one byte, 0 once the peer closed its side and
+    // everything was read, -1 if the peer is gone
+    ssize_t read(char *buffer, size_t length)
+    {
+        Ring &ring = *in;
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        if (!wait(ring, [&]() {
+                return ring.tail.load(std::memory_order_acquire) != head ||
+                       ring.closed.load(std::memory_order_acquire);
+            }))
+        {
+            return -1;
+        }
+
+        uint32_t used = ring.tail.load(std::memory_order_acquire) - head;
+        if (used > capacity)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        if (used == 0 || length == 0)
+        {
+            return 0;
+        }
+
+        size_t count = used < length ? used : length;
+        size_t at = head & (capacity - 1);
+        size_t first = count < capacity - at ? count : capacity - at;
+        memcpy(buffer, inData + at, first);
+        memcpy(buffer + first, inData, count - first);
+
+        ring.head.store(head + count);
+        notify(ring);
+        return count;
+    }
+
+    // wait for room and write all of data, false if the peer is gone
+    bool write(const char *data, size_t length)
+    {
+        Ring &ring = *out;
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+
+        while (length > 0)
+        {
+            if (!wait(ring, [&]() {
+                    return tail - ring.head.load(std::memory_order_acquire) <
+                               capacity ||
+                           in->closed.load(std::memory_order_acquire);
+                }))
+            {
+                return false;
+            }
+
+            uint32_t used = tail - ring.head.load(std::memory_order_acquire);
+            if (used >= capacity)
+            {
+                // full with the peer done reading, or a corrupt ring
+                errno = used == capacity ? EPIPE : EPROTO;
+                return false;
+            }
+
+            size_t count = capacity - used < length ? capacity - used
+                                                    : length;
+            size_t at = tail & (capacity - 1);
+            size_t first = count < capacity - at ? count : capacity - at;
+            memcpy(outData + at, data, first);
+            memcpy(outData, data + first, count - first);
+
+            tail += count;
+            ring.tail.store(tail);
+            notify(ring);
+            data += count;
+            length -= count;
+        }
+
+        return true;
+    }
+
+    // tell the peer nothing more is coming and unmap the rings, the
+    // socket stays with the caller
+    void close()
+    {
+        if (layout != NULL)
+        {
+            if (out != NULL)
+            {
+                out->closed.store(1);
+                notify(*out);
+                notify(*in);
+            }
+            munmap(layout, mapped);
+            layout = NULL;
+            in = out = NULL;
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+private:
+    // one direction
+    struct Ring
+    {
+        alignas(64) std::atomic<uint32_t> head; // bytes read, reader only
+        alignas(64) std::atomic<uint32_t> tail; // bytes written, writer only
+        std::atomic<uint32_t> closed;           // writer is done
+        alignas(64) std::atomic<uint32_t> wake; // futex word of a sleeper
+        std::atomic<uint32_t> sleepers;         // sides waiting on wake
+    };
+
+    // start of the memfd, each ring's bytes follow in order
+    struct Layout
+    {
+        char magic[8];
+        uint32_t capacity;
+        Ring rings[2]; // client to server, server to client
+    };
+
+    static constexpr const char *RING_MAGIC = "PA4RING1";
+
+    // spins before sleeping, only worth it with a cpu for the peer
+    static const int SPIN_LIMIT = 2000;
+
+    // longest futex sleep between checks of the socket
+    static const long WAIT_SLICE_NS = 50 * 1000 * 1000;
+
+    bool map(int memfd, size_t size)
+    {
+        void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             memfd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        layout = (Layout *)mapping;
+        mapped = size;
+        fd = memfd;
+        return true;
+    }
+
+    void setEnds(uint32_t ringCapacity, bool serverEnd)
+    {
+        char *data = (char *)layout + sizeof(Layout);
+        capacity = ringCapacity;
+        in = &layout->rings[serverEnd ? 0 : 1];
+        out = &layout->rings[serverEnd ? 1 : 0];
+        inData = data + (serverEnd ? 0 : capacity);
+        outData = data + (serverEnd ? capacity : 0);
+    }
+
+    // the socket has something to say, which after the offer can only be
+    // the end of the connection
+    bool peerGone() const
+    {
+        struct pollfd check;
+        check.fd = sock;
+        check.events = POLLIN | POLLRDHUP;
+        check.revents = 0;
+        int ready = poll(&check, 1, 0);
+        return ready > 0 || (ready < 0 && errno != EINTR);
+    }
+
+    static bool spareCpu()
+    {
+        static const bool spare = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        return spare;
+    }
+
+    // wait until ready() holds, false if the peer went away first
+    template <typename Ready>
+    bool wait(Ring &ring, Ready ready)
+    {
+        if (ready())
+        {
+            return true;
+        }
+        for (int i = 0; spareCpu() && i < SPIN_LIMIT; i++)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            if (ready())
+            {
+                return true;
+            }
+        }
+
+        while (true)
+        {
+            // announce the sleep before the last look, a writer either
+            // sees the count or its update is seen here
+            uint32_t seen = ring.wake.load();
+            ring.sleepers.fetch_add(1);
+            if (ready())
+            {
+                ring.sleepers.fetch_sub(1);
+                return true;
+            }
+
+            struct timespec slice;
+            slice.tv_sec = 0;
+            slice.tv_nsec = WAIT_SLICE_NS;
+            syscall(SYS_futex, &ring.wake, FUTEX_WAIT, seen, &slice, NULL,
+                    0);
+            ring.sleepers.fetch_sub(1);
+
+            if (ready())
+            {
+                return true;
+            }
+            if (peerGone())
+            {
+                return false;
+            }
+        }
+    }
+
+    // wake whoever sleeps on ring after its positions changed
+    static void notify(Ring &ring)
+    {
+        if (ring.sleepers.load() != 0)
+        {
+            ring.wake.fetch_add(1);
+            syscall(SYS_futex, &ring.wake, FUTEX_WAKE, INT_MAX, NULL, NULL,
+                    0);
+        }
+    }
+
+    Layout *layout; // NULL unless mapped
+    Ring *in;
+    Ring *out;
+    char *inData;
+    char *outData;
+    uint32_t capacity; // private copy, the peer cannot change it
+    size_t mapped;
+    int sock;
+    int fd;
+};
+
+// the ring's bytes through the same calls as a socket's
+inline ssize_t readStream(ShmChannel &channel, char *buffer, size_t length)
+{
+    return channel.read(buffer, length);
+}
+
+inline ssize_t writeStream(ShmChannel &channel, const char *data,
+                           size_t length)
+{
+    return channel.write(data, length) ? (ssize_t)length : -1;
+}
+
+// client: send PROTOCOL_RING_MAGIC with memfd attached, false on error
+inline bool offerRing(int sock, int memfd)
+{
+    std::string magic;
+    putV1Int(magic, PROTOCOL_RING_MAGIC);
+
+    struct iovec iov;
+    iov.iov_base = (void *)magic.data();
+    iov.iov_len = magic.size();
+
+    union
+    {
+        char bytes[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    return sendmsg(sock, &message, MSG_NOSIGNAL) == (ssize_t)magic.size();
+}
+
+// server: one recvmsg() into buffer that also takes a descriptor sent
+// with the bytes, memfd is -1 if none came; returns what recvmsg()
+// returned
+inline ssize_t receiveOffer(int sock, char *buffer, size_t length,
+                            int &memfd)
+{
+    memfd = -1;
+
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = length;
+
+    union
+    {
+        char bytes[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    // descriptors beyond the first are closed by the kernel
+    ssize_t bytesRecv = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+         bytesRecv >= 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+        {
+            memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    return bytesRecv;
+}
+
+#endif
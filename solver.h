@@ -0,0 +1,226 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Trilateration solver
+*/
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "protocol.h"
+
+#include <cmath>
+#include <vector>
+
+/* Finds the treasure in as few turns as the distances allow.
+
+   The first probe is a corner of the grid. Every reply is an exact
+   Euclidean distance, so the treasure lies on the grid points of that
+   circle (at most 16 of them from a corner). Each following guess is
+   the point, preferably a remaining candidate, whose distances split
+   the candidates into the smallest worst-case group. A second probe on
+   the same edge leaves at most one point inside the grid, so a session
+   takes three turns at worst and often two.
+
+   If a reply contradicts every candidate (the server is not using this
+   grid or these distances), the solver falls back to scanning the grid
+   in order instead of giving up. */
+class TreasureSolver
+{
+public:
+    TreasureSolver(long minCoord = -100, long maxCoord = 100)
+        : minCoord(minCoord), maxCoord(maxCoord)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        candidates.clear();
+        probed = false;
+        scanning = false;
+        scanNext = 0;
+    }
+
+    // next point to guess
+    GuessFrame nextGuess()
+    {
+        if (scanning)
+        {
+            long width = maxCoord - minCoord + 1;
+            GuessFrame guess;
+            guess.x = minCoord + scanNext / width;
+            guess.y = minCoord + scanNext % width;
+            scanNext = (scanNext + 1) % (width * width);
+            return guess;
+        }
+
+        if (!probed)
+        {
+            return corner(minCoord, minCoord);
+        }
+
+        if (candidates.size() == 1)
+        {
+            return candidates[0];
+        }
+
+        // candidates first so a lucky guess ends the game, then the
+        // corner on the same edge as the first probe
+        GuessFrame best = candidates[0];
+        size_t bestWorst = worstGroup(best);
+        for (size_t i = 1; i < candidates.size() && bestWorst > 1; i++)
+        {
+            size_t worst = worstGroup(candidates[i]);
+            if (worst < bestWorst)
+            {
+                best = candidates[i];
+                bestWorst = worst;
+            }
+        }
+
+        GuessFrame edge = corner(minCoord, maxCoord);
+        if (worstGroup(edge) < bestWorst)
+        {
+            best = edge;
+        }
+
+        return best;
+    }
+
+    // guesses that can go out together in one GUESS_BATCH: both probes
+    // on the first edge, which pin the treasure down, then the answer
+    std::vector<GuessFrame> nextBatch()
+    {
+        std::vector<GuessFrame> batch;
+        if (!probed && !scanning)
+        {
+            batch.push_back(corner(minCoord, minCoord));
+            batch.push_back(corner(minCoord, maxCoord));
+        }
+        else
+        {
+            batch.push_back(nextGuess());
+        }
+        return batch;
+    }
+
+    // narrow the candidates down with the distance reported for guess
+    void observe(const GuessFrame &guess, double distance)
+    {
+        if (scanning)
+        {
+            return;
+        }
+
+        long r2 = lround(distance * distance);
+
+        if (!probed)
+        {
+            probed = true;
+            pointsOnCircle(guess, r2);
+        }
+        else
+        {
+            size_t kept = 0;
+            for (size_t i = 0; i < candidates.size(); i++)
+            {
+                if (squaredDistance(candidates[i], guess) == r2)
+                {
+                    candidates[kept++] = candidates[i];
+                }
+            }
+            candidates.resize(kept);
+        }
+
+        if (candidates.empty())
+        {
+            scanning = true;
+        }
+    }
+
+    // points still consistent with every distance so far
+    size_t remaining() const { return candidates.size(); }
+    bool solved() const { return !scanning && candidates.size() == 1; }
+
+private:
+    static GuessFrame corner(long x, long y)
+    {
+        GuessFrame guess;
+        guess.x = x;
+        guess.y = y;
+        return guess;
+    }
+
+    static long squaredDistance(const GuessFrame &a, const GuessFrame &b)
+    {
+        long dx = (long)a.x - b.x;
+        long dy = (long)a.y - b.y;
+        return dx * dx + dy * dy;
+    }
+
+    // grid points at squared distance r2 from center
+    void pointsOnCircle(const GuessFrame &center, long r2)
+    {
+        candidates.clear();
+
+        for (long x = minCoord; x <= maxCoord; x++)
+        {
+            long dy2 = r2 - (x - center.x) * (x - center.x);
+            if (dy2 < 0)
+            {
+                continue;
+            }
+            long dy = lround(sqrt((double)dy2));
+            if (dy * dy != dy2)
+            {
+                continue;
+            }
+
+            for (int sign = -1; sign <= 1; sign += 2)
+            {
+                long y = center.y + sign * dy;
+                if (minCoord <= y && y <= maxCoord)
+                {
+                    candidates.push_back(corner(x, y));
+                }
+                if (dy == 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    // size of the largest group of candidates sharing a distance to guess
+    size_t worstGroup(const GuessFrame &guess) const
+    {
+        size_t worst = 0;
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            long r2 = squaredDistance(candidates[i], guess);
+            size_t group = 0;
+            for (size_t j = 0; j < candidates.size(); j++)
+            {
+                if (squaredDistance(candidates[j], guess) == r2)
+                {
+                    group++;
+                }
+            }
+            if (group > worst)
+            {
+                worst = group;
+            }
+        }
+        return worst;
+    }
+
+    long minCoord;
+    long maxCoord;
+    std::vector<GuessFrame> candidates;
+    bool probed;
+    bool scanning;
+    long scanNext;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Admission control tests
+*/
+
+#include "check.h"
+#include "../admission.h"
+#include "../protocol.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+// a connected pair, client[0] for the server side
+static bool makePair(int client[2])
+{
+    return socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, client) == 0;
+}
+
+// everything the peer sends until it closes, with a short timeout
+static string drain(int sock)
+{
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    string received;
+    char buffer[256];
+    ssize_t bytesRecv;
+    while ((bytesRecv = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+    {
+        received.append(buffer, bytesRecv);
+    }
+    return bytesRecv == 0 ? received : "(no end of stream)";
+}
+
+// non-blocking listener on a free loopback port, port filled in
+static int listenLoopback(struct sockaddr_in &addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, length) < 0 ||
+        listen(sock, 16) < 0 ||
+        getsockname(sock, (struct sockaddr *)&addr, &length) < 0)
+    {
+        return -1;
+    }
+    return sock;
+}
+
+static int connectTo(const struct sockaddr_in &addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(sock, (const struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+TEST(admissionLimitAndBusyReply)
+{
+    AdmissionControl control;
+    CHECK(control.start(2, true));
+
+    int first[2], second[2], third[2];
+    CHECK(makePair(first) && makePair(second) && makePair(third));
+    CHECK(control.admit(first[0]));
+    CHECK(control.admit(second[0]));
+    CHECK(control.activeSessions() == 2);
+
+    // over the limit: told the server is busy and closed
+    CHECK(!control.admit(third[0]));
+    CHECK(control.activeSessions() == 2);
+    string expected;
+    putV1Message(expected, "Server busy, try again later\n");
+    CHECK(drain(third[1]) == expected);
+
+    // a finished session makes room again
+    control.release();
+    int fourth[2];
+    CHECK(makePair(fourth));
+    CHECK(control.admit(fourth[0]));
+    CHECK(control.activeSessions() == 2);
+
+    // sessions handed over are never refused
+    control.adopt();
+    CHECK(control.activeSessions() == 3);
+
+    int fds[] = {first[0],  first[1], second[0], second[1],
+                 third[1],  fourth[0], fourth[1]};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        close(fds[i]);
+    }
+}
+
+TEST(admissionNoLimitCountsOnlyWhenTracking)
+{
+    AdmissionControl control;
+    CHECK(control.start(0, false));
+
+    int pair[2];
+    CHECK(makePair(pair));
+    CHECK(control.admit(pair[0]));
+    CHECK(control.activeSessions() == 0);
+
+    control.trackSessions();
+    CHECK(control.admit(pair[0]));
+    CHECK(control.activeSessions() == 1);
+    control.release();
+    CHECK(control.activeSessions() == 0);
+
+    close(pair[0]);
+    close(pair[1]);
+}
+
+// the pending client is accepted and closed at once, not left queued
+TEST(admissionShedClient)
+{
+    AdmissionControl control;
+    CHECK(control.start(0, false));
+
+    struct sockaddr_in addr;
+    int listenSock = listenLoopback(addr);
+    CHECK(listenSock >= 0);
+    bool failed = true;
+    CHECK(control.acceptReady(listenSock, SOCK_CLOEXEC, failed) < 0);
+    CHECK(!failed);
+
+    int client = connectTo(addr);
+    CHECK(client >= 0);
+    CHECK(control.shedClient(listenSock));
+    CHECK(drain(client).empty());
+    CHECK(!control.shedClient(listenSock));
+
+    close(client);
+    close(listenSock);
+}
+
+struct Acceptor
+{
+    AdmissionControl *control;
+    int listenSock;
+    int result;
+};
+
+static void *acceptMain(void *args)
+{
+    Acceptor *acceptor = (Acceptor *)args;
+    acceptor->result = acceptor->control->acceptSession(acceptor->listenSock);
+    return NULL;
+}
+
+// a handoff stops the acceptors waiting on a shared listener
+TEST(admissionStopAccepting)
+{
+    AdmissionControl control;
+    CHECK(control.start(0, false));
+
+    struct sockaddr_in addr;
+    Acceptor acceptor;
+    acceptor.control = &control;
+    acceptor.listenSock = listenLoopback(addr);
+    acceptor.result = 0;
+    CHECK(acceptor.listenSock >= 0);
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, acceptMain, &acceptor) == 0);
+    usleep(20 * 1000);
+    control.stopAccepting();
+    pthread_join(thread, NULL);
+    CHECK(acceptor.result == -1);
+
+    close(acceptor.listenSock);
+}
@@ -0,0 +1,48 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Unit test harness
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstddef>
+
+/* Just enough of a test framework for pa4_test. TEST(name) defines a
+   test that registers itself before main() runs; CHECK(cond) records a
+   failure with its file and line and lets the test go on, so one run
+   shows every broken expectation. pa4_test runs every test, or those
+   whose name contains its argument, and exits with 1 if any failed. */
+
+typedef void (*TestFunction)();
+
+struct TestCase
+{
+    const char *name;
+    TestFunction run;
+};
+
+// adds the test to the list pa4_test runs
+struct TestRegistrar
+{
+    TestRegistrar(const char *name, TestFunction run);
+};
+
+void checkFailed(const char *file, int line, const char *condition);
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static TestRegistrar name##Registrar(#name, name);               \
+    static void name()
+
+#define CHECK(condition)                                             \
+    do                                                               \
+    {                                                                \
+        if (!(condition))                                            \
+        {                                                            \
+            checkFailed(__FILE__, __LINE__, #condition);             \
+        }                                                            \
+    } while (0)
+
+#endif
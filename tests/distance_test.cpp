@@ -0,0 +1,111 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Distance engine tests
+*/
+
+#include "check.h"
+#include "../distance.h"
+#include "../game.h"
+
+#include <climits>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// the original formula every fast path has to match bit for bit
+static double referenceDist(long dx, long dy)
+{
+    return sqrt(pow(dx, 2) + pow(dy, 2));
+}
+
+// true if every distance of the batch is the reference one
+static bool batchMatches(long randomX, long randomY,
+                         const vector<GuessFrame> &guesses)
+{
+    vector<double> fast(guesses.size());
+    calcDistBatch(randomX, randomY, guesses.data(), guesses.size(),
+                  fast.data());
+    for (size_t i = 0; i < guesses.size(); i++)
+    {
+        double expected = referenceDist(randomX - guesses[i].x,
+                                        randomY - guesses[i].y);
+        if (fast[i] != expected)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// every offset the table holds, both signs
+TEST(distanceTableMatchesFormula)
+{
+    bool same = true;
+    for (long dx = -GRID_SPAN; dx <= GRID_SPAN; dx++)
+    {
+        for (long dy = -GRID_SPAN; dy <= GRID_SPAN; dy++)
+        {
+            same = same && calcDist(dx, dy, 0, 0) == referenceDist(dx, dy);
+        }
+    }
+    CHECK(same);
+}
+
+// a grid row through both vector widths and the scalar tail
+TEST(distanceBatchGridRow)
+{
+    vector<GuessFrame> guesses;
+    for (long y = -100; y <= 100; y++)
+    {
+        GuessFrame guess;
+        guess.x = 37;
+        guess.y = y;
+        guesses.push_back(guess);
+    }
+    CHECK(batchMatches(-58, 91, guesses));
+
+    // every length up to two AVX2 blocks, so each tail is covered
+    for (size_t count = 0; count <= 9; count++)
+    {
+        vector<GuessFrame> head(guesses.begin(), guesses.begin() + count);
+        CHECK(batchMatches(12, -7, head));
+    }
+}
+
+// offsets far off the grid, around the edge of the vector path and past
+// it, where the batch falls back to the formula
+TEST(distanceBatchOffGrid)
+{
+    mt19937_64 engine(3500);
+    uniform_int_distribution<int32_t> coord(INT32_MIN, INT32_MAX);
+    uniform_int_distribution<long> edge(-EXACT_SPAN - 8, EXACT_SPAN + 8);
+    for (int round = 0; round < 64; round++)
+    {
+        vector<GuessFrame> guesses;
+        for (int i = 0; i < 19; i++)
+        {
+            GuessFrame guess;
+            guess.x = round % 2 ? coord(engine) : edge(engine);
+            guess.y = i % 3 ? coord(engine) : edge(engine);
+            guesses.push_back(guess);
+        }
+        CHECK(batchMatches(edge(engine), 0, guesses));
+    }
+}
+
+// a treasure too far out to be exact in a double
+TEST(distanceBatchFarTreasure)
+{
+    vector<GuessFrame> guesses;
+    for (int i = 0; i < 11; i++)
+    {
+        GuessFrame guess;
+        guess.x = i * 1000003;
+        guess.y = -i;
+        guesses.push_back(guess);
+    }
+    CHECK(batchMatches(1L << 60, -(1L << 53), guesses));
+}
@@ -0,0 +1,217 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Session handoff tests
+*/
+
+#include "check.h"
+#include "../session.h"
+#include "../treasure.h"
+#include "../logger.h"
+#include "../protocol.h"
+#include "../room.h"
+
+#include <string>
+
+using namespace std;
+
+// what a session needs from the server to get as far as a guess
+static void startServices()
+{
+    static bool started = false;
+    if (!started)
+    {
+        started = logger.start(LOG_WARN) && treasures.start(64, true, 23);
+    }
+}
+
+// everything the session has queued, as the driver would send it
+static string drain(Session &session)
+{
+    string sent;
+    while (session.pendingLength() > 0)
+    {
+        sent.append(session.pendingData(), session.pendingLength());
+        session.consumed(session.pendingLength());
+    }
+    return sent;
+}
+
+static string v1Name(const string &name)
+{
+    string bytes;
+    putV1Int(bytes, name.size());
+    return bytes + name;
+}
+
+static string v1Guess(long x, long y)
+{
+    string bytes;
+    putV1Int(bytes, x);
+    putV1Int(bytes, y);
+    return bytes;
+}
+
+// session moved to a new one the way a restart moves it
+static bool handOver(const Session &from, Session &to)
+{
+    string state;
+    from.exportState(state);
+    return to.importState(state.data(), state.size());
+}
+
+// the new process answers a guess exactly like the old one would have
+TEST(handoffSessionAnswersLikeTheOriginal)
+{
+    startServices();
+    Session original;
+    original.start();
+    drain(original);
+    string name = v1Name("alice");
+    CHECK(original.onInput(name.data(), name.size()));
+    drain(original);
+    CHECK(original.getState() == GUESS && original.canHandOff());
+
+    Session moved;
+    CHECK(handOver(original, moved));
+    CHECK(moved.getState() == GUESS && moved.getVersion() == 1);
+    CHECK(moved.deadline() == original.deadline());
+
+    // a guess off the grid never finds the treasure
+    string guess = v1Guess(1000, -1000);
+    CHECK(original.onInput(guess.data(), guess.size()));
+    CHECK(moved.onInput(guess.data(), guess.size()));
+    string expected = drain(original);
+    CHECK(!expected.empty() && drain(moved) == expected);
+}
+
+// bytes received but not parsed yet travel with the session
+TEST(handoffKeepsPartialInput)
+{
+    startServices();
+
+    // v1: the name length and half of the name
+    Session v1;
+    v1.start();
+    drain(v1);
+    string name = v1Name("bob");
+    CHECK(v1.onInput(name.data(), name.size() - 2));
+    CHECK(v1.getState() == NAME);
+
+    Session v1Moved;
+    CHECK(handOver(v1, v1Moved));
+    CHECK(v1Moved.onInput(name.data() + name.size() - 2, 2));
+    CHECK(v1Moved.getState() == GUESS && !drain(v1Moved).empty());
+
+    // v2: half of a GUESS frame
+    Session v2;
+    v2.start();
+    drain(v2);
+    string hello;
+    putV1Int(hello, PROTOCOL_V2_MAGIC);
+    encodeName(hello, "carol");
+    CHECK(v2.onInput(hello.data(), hello.size()));
+    drain(v2);
+
+    string guess;
+    GuessFrame frame;
+    frame.x = 1000;
+    frame.y = 1000;
+    encodeFrame(guess, frame);
+    CHECK(v2.onInput(guess.data(), 5));
+
+    Session v2Moved;
+    CHECK(handOver(v2, v2Moved));
+    CHECK(v2Moved.getVersion() == 2);
+    CHECK(v2Moved.onInput(guess.data() + 5, guess.size() - 5));
+
+    string reply = drain(v2Moved);
+    FrameHeader header;
+    TurnFrame turn = TurnFrame();
+    CHECK(frameComplete(reply.data(), reply.size(), header) &&
+          header.type == FRAME_TURN &&
+          decodeFrame(reply.data() + FRAME_HEADER_SIZE, header.length,
+                      turn) &&
+          turn.turn == 2);
+}
+
+// only a session waiting on its client with nothing to send can move
+TEST(handoffOnlyIdleSessions)
+{
+    startServices();
+    Session session;
+    session.start();
+    CHECK(!session.canHandOff());
+    drain(session);
+    CHECK(session.canHandOff());
+}
+
+// whatever arrives over the control socket is checked before use
+TEST(handoffRefusesMalformedState)
+{
+    startServices();
+    Session original;
+    original.start();
+    drain(original);
+    string name = v1Name("dave");
+    CHECK(original.onInput(name.data(), name.size()));
+    drain(original);
+
+    string state;
+    original.exportState(state);
+
+    Session cut;
+    CHECK(!cut.importState(state.data(), state.size() - 1));
+
+    string longer = state + "x";
+    Session extra;
+    CHECK(!extra.importState(longer.data(), longer.size()));
+
+    string badState = state;
+    badState[0] = (char)RESULT;
+    Session result;
+    CHECK(!result.importState(badState.data(), badState.size()));
+
+    string badVersion = state;
+    badVersion[1] = 3;
+    Session version;
+    CHECK(!version.importState(badVersion.data(), badVersion.size()));
+
+    // a name the parser would never have taken
+    string longName;
+    longName.append(state, 0, 46);
+    putU32(longName, MAX_NAME + 1);
+    longName.append(MAX_NAME + 1, 'n');
+    putU32(longName, 0);
+    Session named;
+    CHECK(!named.importState(longName.data(), longName.size()));
+}
+
+// a v2 player in a room waits on the others and stays put, one kept out
+// of rooms plays alone and can still move
+TEST(handoffSessionOutOfRooms)
+{
+    startServices();
+    Room::setSize(4);
+
+    string hello;
+    putV1Int(hello, PROTOCOL_V2_MAGIC);
+    encodeName(hello, "dave");
+
+    Session member;
+    member.start();
+    drain(member);
+    CHECK(member.onInput(hello.data(), hello.size()));
+    drain(member);
+    CHECK(member.getState() == GUESS && !member.canHandOff());
+
+    Session solo;
+    solo.stayOutOfRooms();
+    solo.start();
+    drain(solo);
+    CHECK(solo.onInput(hello.data(), hello.size()));
+    drain(solo);
+    CHECK(solo.getState() == GUESS && solo.canHandOff());
+
+    Room::setSize(0);
+}
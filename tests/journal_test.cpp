@@ -0,0 +1,196 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Durable leaderboard journal tests
+*/
+
+#include "check.h"
+#include "../journal.h"
+#include "../game.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// what one start of a journal recovered
+struct Recovered
+{
+    bool ok;
+    leaderBoard board;
+    unsigned long lastId;
+    vector<uint64_t> byTries;
+};
+
+// a new empty directory for one test
+static string tempDir()
+{
+    char path[] = "/tmp/pa4-journal-XXXXXX";
+    return mkdtemp(path) != NULL ? path : "";
+}
+
+// start a journal on dir as a restarted server would; its writer thread
+// never exits, so the journal is never freed either
+static GameJournal *startJournal(const string &dir, Recovered &recovered)
+{
+    GameJournal *games = new GameJournal;
+    recovered.ok = games->start(dir, recovered.board, recovered.lastId,
+                                recovered.byTries);
+    return games;
+}
+
+static player game(const string &name, int tries, unsigned long id)
+{
+    player finished(name, tries);
+    finished.id = id;
+    return finished;
+}
+
+static uint64_t countOf(const Recovered &recovered, size_t tries)
+{
+    return tries < recovered.byTries.size() ? recovered.byTries[tries] : 0;
+}
+
+static void appendBytes(const string &path, const string &bytes)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    if (fd >= 0)
+    {
+        ssize_t written = write(fd, bytes.data(), bytes.size());
+        (void)written;
+        close(fd);
+    }
+}
+
+static off_t fileSize(const string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+TEST(journalRecoversWrittenGames)
+{
+    string dir = tempDir();
+    Recovered first;
+    GameJournal *games = startJournal(dir, first);
+    CHECK(first.ok);
+    CHECK(first.board.players.empty() && first.lastId == 0);
+
+    games->append(game("carol", 9, 1));
+    games->append(game("alice", 3, 2));
+    games->append(game("dave", 12, 3));
+    games->append(game("bob", 5, 4));
+    games->flush();
+
+    Recovered second;
+    startJournal(dir, second);
+    CHECK(second.ok);
+    CHECK(second.lastId == 4);
+    CHECK(second.board.players.size() == LEADERBOARD_SIZE);
+    CHECK(second.board.players[0].name == "alice" &&
+          second.board.players[1].name == "bob" &&
+          second.board.players[2].name == "carol");
+    CHECK(countOf(second, 3) == 1 && countOf(second, 12) == 1 &&
+          countOf(second, 4) == 0);
+}
+
+// a crash in the middle of a write leaves part of a record at the end
+TEST(journalDropsTornRecord)
+{
+    string dir = tempDir();
+    Recovered first;
+    GameJournal *games = startJournal(dir, first);
+    games->append(game("alice", 3, 1));
+    games->flush();
+
+    string log = dir + "/games.log";
+    off_t complete = fileSize(log);
+    appendBytes(log, string("\x12\x34\x56\x78\x05\x00\x00", 7));
+
+    Recovered second;
+    GameJournal *restarted = startJournal(dir, second);
+    CHECK(second.ok);
+    CHECK(second.board.players.size() == 1 && second.lastId == 1);
+    CHECK(fileSize(log) == complete);
+
+    // games after the cut are appended where the torn one was
+    restarted->append(game("bob", 2, 2));
+    restarted->flush();
+    Recovered third;
+    startJournal(dir, third);
+    CHECK(third.board.players.size() == 2 &&
+          third.board.players[0].name == "bob" && third.lastId == 2);
+}
+
+// a damaged record ends the replay, the games before it survive
+TEST(journalStopsAtDamagedRecord)
+{
+    string dir = tempDir();
+    Recovered first;
+    GameJournal *games = startJournal(dir, first);
+    games->append(game("alice", 3, 1));
+    games->flush();
+    off_t good = fileSize(dir + "/games.log");
+    games->append(game("bob", 2, 2));
+    games->flush();
+
+    // flip a byte of the second record's name
+    int fd = open((dir + "/games.log").c_str(), O_WRONLY);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, "X", 1, fileSize(dir + "/games.log") - 1) == 1);
+    close(fd);
+
+    Recovered second;
+    startJournal(dir, second);
+    CHECK(second.ok);
+    CHECK(second.board.players.size() == 1 &&
+          second.board.players[0].name == "alice" && second.lastId == 1);
+    CHECK(fileSize(dir + "/games.log") == good);
+}
+
+// enough games for a snapshot, then recovery from it and from the log
+// alone once the snapshot is damaged
+TEST(journalRecoversFromSnapshot)
+{
+    const unsigned long GAMES = 70000;
+
+    string dir = tempDir();
+    Recovered first;
+    GameJournal *games = startJournal(dir, first);
+    for (unsigned long id = 1; id <= GAMES; id++)
+    {
+        games->append(game("p" + to_string(id), 10 + id % 50, id));
+    }
+    games->append(game("best", 1, GAMES + 1));
+    games->flush();
+
+    string snapshot = dir + "/leaderboard.snap";
+    CHECK(fileSize(snapshot) > 0);
+
+    Recovered second;
+    startJournal(dir, second);
+    CHECK(second.ok);
+    CHECK(second.lastId == GAMES + 1);
+    CHECK(!second.board.players.empty() &&
+          second.board.players[0].name == "best");
+    CHECK(countOf(second, 1) == 1 && countOf(second, 10) == GAMES / 50);
+
+    // a bad checksum falls back to replaying the whole log
+    int fd = open(snapshot.c_str(), O_WRONLY);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, "\xff", 1, fileSize(snapshot) - 1) == 1);
+    close(fd);
+
+    Recovered third;
+    startJournal(dir, third);
+    CHECK(third.ok);
+    CHECK(third.lastId == second.lastId &&
+          third.board.players.size() == second.board.players.size() &&
+          third.board.players[0].name == "best");
+    CHECK(third.byTries == second.byTries);
+}
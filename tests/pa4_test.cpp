@@ -0,0 +1,72 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Unit test runner
+*/
+
+#include "check.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// filled in by the TestRegistrars before main() runs
+static vector<TestCase> &tests()
+{
+    static vector<TestCase> all;
+    return all;
+}
+
+// failed checks of the test running now
+static int failures = 0;
+
+TestRegistrar::TestRegistrar(const char *name, TestFunction run)
+{
+    TestCase test;
+    test.name = name;
+    test.run = run;
+    tests().push_back(test);
+}
+
+void checkFailed(const char *file, int line, const char *condition)
+{
+    cerr << file << ":" << line << ": CHECK(" << condition << ") failed"
+         << endl;
+    failures++;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        cerr << "Usage: " << argv[0] << " [name filter]" << endl;
+        exit(EXIT_FAILURE);
+    }
+    const char *filter = argc == 2 ? argv[1] : "";
+
+    int ran = 0;
+    int failed = 0;
+    for (size_t i = 0; i < tests().size(); i++)
+    {
+        const TestCase &test = tests()[i];
+        if (strstr(test.name, filter) == NULL)
+        {
+            continue;
+        }
+
+        failures = 0;
+        test.run();
+        ran++;
+        if (failures > 0)
+        {
+            failed++;
+        }
+        cout << (failures > 0 ? "FAIL " : "ok   ") << test.name << endl;
+    }
+
+    cout << ran - failed << " of " << ran << " tests passed" << endl;
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
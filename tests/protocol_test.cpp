@@ -0,0 +1,241 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Protocol v2 codec tests
+*/
+
+#include "check.h"
+#include "../protocol.h"
+#include "../frame_reader.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// the single complete frame at the front of bytes, false if there is none
+static bool onlyFrame(const string &bytes, FrameHeader &header,
+                      string &payload)
+{
+    if (!frameComplete(bytes.data(), bytes.size(), header) ||
+        bytes.size() != FRAME_HEADER_SIZE + header.length)
+    {
+        return false;
+    }
+    payload = bytes.substr(FRAME_HEADER_SIZE);
+    return true;
+}
+
+TEST(protocolFixedFramesRoundTrip)
+{
+    string out;
+    TurnFrame turn;
+    turn.turn = 7;
+    turn.distance = 12.5;
+    encodeFrame(out, turn);
+
+    FrameHeader header;
+    string payload;
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(header.type == FRAME_TURN && header.flags == 0);
+
+    TurnFrame decoded = TurnFrame();
+    CHECK(decodeFrame(payload.data(), payload.size(), decoded));
+    CHECK(decoded.turn == 7 && decoded.distance == 12.5);
+
+    // a payload of the wrong size never decodes
+    GuessFrame guess;
+    CHECK(!decodeFrame(payload.data(), payload.size(), guess));
+    CHECK(!decodeFrame(payload.data(), payload.size() - 1, decoded));
+}
+
+TEST(protocolBatchRoundTrip)
+{
+    vector<GuessFrame> guesses(3);
+    guesses[0].x = -100;
+    guesses[0].y = 100;
+    guesses[1].x = INT32_MIN;
+    guesses[1].y = INT32_MAX;
+    guesses[2].x = 0;
+    guesses[2].y = -1;
+
+    string out;
+    encodeGuessBatch(out, guesses);
+    FrameHeader header;
+    string payload;
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(header.type == FRAME_GUESS_BATCH);
+
+    vector<GuessFrame> decoded;
+    CHECK(decodeGuessBatch(payload.data(), payload.size(), decoded));
+    CHECK(decoded.size() == 3 && decoded[1].x == INT32_MIN &&
+          decoded[1].y == INT32_MAX && decoded[2].y == -1);
+    CHECK(!decodeGuessBatch(payload.data(), payload.size() - 1, decoded));
+
+    // too many guesses are cut to what one frame holds
+    out.clear();
+    encodeGuessBatch(out, vector<GuessFrame>(MAX_BATCH_GUESSES + 10));
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(decodeGuessBatch(payload.data(), payload.size(), decoded));
+    CHECK(decoded.size() == MAX_BATCH_GUESSES);
+
+    DistancesFrame reply;
+    reply.turn = 4;
+    reply.distances.push_back(1.5);
+    reply.distances.push_back(0);
+    out.clear();
+    encodeDistances(out, reply);
+    DistancesFrame distances;
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(decodeDistances(payload.data(), payload.size(), distances));
+    CHECK(distances.turn == 4 && distances.distances == reply.distances);
+}
+
+TEST(protocolResultAndRoomFramesRoundTrip)
+{
+    ResultFrame result;
+    result.tries = 9;
+    result.message = "Congratulations!";
+    BoardEntry entry;
+    entry.name = "alice";
+    entry.tries = 3;
+    result.board.push_back(entry);
+
+    string out;
+    CHECK(encodeResult(out, result, RESULT_STANDINGS_FOLLOW));
+    FrameHeader header;
+    string payload;
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(header.flags == RESULT_STANDINGS_FOLLOW);
+
+    ResultFrame decoded;
+    CHECK(decodeResult(payload.data(), payload.size(), decoded));
+    CHECK(decoded.tries == 9 && decoded.message == result.message &&
+          decoded.board.size() == 1 && decoded.board[0].name == "alice" &&
+          decoded.board[0].tries == 3);
+
+    // every truncation is refused rather than read past the end
+    bool refused = true;
+    for (size_t length = 0; length < payload.size(); length++)
+    {
+        refused = refused && !decodeResult(payload.data(), length, decoded);
+    }
+    CHECK(refused);
+
+    FoundFrame found;
+    found.name = "bob";
+    found.tries = 2;
+    found.place = 1;
+    out.clear();
+    CHECK(encodeFound(out, found));
+    FoundFrame foundBack;
+    CHECK(onlyFrame(out, header, payload));
+    CHECK(decodeFound(payload.data(), payload.size(), foundBack));
+    CHECK(foundBack.name == "bob" && foundBack.place == 1);
+}
+
+// the length field must never wrap: a frame over the limit is refused
+// and leaves what was already queued alone
+TEST(protocolOversizedFrameRefused)
+{
+    ResultFrame result;
+    result.tries = 1;
+    result.message = string(40000, 'm');
+    BoardEntry entry;
+    entry.name = string(30000, 'n');
+    entry.tries = 1;
+    result.board.push_back(entry);
+
+    string out = "queued";
+    CHECK(!encodeResult(out, result));
+    CHECK(out == "queued");
+
+    // a frame of exactly the limit still goes out
+    result.message = string(MAX_FRAME_PAYLOAD - 4 - 2 - 2, 'm');
+    result.board.clear();
+    out.clear();
+    CHECK(encodeResult(out, result));
+    CHECK(out.size() == FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD);
+    CHECK(parseHeader(out.data()).length == MAX_FRAME_PAYLOAD);
+}
+
+// the largest room with the longest names still fits one frame
+TEST(protocolFullRoomStandingsFit)
+{
+    StandingsFrame standings;
+    BoardEntry entry;
+    entry.name = string(MAX_NAME, 'p');
+    entry.tries = UINT32_MAX;
+    standings.players.assign(MAX_ROOM_PLAYERS, entry);
+
+    string out;
+    CHECK(encodeStandings(out, standings));
+    FrameHeader header;
+    string payload;
+    CHECK(onlyFrame(out, header, payload));
+
+    StandingsFrame decoded;
+    CHECK(decodeStandings(payload.data(), payload.size(), decoded));
+    CHECK(decoded.players.size() == MAX_ROOM_PLAYERS);
+}
+
+TEST(protocolNameCutToLimit)
+{
+    string out;
+    encodeName(out, string(MAX_NAME + 50, 'a'));
+    CHECK(out.size() == FRAME_HEADER_SIZE + MAX_NAME);
+    CHECK(parseHeader(out.data()).length == MAX_NAME);
+}
+
+TEST(protocolReaderPeeksWholeFrames)
+{
+    string bytes;
+    TurnFrame turn;
+    turn.turn = 1;
+    turn.distance = -1;
+    encodeFrame(bytes, turn);
+    encodeFrame(bytes, turn);
+
+    FrameReader reader;
+    FrameHeader header;
+    string_view payload;
+    bool tooLarge = true;
+
+    // byte by byte, the frame only shows once all of it is there
+    size_t frames = 0;
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        size_t length;
+        char *bp = reader.space(length);
+        *bp = bytes[i];
+        reader.produced(1);
+        if (reader.peekFrame(header, payload, tooLarge))
+        {
+            CHECK(payload.size() == 12);
+            reader.consume(FRAME_HEADER_SIZE + header.length);
+            frames++;
+        }
+        CHECK(!tooLarge);
+    }
+    CHECK(frames == 2 && reader.size() == 0);
+}
+
+TEST(protocolReaderRefusesOversizedFrames)
+{
+    FrameReader reader(64);
+    string bytes;
+    beginFrame(bytes, FRAME_NAME);
+    storeU16(&bytes[2], 100);
+
+    size_t length;
+    char *bp = reader.space(length);
+    memcpy(bp, bytes.data(), bytes.size());
+    reader.produced(bytes.size());
+
+    FrameHeader header;
+    string_view payload;
+    bool tooLarge = false;
+    CHECK(!reader.peekFrame(header, payload, tooLarge));
+    CHECK(tooLarge);
+}
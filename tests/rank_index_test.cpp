@@ -0,0 +1,164 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Rank index tests
+*/
+
+#include "check.h"
+#include "../rank_index.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// games per tries, the slow way the index must agree with
+struct Counted
+{
+    vector<uint64_t> byTries;
+
+    Counted() : byTries(MAX_RANKED_TRIES + 1) {}
+
+    void add(uint32_t tries)
+    {
+        size_t slot = tries == 0 ? 1 : tries;
+        byTries[slot < MAX_RANKED_TRIES ? slot : MAX_RANKED_TRIES]++;
+    }
+
+    uint64_t fewer(size_t slot) const
+    {
+        uint64_t count = 0;
+        for (size_t t = 1; t < slot; t++)
+        {
+            count += byTries[t];
+        }
+        return count;
+    }
+
+    uint64_t total() const { return fewer(MAX_RANKED_TRIES + 1); }
+};
+
+TEST(rankMatchesCounting)
+{
+    RankIndex index;
+    CHECK(index.create());
+    CHECK(index.total() == 0 && index.rank(5) == 1 && index.slower(5) == 0);
+
+    Counted counted;
+    mt19937 engine(21);
+    uniform_int_distribution<uint32_t> tries(1, 300);
+    for (int i = 0; i < 20000; i++)
+    {
+        uint32_t t = tries(engine);
+        index.add(t);
+        counted.add(t);
+    }
+
+    bool same = index.total() == counted.total();
+    for (uint32_t t = 1; t <= 310; t++)
+    {
+        uint64_t fewer = counted.fewer(t);
+        uint64_t atMost = counted.fewer(t + 1);
+        same = same && index.rank(t) == fewer + 1 &&
+               index.slower(t) == counted.total() - atMost;
+    }
+    CHECK(same);
+}
+
+// tries 0 counts with 1, anything past the last slot shares it
+TEST(rankEdgeSlots)
+{
+    RankIndex index;
+    CHECK(index.create());
+    index.add(0);
+    index.add(1);
+    index.add(MAX_RANKED_TRIES);
+    index.add(4000000000u);
+
+    CHECK(index.total() == 4);
+    CHECK(index.rank(1) == 1 && index.slower(1) == 2);
+    CHECK(index.rank(MAX_RANKED_TRIES) == 3);
+    CHECK(index.rank(4000000000u) == 3 && index.slower(4000000000u) == 0);
+}
+
+// counts() gives back exactly what restore() puts in
+TEST(rankCountsRoundTrip)
+{
+    RankIndex index;
+    CHECK(index.create());
+
+    Counted counted;
+    mt19937 engine(3500);
+    uniform_int_distribution<uint32_t> tries(0, MAX_RANKED_TRIES + 10);
+    for (int i = 0; i < 5000; i++)
+    {
+        uint32_t t = tries(engine);
+        index.add(t);
+        counted.add(t);
+    }
+    vector<uint64_t> byTries = index.counts();
+    CHECK(byTries == counted.byTries);
+
+    RankIndex restored;
+    CHECK(restored.create());
+    restored.restore(byTries);
+    CHECK(restored.counts() == byTries);
+    CHECK(restored.total() == index.total() &&
+          restored.rank(777) == index.rank(777));
+}
+
+static RankIndex *sharedIndex = NULL;
+
+static void *addMain(void *)
+{
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        sharedIndex->add(1 + i % 100);
+    }
+    return NULL;
+}
+
+// threads add without locks and no game is lost
+TEST(rankConcurrentAdds)
+{
+    RankIndex index;
+    CHECK(index.create());
+    sharedIndex = &index;
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(pthread_create(&threads[i], NULL, addMain, NULL) == 0);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(index.total() == 40000);
+    CHECK(index.rank(100) == 1 + 4 * 9900);
+}
+
+// the tree is shared with processes forked after create()
+TEST(rankSharedWithWorkers)
+{
+    RankIndex index;
+    CHECK(index.create());
+    index.add(7);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        index.add(3);
+        _exit(EXIT_SUCCESS);
+    }
+    CHECK(pid > 0);
+    int status;
+    waitpid(pid, &status, 0);
+
+    CHECK(index.total() == 2 && index.rank(7) == 2);
+}
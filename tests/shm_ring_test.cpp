@@ -0,0 +1,187 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Shared memory ring tests
+*/
+
+#include "check.h"
+#include "../shm_ring.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+
+using namespace std;
+
+/* Both ends of one ring connection inside the test process: the client
+   creates the rings and offers the memfd over a socketpair the way
+   pa4_client does, the server takes it the way a local session does. */
+struct RingPair
+{
+    int socks[2]; // client, server
+    ShmChannel client;
+    ShmChannel server;
+
+    bool open()
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) < 0 ||
+            !client.create(socks[0]) || !offerRing(socks[0], client.memfd()))
+        {
+            return false;
+        }
+
+        char magic[V1_INT_SIZE];
+        int memfd;
+        ssize_t bytesRecv = receiveOffer(socks[1], magic, sizeof(magic),
+                                         memfd);
+        return bytesRecv == (ssize_t)V1_INT_SIZE &&
+               getV1Int(magic) == PROTOCOL_RING_MAGIC && memfd >= 0 &&
+               server.attach(socks[1], memfd);
+    }
+
+    ~RingPair()
+    {
+        client.close();
+        server.close();
+        ::close(socks[0]);
+        ::close(socks[1]);
+    }
+};
+
+// read exactly length bytes, false on an early end
+static bool readAll(ShmChannel &channel, string &received, size_t length)
+{
+    char buffer[4096];
+    while (received.size() < length)
+    {
+        size_t wanted = length - received.size();
+        ssize_t bytesRecv = channel.read(
+            buffer, wanted < sizeof(buffer) ? wanted : sizeof(buffer));
+        if (bytesRecv <= 0)
+        {
+            return false;
+        }
+        received.append(buffer, bytesRecv);
+    }
+    return true;
+}
+
+TEST(ringRoundTrip)
+{
+    RingPair pair;
+    CHECK(pair.open());
+
+    CHECK(writeStream(pair.client, "guess", 5) == 5);
+    string received;
+    CHECK(readAll(pair.server, received, 5) && received == "guess");
+
+    CHECK(pair.server.write("turn", 4));
+    received.clear();
+    CHECK(readAll(pair.client, received, 4) && received == "turn");
+}
+
+// byte i of the stream the writer sends
+static char patternAt(size_t i)
+{
+    return (char)(i * 131 + i / 7);
+}
+
+struct Writer
+{
+    ShmChannel *channel;
+    size_t length;
+    bool ok;
+};
+
+static void *writerMain(void *args)
+{
+    Writer *writer = (Writer *)args;
+    string data(writer->length, 0);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = patternAt(i);
+    }
+
+    // odd pieces so the positions wrap anywhere in the ring
+    writer->ok = true;
+    for (size_t pos = 0; writer->ok && pos < data.size(); pos += 1009)
+    {
+        size_t piece = data.size() - pos < 1009 ? data.size() - pos : 1009;
+        writer->ok = writer->channel->write(data.data() + pos, piece);
+    }
+    return NULL;
+}
+
+// many times the ring's capacity, the writer waiting on a full ring
+TEST(ringWrapsAround)
+{
+    RingPair pair;
+    CHECK(pair.open());
+
+    Writer writer;
+    writer.channel = &pair.client;
+    writer.length = 20 * RING_CAPACITY + 123;
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, writerMain, &writer) == 0);
+
+    string received;
+    CHECK(readAll(pair.server, received, writer.length));
+    pthread_join(thread, NULL);
+    CHECK(writer.ok);
+
+    bool same = received.size() == writer.length;
+    for (size_t i = 0; same && i < received.size(); i++)
+    {
+        same = received[i] == patternAt(i);
+    }
+    CHECK(same);
+}
+
+// what was written before close() is still read, then the end
+TEST(ringCloseEndsStream)
+{
+    RingPair pair;
+    CHECK(pair.open());
+
+    CHECK(pair.client.write("bye", 3));
+    pair.client.close();
+
+    string received;
+    CHECK(readAll(pair.server, received, 3) && received == "bye");
+    char byte;
+    CHECK(pair.server.read(&byte, 1) == 0);
+}
+
+// a peer that dies without closing the rings hangs up the socket
+TEST(ringPeerGone)
+{
+    RingPair pair;
+    CHECK(pair.open());
+
+    shutdown(pair.socks[0], SHUT_RDWR);
+    char byte;
+    CHECK(pair.server.read(&byte, 1) < 0);
+}
+
+// a memfd that could still be resized, or is not a ring, is refused
+TEST(ringAttachRefusesBadMemfd)
+{
+    int socks[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) == 0);
+
+    int unsealed = memfd_create("pa4-test", MFD_CLOEXEC);
+    CHECK(unsealed >= 0 && ftruncate(unsealed, 4096 + 2 * 65536) == 0);
+    ShmChannel server;
+    CHECK(!server.attach(socks[1], unsealed));
+
+    ShmChannel client;
+    CHECK(client.create(socks[0]));
+    CHECK(pwrite(client.memfd(), "NOTARING", 8, 0) == 8);
+    ShmChannel other;
+    CHECK(!other.attach(socks[1], dup(client.memfd())));
+
+    close(socks[0]);
+    close(socks[1]);
+}
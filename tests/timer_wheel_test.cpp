@@ -0,0 +1,129 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Timer wheel tests
+*/
+
+#include "check.h"
+#include "../timer_wheel.h"
+
+#include <vector>
+
+using namespace std;
+
+// ticks the top level of the wheel reaches
+static const uint64_t RANGE = (uint64_t)1
+                              << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+
+// true if node fires at exactly tick expires, not a tick sooner
+static bool firesAt(TimerWheel &wheel, TimerNode &node, uint64_t expires)
+{
+    vector<TimerNode *> expired;
+    wheel.advance(expires - 1, expired);
+    if (!expired.empty() || !node.armed())
+    {
+        return false;
+    }
+    wheel.advance(expires, expired);
+    return expired.size() == 1 && expired[0] == &node && !node.armed();
+}
+
+// deadlines on each side of every level boundary
+TEST(timerFiresOnTimeAtEveryLevel)
+{
+    const uint64_t deltas[] = {1,     2,      63,     64,     65,
+                               4095,  4096,   4097,   262143, 262144,
+                               262145, RANGE - 1};
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++)
+    {
+        // an odd start so the slots are not lined up with the levels
+        uint64_t start = 1000 + 7 * i;
+        TimerWheel wheel(start);
+        TimerNode node;
+        wheel.arm(&node, start + deltas[i]);
+        CHECK(firesAt(wheel, node, start + deltas[i]));
+        CHECK(wheel.empty());
+    }
+}
+
+// deadlines past the top level wait there instead of firing early
+TEST(timerBeyondTopLevelIsNotEarly)
+{
+    const uint64_t deltas[] = {RANGE, RANGE + 5000, 3 * RANGE + 17};
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++)
+    {
+        TimerWheel wheel(123);
+        TimerNode node;
+        wheel.arm(&node, 123 + deltas[i]);
+        CHECK(node.expires == 123 + deltas[i]);
+        CHECK(firesAt(wheel, node, 123 + deltas[i]));
+    }
+}
+
+TEST(timerPastDeadlineFiresNextTick)
+{
+    TimerWheel wheel(500);
+    TimerNode node;
+    wheel.arm(&node, 10);
+    CHECK(firesAt(wheel, node, 501));
+}
+
+TEST(timerCancelAndRearm)
+{
+    TimerWheel wheel(0);
+    TimerNode cancelled;
+    TimerNode moved;
+    wheel.arm(&cancelled, 100);
+    wheel.arm(&moved, 100);
+    wheel.cancel(&cancelled);
+    CHECK(!cancelled.armed());
+
+    // rearming unlinks it from its old slot first
+    wheel.arm(&moved, 5000);
+    vector<TimerNode *> expired;
+    wheel.advance(4999, expired);
+    CHECK(expired.empty());
+    wheel.advance(5000, expired);
+    CHECK(expired.size() == 1 && expired[0] == &moved);
+    CHECK(wheel.empty());
+}
+
+// many timers over several levels come out in expiry order
+TEST(timerManyFireInOrder)
+{
+    TimerWheel wheel(0);
+    vector<TimerNode> nodes(2000);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        wheel.arm(&nodes[i], 1 + (i * 7919) % 300000);
+    }
+
+    vector<TimerNode *> expired;
+    uint64_t last = 0;
+    bool ordered = true;
+    for (uint64_t tick = 1; tick <= 300000; tick++)
+    {
+        expired.clear();
+        wheel.advance(tick, expired);
+        for (size_t i = 0; i < expired.size(); i++)
+        {
+            ordered = ordered && expired[i]->expires == tick && tick >= last;
+            last = tick;
+        }
+    }
+    CHECK(ordered);
+    CHECK(wheel.empty());
+}
+
+// the loop may sleep until the next busy slot or the next cascade
+TEST(timerTicksToNext)
+{
+    TimerWheel wheel(0);
+    CHECK(wheel.ticksToNext() == RANGE);
+
+    TimerNode node;
+    wheel.arm(&node, 10);
+    CHECK(wheel.ticksToNext() == 10);
+    wheel.arm(&node, 1000);
+    CHECK(wheel.ticksToNext() == TimerWheel::SLOTS);
+}
@@ -0,0 +1,156 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Hierarchical timer wheel
+*/
+
+#include "timer_wheel.h"
+
+using namespace std;
+
+// ticks the top level reaches, later timers wait in its last slot
+static const uint64_t WHEEL_RANGE =
+    (uint64_t)1 << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+
+static void unlink(TimerNode *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+TimerWheel::TimerWheel(uint64_t now) : current(now), count(0)
+{
+    // every slot is an empty circular list
+    for (int level = 0; level < LEVELS; level++)
+    {
+        for (int i = 0; i < SLOTS; i++)
+        {
+            slots[level][i].prev = &slots[level][i];
+            slots[level][i].next = &slots[level][i];
+        }
+    }
+}
+
+void TimerWheel::arm(TimerNode *node, uint64_t expires)
+{
+    if (node->armed())
+    {
+        unlink(node);
+        count--;
+    }
+
+    node->expires = expires > current ? expires : current + 1;
+    insert(node);
+    count++;
+}
+
+void TimerWheel::cancel(TimerNode *node)
+{
+    if (node->armed())
+    {
+        unlink(node);
+        count--;
+    }
+}
+
+// link node into the slot covering its expiry, at or after current
+void TimerWheel::insert(TimerNode *node)
+{
+    uint64_t at = node->expires;
+    uint64_t delta = at - current;
+
+    // past the top level: park it in the last slot the wheel reaches, it
+    // comes back here with its real expiry when that slot cascades
+    if (delta >= WHEEL_RANGE)
+    {
+        delta = WHEEL_RANGE - 1;
+        at = current + delta;
+    }
+
+    int level = 0;
+    while (delta >= (uint64_t)1 << (SLOT_BITS * (level + 1)))
+    {
+        level++;
+    }
+
+    TimerNode *head = &slots[level][(at >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+// move the nodes of one coarse slot down to the finer levels
+void TimerWheel::cascade(int level)
+{
+    TimerNode *head =
+        &slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+
+    TimerNode *node = head->next;
+    head->prev = head;
+    head->next = head;
+
+    while (node != head)
+    {
+        TimerNode *next = node->next;
+        insert(node);
+        node = next;
+    }
+}
+
+void TimerWheel::advance(uint64_t now, vector<TimerNode *> &expired)
+{
+    while (current < now)
+    {
+        // nothing armed, skip the idle ticks at once
+        if (count == 0)
+        {
+            current = now;
+            return;
+        }
+
+        current++;
+
+        // a level that wrapped brings its next slot down, which may
+        // wrap the level above it too
+        for (int level = 1; level < LEVELS; level++)
+        {
+            if (((current >> (SLOT_BITS * (level - 1))) & (SLOTS - 1)) != 0)
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        TimerNode *head = &slots[0][current & (SLOTS - 1)];
+        while (head->next != head)
+        {
+            TimerNode *node = head->next;
+            unlink(node);
+            count--;
+            expired.push_back(node);
+        }
+    }
+}
+
+uint64_t TimerWheel::ticksToNext() const
+{
+    if (count == 0)
+    {
+        return WHEEL_RANGE;
+    }
+
+    // the first busy slot of this lap, or the end of the lap where the
+    // next level cascades
+    for (uint64_t i = 1; i < SLOTS; i++)
+    {
+        const TimerNode *head = &slots[0][(current + i) & (SLOTS - 1)];
+        if (head->next != head || ((current + i) & (SLOTS - 1)) == 0)
+        {
+            return i;
+        }
+    }
+    return SLOTS;
+}
@@ -0,0 +1,85 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Hierarchical timer wheel
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <time.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// resolution of every timer
+const uint64_t TIMER_TICK_MS = 10;
+
+inline uint64_t monotonicMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// first tick at or after ms, so a timer never fires early
+inline uint64_t tickOf(uint64_t ms)
+{
+    return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+}
+
+// timer embedded in whatever it times out
+struct TimerNode
+{
+    TimerNode *prev; // NULL while not armed
+    TimerNode *next;
+    uint64_t expires; // tick
+    void *owner;
+
+    TimerNode() : prev(NULL), next(NULL), expires(0), owner(NULL) {}
+
+    bool armed() const { return prev != NULL; }
+};
+
+/* Timers kept in four levels of 64 slots, each level 64 times coarser
+   than the one below, like the classic kernel timer wheel. Arming and
+   cancelling unlink or link one node, whatever the number of timers.
+   Timers further away sit in a coarse slot and move down a level every
+   time the level below wraps around, so each timer is touched at most
+   once per level before it fires. A timer beyond the top level's reach
+   of 2^24 ticks waits in its furthest slot and goes back in from there,
+   so it neither fires early nor loses its expiry. Not thread-safe, a
+   wheel belongs to one thread or is used under its owner's lock. */
+class TimerWheel
+{
+public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    explicit TimerWheel(uint64_t now);
+
+    // (re)arm node to fire at tick expires, at the next tick if that
+    // has already passed
+    void arm(TimerNode *node, uint64_t expires);
+
+    void cancel(TimerNode *node);
+
+    // move time forward to tick now, appending every node that fired
+    void advance(uint64_t now, std::vector<TimerNode *> &expired);
+
+    bool empty() const { return count == 0; }
+
+    // ticks the caller may sleep before advance() can have work
+    uint64_t ticksToNext() const;
+
+private:
+    void insert(TimerNode *node);
+    void cascade(int level);
+
+    TimerNode slots[LEVELS][SLOTS]; // list heads
+    uint64_t current;               // last tick processed
+    size_t count;                   // armed nodes
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Treasure location provider
+*/
+
+#include "treasure.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <iostream>
+
+using namespace std;
+
+TreasureProvider treasures;
+
+mt19937_64 &threadEngine()
+{
+    // seeded once per thread instead of once per call
+    static thread_local mt19937_64 engine(random_device{}());
+    return engine;
+}
+
+// pick a location on the -100..100 grid
+static treasureLocation randomLocation(mt19937_64 &engine)
+{
+    uniform_int_distribution<long> distribution(-100, 100);
+
+    long randomX = distribution(engine);
+    long randomY = distribution(engine);
+    return treasureLocation(randomX, randomY);
+}
+
+TreasureProvider::TreasureProvider()
+    : pool(NULL), refillRequested(false), seeded(false), seed(0)
+{
+}
+
+bool TreasureProvider::start(size_t poolSize, bool seeded, uint64_t seed)
+{
+    this->seeded = seeded;
+    this->seed = seeded ? seed : random_device{}();
+    fillEngine.seed(this->seed);
+
+    sem_init(&wake, 0, 0);
+    pool = new MpmcQueue<treasureLocation>(poolSize);
+
+    pthread_t threadID;
+    int status = pthread_create(&threadID, NULL, refillMain, this);
+    if (status != 0)
+    {
+        cerr << "Error creating treasure refill thread" << endl;
+        delete pool;
+        pool = NULL;
+        return false;
+    }
+    pthread_detach(threadID);
+
+    return true;
+}
+
+void TreasureProvider::requestRefill()
+{
+    // one wakeup is enough however many sessions notice the pool is low
+    if (!refillRequested.exchange(true))
+    {
+        sem_post(&wake);
+    }
+}
+
+treasureLocation TreasureProvider::next()
+{
+    treasureLocation location;
+
+    if (pool == NULL)
+    {
+        return randomLocation(threadEngine());
+    }
+
+    if (pool->tryPop(location))
+    {
+        if (pool->size() < pool->capacity() / 2)
+        {
+            requestRefill();
+        }
+        return location;
+    }
+
+    requestRefill();
+
+    // a seeded run must not skip ahead of the pool
+    if (seeded)
+    {
+        while (!pool->tryPop(location))
+        {
+            sched_yield();
+        }
+        return location;
+    }
+
+    return randomLocation(threadEngine());
+}
+
+// refill thread function
+void *TreasureProvider::refillMain(void *args)
+{
+    TreasureProvider *provider = (TreasureProvider *)args;
+
+    // generated but not yet pushed, kept so a seeded sequence has no gaps
+    treasureLocation pending = randomLocation(provider->fillEngine);
+
+    while (true)
+    {
+        provider->refillRequested.store(false);
+
+        while (provider->pool->tryPush(pending))
+        {
+            pending = randomLocation(provider->fillEngine);
+        }
+
+        while (sem_wait(&provider->wake) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    return NULL;
+}
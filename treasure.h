@@ -0,0 +1,55 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Treasure location provider
+*/
+
+#ifndef TREASURE_H
+#define TREASURE_H
+
+#include "game.h"
+#include "mpmc_queue.h"
+
+#include <semaphore.h>
+#include <atomic>
+#include <cstdint>
+#include <random>
+
+/* Hands out treasure locations without touching the kernel.
+   A background thread keeps a lock-free pool of pre-generated locations
+   topped up, so starting a session costs a queue pop. When the pool runs
+   dry, locations come from a per-thread engine seeded once.
+   In seeded mode every location comes from the pool, so sessions get the
+   same treasure sequence, in connection order, on every run. */
+class TreasureProvider
+{
+public:
+    TreasureProvider();
+
+    // create the pool and its refill thread, false on failure
+    bool start(size_t poolSize, bool seeded, uint64_t seed);
+
+    // location for a new session
+    treasureLocation next();
+
+    bool isSeeded() const { return seeded; }
+    uint64_t getSeed() const { return seed; }
+
+private:
+    static void *refillMain(void *args);
+    void requestRefill();
+
+    MpmcQueue<treasureLocation> *pool; // null until start()
+    sem_t wake;
+    std::atomic<bool> refillRequested;
+    bool seeded;
+    uint64_t seed;
+    std::mt19937_64 fillEngine; // only used by the refill thread
+};
+
+extern TreasureProvider treasures;
+
+// engine of the calling thread, seeded from random_device on first use
+std::mt19937_64 &threadEngine();
+
+#endif
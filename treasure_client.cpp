@@ -0,0 +1,642 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Non-blocking client library
+*/
+
+#include "treasure_client.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+// events handled per epoll_wait()
+const int LOOP_EVENTS = 64;
+
+ClientLoop::ClientLoop() : epfd(-1), active(0) {}
+
+ClientLoop::~ClientLoop()
+{
+    if (epfd >= 0)
+    {
+        close(epfd);
+    }
+}
+
+bool ClientLoop::open()
+{
+    if (epfd < 0)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    return epfd >= 0;
+}
+
+bool ClientLoop::runOnce(int timeoutMs)
+{
+    if (active == 0)
+    {
+        return false;
+    }
+
+    struct epoll_event events[LOOP_EVENTS];
+    int count = epoll_wait(epfd, events, LOOP_EVENTS, timeoutMs);
+
+    // each client shows up at most once per wait
+    for (int i = 0; i < count; i++)
+    {
+        TreasureClient *client = (TreasureClient *)events[i].data.ptr;
+        client->ready(events[i].events);
+    }
+
+    return active > 0;
+}
+
+void ClientLoop::run()
+{
+    while (runOnce(-1))
+    {
+    }
+}
+
+TreasureClient::TreasureClient(ClientLoop &loop, TreasureHandler &handler)
+    : loop(loop), handler(handler), protocol(2), sock(-1), local(false),
+      state(CONNECTING), outPos(0), ring(NULL), failure(0), done(false),
+      turn(0), lastDistance(-1), boardLeft(0)
+{
+}
+
+TreasureClient::~TreasureClient()
+{
+    close();
+}
+
+bool TreasureClient::connect(const struct sockaddr_in &servAddr,
+                             int version)
+{
+    return start(AF_INET, (const struct sockaddr *)&servAddr,
+                 sizeof(servAddr), version);
+}
+
+bool TreasureClient::connectLocal(const string &path, int version)
+{
+    struct sockaddr_un servAddr;
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(servAddr.sun_path))
+    {
+        failure = ENAMETOOLONG;
+        return false;
+    }
+    strncpy(servAddr.sun_path, path.c_str(), sizeof(servAddr.sun_path) - 1);
+
+    return start(AF_UNIX, (const struct sockaddr *)&servAddr,
+                 sizeof(servAddr), version);
+}
+
+bool TreasureClient::start(int family, const struct sockaddr *addr,
+                           socklen_t length, int version)
+{
+    close();
+
+    sock = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        failure = errno;
+        return false;
+    }
+
+    if (family == AF_INET)
+    {
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = this;
+
+    if ((::connect(sock, addr, length) < 0 && errno != EINPROGRESS) ||
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, sock, &event) < 0)
+    {
+        failure = errno;
+        ::close(sock);
+        sock = -1;
+        return false;
+    }
+
+    protocol = version;
+    local = family == AF_UNIX;
+    state = CONNECTING;
+    failure = 0;
+    done = false;
+    turn = 0;
+    lastDistance = -1;
+    loop.active++;
+    return true;
+}
+
+bool TreasureClient::useRing()
+{
+    if (!local || state != NAMING || ring != NULL)
+    {
+        return false;
+    }
+
+    ShmChannel *channel = new ShmChannel;
+    if (!channel->create(sock) || !offerRing(sock, channel->memfd()))
+    {
+        failure = errno;
+        delete channel;
+        return false;
+    }
+
+    // the socket only tells the rings that the server is gone now
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, sock, NULL);
+    ring = channel;
+    return true;
+}
+
+void TreasureClient::sendName(const string &name)
+{
+    if (state != NAMING)
+    {
+        return;
+    }
+
+    if (protocol == 2)
+    {
+        // ask for v2 and send the name frame in the same packet
+        putV1Int(out, PROTOCOL_V2_MAGIC);
+        encodeName(out, name);
+        state = PLAYING;
+    }
+    else
+    {
+        // cut short like encodeName() does, the server would refuse it
+        size_t length = min(name.length(), MAX_NAME);
+        putV1Int(out, length);
+        out.append(name, 0, length);
+        state = V1_TURN;
+    }
+    flush();
+}
+
+void TreasureClient::guess(long x, long y)
+{
+    if (protocol == 2)
+    {
+        GuessFrame frame;
+        frame.x = x;
+        frame.y = y;
+        encodeFrame(out, frame);
+    }
+    else if (state == V1_GUESS)
+    {
+        // both ints in one packet
+        putV1Int(out, x);
+        putV1Int(out, y);
+        state = V1_DISTANCE;
+    }
+    flush();
+}
+
+void TreasureClient::guessBatch(const vector<GuessFrame> &guesses)
+{
+    if (protocol == 2)
+    {
+        encodeGuessBatch(out, guesses);
+        flush();
+    }
+}
+
+void TreasureClient::close()
+{
+    if (sock < 0)
+    {
+        return;
+    }
+
+    if (ring != NULL)
+    {
+        delete ring;
+        ring = NULL;
+    }
+    else
+    {
+        epoll_ctl(loop.epfd, EPOLL_CTL_DEL, sock, NULL);
+    }
+    ::close(sock);
+    sock = -1;
+    loop.active--;
+
+    out.clear();
+    outPos = 0;
+    in.consume(in.size());
+    in.releaseIfEmpty();
+}
+
+// the loop saw events on the socket
+void TreasureClient::ready(uint32_t events)
+{
+    // closed by another client's handler since the wait
+    if (sock < 0)
+    {
+        return;
+    }
+
+    if (state == CONNECTING)
+    {
+        if (!connected() || (events & (EPOLLERR | EPOLLHUP)))
+        {
+            finish(false);
+            return;
+        }
+        state = WELCOME;
+    }
+
+    bool open = true;
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        open = readInput();
+    }
+
+    // the handler switched to the rings from onWelcome()
+    if (open && ring != NULL)
+    {
+        runRing();
+        return;
+    }
+
+    if (open)
+    {
+        open = flush();
+    }
+
+    // a handler that called close() hears nothing more
+    if (!open && sock >= 0)
+    {
+        finish(done);
+    }
+}
+
+// a non-blocking connect() finished, false if it failed
+bool TreasureClient::connected()
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+    {
+        error = errno;
+    }
+    failure = error;
+    return error == 0;
+}
+
+// send what is buffered, false if the connection failed
+bool TreasureClient::flush()
+{
+    if (sock < 0 || state == CONNECTING)
+    {
+        return true;
+    }
+
+    if (ring != NULL)
+    {
+        bool sent = out.empty() || ring->write(out.data(), out.size());
+        if (!sent)
+        {
+            failure = errno;
+        }
+        out.clear();
+        return sent;
+    }
+
+    while (outPos < out.size())
+    {
+        ssize_t bytesSent = send(sock, out.data() + outPos,
+                                 out.size() - outPos, MSG_NOSIGNAL);
+        if (bytesSent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            failure = errno;
+            return false;
+        }
+        outPos += bytesSent;
+    }
+
+    out.clear();
+    outPos = 0;
+    return true;
+}
+
+// read until the socket runs dry, false once the game is over
+bool TreasureClient::readInput()
+{
+    while (ring == NULL)
+    {
+        ssize_t bytesRecv = in.fill(sock);
+        if (bytesRecv < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            failure = errno;
+            return false;
+        }
+        if (bytesRecv == 0)
+        {
+            return false;
+        }
+
+        if (!handleInput())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the rest of the game over the rings, blocking this thread
+void TreasureClient::runRing()
+{
+    bool open = flush();
+    while (open)
+    {
+        ssize_t bytesRecv = in.fill(*ring);
+        if (bytesRecv <= 0)
+        {
+            failure = bytesRecv < 0 ? errno : 0;
+            break;
+        }
+        open = handleInput() && flush();
+    }
+    if (sock >= 0)
+    {
+        finish(done);
+    }
+}
+
+// a whole v1 item at the front of the input, a message is taken off
+// into message; false if it has not fully arrived, broken is set when
+// it never could
+bool TreasureClient::takeV1(string &message, bool &broken)
+{
+    broken = false;
+    if (in.size() < (state == V1_DISTANCE ? sizeof(double) : V1_INT_SIZE))
+    {
+        return false;
+    }
+    if (state == V1_DISTANCE || state == V1_BOARD)
+    {
+        return true;
+    }
+
+    // a message, or a leaderboard entry of name length, name and tries
+    long length = getV1Int(in.data());
+    size_t whole = V1_INT_SIZE + length;
+    if (state == V1_ENTRY)
+    {
+        whole += V1_INT_SIZE;
+    }
+    if (length < 0 || !in.reserve(whole))
+    {
+        broken = true;
+        return false;
+    }
+    if (in.size() < whole)
+    {
+        return false;
+    }
+
+    if (state != V1_ENTRY)
+    {
+        message.assign(in.data() + V1_INT_SIZE, length);
+        in.consume(whole);
+    }
+    return true;
+}
+
+// parse everything buffered, false once the game is over
+bool TreasureClient::handleInput()
+{
+    while (sock >= 0)
+    {
+        if (state == NAMING || state == V1_GUESS)
+        {
+            // the server waits for us
+            break;
+        }
+
+        if (state == PLAYING)
+        {
+            FrameHeader header;
+            string_view payload;
+            bool tooLarge;
+            if (!in.peekFrame(header, payload, tooLarge))
+            {
+                if (tooLarge)
+                {
+                    return false;
+                }
+                break;
+            }
+            in.consume(FRAME_HEADER_SIZE + header.length);
+            if (!handleFrame(header, payload.data()))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        // the welcome message and everything of protocol v1
+        string message;
+        bool broken;
+        if (!takeV1(message, broken))
+        {
+            if (broken)
+            {
+                return false;
+            }
+            break;
+        }
+        if (!handleV1(message))
+        {
+            return false;
+        }
+    }
+
+    in.releaseIfEmpty();
+    return sock >= 0;
+}
+
+bool TreasureClient::handleFrame(const FrameHeader &header,
+                                 const char *payload)
+{
+    if (header.type == FRAME_TURN)
+    {
+        TurnFrame next;
+        if (!decodeFrame(payload, header.length, next))
+        {
+            return false;
+        }
+        handler.onTurn(*this, next);
+        return true;
+    }
+
+    if (header.type == FRAME_DISTANCES)
+    {
+        DistancesFrame reply;
+        if (!decodeDistances(payload, header.length, reply) ||
+            reply.distances.empty())
+        {
+            return false;
+        }
+        handler.onDistances(*this, reply);
+        return true;
+    }
+
+    if (header.type == FRAME_RESULT)
+    {
+        ResultFrame found;
+        if (!decodeResult(payload, header.length, found))
+        {
+            return false;
+        }
+
+        // a room player stays until the whole room is done
+        bool standingsFollow = header.flags & RESULT_STANDINGS_FOLLOW;
+        done = !standingsFollow;
+        handler.onResult(*this, found, standingsFollow);
+        return standingsFollow;
+    }
+
+    if (header.type == FRAME_FOUND)
+    {
+        FoundFrame found;
+        if (!decodeFound(payload, header.length, found))
+        {
+            return false;
+        }
+        handler.onFound(*this, found);
+        return true;
+    }
+
+    if (header.type == FRAME_STANDINGS)
+    {
+        StandingsFrame standings;
+        if (!decodeStandings(payload, header.length, standings))
+        {
+            return false;
+        }
+        done = true;
+        handler.onStandings(*this, standings);
+        return false;
+    }
+
+    return false;
+}
+
+// one whole v1 item from takeV1(), false once the game is over
+bool TreasureClient::handleV1(const string &message)
+{
+    switch (state)
+    {
+    case WELCOME:
+        state = NAMING;
+        handler.onWelcome(*this, message);
+        return true;
+
+    case V1_TURN:
+        state = V1_PROMPT;
+        return true;
+
+    case V1_PROMPT:
+    {
+        // the text says the turn, the frame carries it as a number
+        TurnFrame next;
+        next.turn = ++turn;
+        next.distance = lastDistance;
+        state = V1_GUESS;
+        handler.onTurn(*this, next);
+        return true;
+    }
+
+    case V1_DISTANCE:
+        memcpy(&lastDistance, in.data(), sizeof(double));
+        in.consume(sizeof(double));
+        state = lastDistance == 0 ? V1_VICTORY : V1_TURN;
+        return true;
+
+    case V1_VICTORY:
+        result.tries = turn;
+        result.message = message;
+        result.board.clear();
+        state = V1_BOARD;
+        return true;
+
+    case V1_BOARD:
+        boardLeft = getV1Int(in.data());
+        in.consume(V1_INT_SIZE);
+        if (boardLeft < 0)
+        {
+            return false;
+        }
+        state = V1_ENTRY;
+        break;
+
+    case V1_ENTRY:
+    {
+        long length = getV1Int(in.data());
+        BoardEntry entry;
+        entry.name.assign(in.data() + V1_INT_SIZE, length);
+        entry.tries = getV1Int(in.data() + V1_INT_SIZE + length);
+        in.consume(2 * V1_INT_SIZE + length);
+        result.board.push_back(entry);
+        boardLeft--;
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    // the leaderboard ends the game
+    if (boardLeft > 0)
+    {
+        return true;
+    }
+    done = true;
+    handler.onResult(*this, result, false);
+    return false;
+}
+
+void TreasureClient::finish(bool finished)
+{
+    // the handler may delete this client, nothing touches it afterwards
+    TreasureHandler &events = handler;
+    close();
+    events.onClosed(*this, finished);
+}
@@ -0,0 +1,191 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Non-blocking client library
+*/
+
+#ifndef TREASURE_CLIENT_H
+#define TREASURE_CLIENT_H
+
+#include "protocol.h"
+#include "frame_reader.h"
+#include "shm_ring.h"
+
+#include <netinet/in.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TreasureClient;
+
+/* What happens in one TreasureClient's game, called on the thread
+   running its ClientLoop. A handler answers from inside the callbacks:
+   sendName() from onWelcome(), guess() or guessBatch() from onTurn()
+   and onDistances(). Every callback is optional. A client is deleted
+   only from its own onClosed() or while its loop is not running.
+
+   The same events come whichever protocol version the client speaks;
+   with v1 the client counts the turns itself and builds the result from
+   the victory message and leaderboard. */
+class TreasureHandler
+{
+public:
+    virtual ~TreasureHandler() {}
+
+    // the server's welcome message
+    virtual void onWelcome(TreasureClient &, const std::string &) {}
+
+    // the next turn, turn.distance is that of the last guess and
+    // negative before the first one
+    virtual void onTurn(TreasureClient &, const TurnFrame &) {}
+
+    // the distance of every guess of a batch the server looked at; the
+    // next batch goes out from here unless the last distance is 0
+    virtual void onDistances(TreasureClient &, const DistancesFrame &) {}
+
+    // another player of the room found the treasure
+    virtual void onFound(TreasureClient &, const FoundFrame &) {}
+
+    // the treasure was found; with standingsFollow the room's standings
+    // come once every player of it is done
+    virtual void onResult(TreasureClient &, const ResultFrame &,
+                          bool /* standingsFollow */)
+    {
+    }
+
+    // the room's finishing order
+    virtual void onStandings(TreasureClient &, const StandingsFrame &) {}
+
+    // the connection is gone, finished if the game ended normally; the
+    // client is left alone afterwards, so it may be deleted from here
+    virtual void onClosed(TreasureClient &, bool /* finished */) {}
+};
+
+/* One epoll instance driving any number of TreasureClients from the
+   thread that calls run(). Every call on a client has to come from that
+   thread, most often from its handler; several loops on several threads
+   share nothing. */
+class ClientLoop
+{
+public:
+    ClientLoop();
+    ~ClientLoop();
+
+    ClientLoop(const ClientLoop &) = delete;
+    ClientLoop &operator=(const ClientLoop &) = delete;
+
+    // false if the epoll instance could not be created
+    bool open();
+
+    // wait up to timeoutMs (-1 for no limit) and handle what is ready,
+    // false once no client is left
+    bool runOnce(int timeoutMs);
+
+    // until every client is closed
+    void run();
+
+    // clients connecting or playing
+    size_t clients() const { return active; }
+
+private:
+    friend class TreasureClient;
+
+    int epfd;
+    size_t active;
+};
+
+/* One game against a server, over TCP or its Unix domain socket, with
+   nothing blocking: connect() returns at once, the sends are buffered
+   and everything else arrives through the TreasureHandler.
+
+   A local client may also switch to shared memory rings from
+   onWelcome(). The rings cannot be waited on with epoll, so the rest of
+   that game then runs blocking on the loop thread; such a client wants
+   a loop of its own. */
+class TreasureClient
+{
+public:
+    TreasureClient(ClientLoop &loop, TreasureHandler &handler);
+    ~TreasureClient();
+
+    TreasureClient(const TreasureClient &) = delete;
+    TreasureClient &operator=(const TreasureClient &) = delete;
+
+    // start connecting with protocol version 1 or 2, false if it failed
+    // at once
+    bool connect(const struct sockaddr_in &servAddr, int version = 2);
+    bool connectLocal(const std::string &path, int version = 2);
+
+    // from onWelcome() on a Unix domain connection: play the rest over
+    // shared memory rings, false on failure
+    bool useRing();
+
+    // only the first MAX_NAME bytes of a longer name are sent
+    void sendName(const std::string &name);
+    void guess(long x, long y);
+
+    // several guesses in one GUESS_BATCH frame, v2 only
+    void guessBatch(const std::vector<GuessFrame> &guesses);
+
+    // drop the connection, onClosed() is not called
+    void close();
+
+    int version() const { return protocol; }
+    bool isOpen() const { return sock >= 0; }
+
+    // errno of the last failure, 0 if the server closed or broke the
+    // protocol
+    int error() const { return failure; }
+
+private:
+    enum State
+    {
+        CONNECTING, // waiting for connect() to finish
+        WELCOME,    // waiting for the v1 welcome message
+        NAMING,     // welcome delivered, waiting for sendName()
+        PLAYING,    // v2 frames
+        V1_TURN,    // waiting for the v1 turn message
+        V1_PROMPT,  // waiting for the v1 guess prompt
+        V1_GUESS,   // waiting for guess()
+        V1_DISTANCE,
+        V1_VICTORY,
+        V1_BOARD,   // waiting for the leaderboard size
+        V1_ENTRY    // waiting for the next leaderboard entry
+    };
+
+    friend class ClientLoop;
+
+    bool start(int family, const struct sockaddr *addr, socklen_t length,
+               int version);
+    void ready(uint32_t events);
+    bool connected();
+    bool flush();
+    bool readInput();
+    bool handleInput();
+    bool handleFrame(const FrameHeader &header, const char *payload);
+    bool takeV1(std::string &message, bool &broken);
+    bool handleV1(const std::string &message);
+    void runRing();
+    void finish(bool finished);
+
+    ClientLoop &loop;
+    TreasureHandler &handler;
+    int protocol;
+    int sock;
+    bool local; // Unix domain socket
+    State state;
+    FrameReader in;
+    std::string out;
+    size_t outPos;
+    ShmChannel *ring; // NULL unless useRing() succeeded
+    int failure;
+    bool done; // the game ended normally
+
+    uint32_t turn;       // v1: turn being played
+    double lastDistance; // v1: distance of the last guess, -1 before one
+    ResultFrame result;  // v1: built as it arrives
+    long boardLeft;      // v1: leaderboard entries still to come
+};
+
+#endif
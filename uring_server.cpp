@@ -0,0 +1,807 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/io_uring server mode
+*/
+
+#include "uring_server.h"
+#include "session.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "admission.h"
+
+#include <linux/io_uring.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// submission queue entries of each loop
+const unsigned RING_ENTRIES = 4096;
+
+// kernel-picked receive buffers of each loop
+const unsigned RECV_BUFFERS = 512;
+const unsigned RECV_BUFFER_SIZE = 2048;
+const unsigned short RECV_GROUP = 0;
+
+// pieces of output gathered into one send
+const size_t SEND_IOVS = 16;
+
+// user_data of requests that belong to no connection, connection
+// requests carry the connection pointer plus the operation
+const uint64_t ACCEPT_TAG = 1;
+const uint64_t TIMEOUT_TAG = 2;
+const uint64_t PROVIDE_TAG = 3;
+const uint64_t OP_SEND = 1;
+const uint64_t OP_RECV = 2;
+const uint64_t OP_MASK = 7;
+
+// one accepted client owned by a loop
+struct UringConnection
+{
+    int sock;
+    Session session;
+    TimerNode timer; // fires when the session deadline passes
+    int inflight;    // requests the kernel has not completed yet
+    bool closing;    // freed once inflight drops to 0
+    bool sending;    // a send points into the session's output
+    std::string held; // input received while that send is in flight
+    struct msghdr msg; // of the send in flight
+    struct iovec iov[SEND_IOVS];
+};
+
+static int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, unsigned submit, unsigned wait,
+                      unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFd, submit, wait, flags,
+                        NULL, 0);
+}
+
+/* One io_uring instance with its mapped queues and buffer ring.
+   Only the thread that created it may use it. */
+class UringLoop
+{
+public:
+    UringLoop();
+    ~UringLoop();
+
+    // create the ring and queue the receive buffers, false if the
+    // kernel does not support everything this mode needs
+    bool init();
+
+    void run(int listenSock);
+
+private:
+    struct io_uring_sqe *nextSqe();
+    void submit(unsigned wait);
+    bool reap();
+    void complete(struct io_uring_cqe *cqe);
+
+    void armAccept();
+    void armTimeout();
+    void queueRecv(UringConnection *conn);
+    void queueSend(UringConnection *conn, bool linked);
+    void queueTurn(UringConnection *conn);
+    void provideBuffers(unsigned short bid, unsigned count);
+
+    void onAccept(struct io_uring_cqe *cqe);
+    void onSend(UringConnection *conn, int res);
+    void onRecv(UringConnection *conn, struct io_uring_cqe *cqe);
+    void handleInput(UringConnection *conn, const char *data, size_t length);
+    void handleResult(UringConnection *conn, bool ok);
+    void flushWoken();
+    void armTimer(UringConnection *conn);
+    void expireConnections();
+    void closeConnection(UringConnection *conn);
+
+    int ringFd;
+    int listenSock;
+
+    // submission queue
+    void *sqRing;
+    size_t sqRingSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+
+    // completion queue, may share the submission queue mapping
+    void *cqRing;
+    size_t cqRingSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    // completions taken off the ring and not handled yet, so the ring
+    // can be emptied while a handler is still queueing requests
+    vector<struct io_uring_cqe> reaped;
+
+    // provided buffers the kernel picks from for every receive
+    char *buffers;
+    bool multishotAccept; // cleared if the kernel predates it
+
+    TimerWheel wheel;
+    vector<TimerNode *> expired;
+    vector<Session *> woken;
+    bool timeoutArmed;
+    struct __kernel_timespec timeout;
+};
+
+UringLoop::UringLoop()
+    : ringFd(-1), listenSock(-1), sqRing(MAP_FAILED), sqRingSize(0),
+      cqRing(MAP_FAILED), cqRingSize(0),
+      buffers(NULL), multishotAccept(true), wheel(tickOf(monotonicMs())),
+      timeoutArmed(false)
+{
+    sqes = (struct io_uring_sqe *)MAP_FAILED;
+}
+
+UringLoop::~UringLoop()
+{
+    delete[] buffers;
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqEntries * sizeof(struct io_uring_sqe));
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+    {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED)
+    {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd >= 0)
+    {
+        close(ringFd);
+    }
+}
+
+bool UringLoop::init()
+{
+    struct io_uring_params params;
+
+    // only this thread submits, let completions run when it waits;
+    // older kernels get the plain setup
+    static const unsigned setupFlags[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_COOP_TASKRUN, 0};
+    for (size_t i = 0; i < 3 && ringFd < 0; i++)
+    {
+        memset(&params, 0, sizeof(params));
+        params.flags = setupFlags[i];
+        ringFd = uringSetup(RING_ENTRIES, &params);
+    }
+    if (ringFd < 0)
+    {
+        return false;
+    }
+
+    // receives must wait on the socket instead of blocking a kernel
+    // worker, and recycled buffers must not post completions
+    if (!(params.features & IORING_FEAT_FAST_POLL) ||
+        !(params.features & IORING_FEAT_CQE_SKIP))
+    {
+        return false;
+    }
+
+    sqEntries = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes +
+                 params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cqRing = sqRing;
+    }
+    else
+    {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    sqes = (struct io_uring_sqe *)mmap(
+        NULL, sqEntries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    char *sq = (char *)sqRing;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)cqRing;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // handed to the kernel with the first submission
+    buffers = new char[RECV_BUFFERS * RECV_BUFFER_SIZE];
+    provideBuffers(0, RECV_BUFFERS);
+
+    return true;
+}
+
+// give count buffers starting at bid to the kernel, the request goes
+// out with the next submission
+void UringLoop::provideBuffers(unsigned short bid, unsigned count)
+{
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(buffers + bid * RECV_BUFFER_SIZE);
+    sqe->len = RECV_BUFFER_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = RECV_GROUP;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = PROVIDE_TAG;
+}
+
+// free submission queue entry, submitting first if the queue is full
+struct io_uring_sqe *UringLoop::nextSqe()
+{
+    unsigned tail = *sqTail;
+
+    // every entry up to the tail belongs to the kernel until it moves
+    // the head; submitting fails with EBUSY while the completion queue
+    // overflows, so empty it, or wait for completions, and try again
+    while (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries)
+    {
+        submit(0);
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries &&
+            !reap())
+        {
+            submit(1);
+        }
+    }
+
+    struct io_uring_sqe *sqe = &sqes[tail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[tail & sqMask] = tail & sqMask;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+// submit everything queued and wait for at least wait completions
+void UringLoop::submit(unsigned wait)
+{
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    unsigned queued = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    while (uringEnter(ringFd, queued, wait, flags) < 0)
+    {
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        // EAGAIN and EBUSY go away once completions are reaped
+        if (errno != EAGAIN && errno != EBUSY)
+        {
+            cerr << "Error with io_uring_enter" << endl;
+        }
+        break;
+    }
+}
+
+// move every completion off the ring into reaped, false if there was
+// none
+bool UringLoop::reap()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+        return false;
+    }
+    for (; head != tail; head++)
+    {
+        reaped.push_back(cqes[head & cqMask]);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+void UringLoop::armAccept()
+{
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSock;
+    sqe->ioprio = multishotAccept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_TAG;
+}
+
+// wake up for the next timer slot that may fire
+void UringLoop::armTimeout()
+{
+    uint64_t ms = wheel.ticksToNext() * TIMER_TICK_MS;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_nsec = (ms % 1000) * 1000000;
+
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&timeout;
+    sqe->len = 1;
+    sqe->user_data = TIMEOUT_TAG;
+    timeoutArmed = true;
+}
+
+void UringLoop::queueRecv(UringConnection *conn)
+{
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_RECV;
+    conn->inflight++;
+}
+
+// send the session's next pending bytes, linked to the request queued
+// right after it
+void UringLoop::queueSend(UringConnection *conn, bool linked)
+{
+    Session &session = conn->session;
+
+    // the output buffer stays untouched until the send completes, input
+    // arriving meanwhile is held back
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = session.pendingIov(conn->iov, SEND_IOVS);
+
+    // own replies and room frames go out in one request, a plain send
+    // is cheaper for a single piece
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->fd = conn->sock;
+    if (conn->msg.msg_iovlen == 1)
+    {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)conn->iov[0].iov_base;
+        sqe->len = conn->iov[0].iov_len;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&conn->msg;
+        sqe->len = 1;
+    }
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = linked ? IOSQE_IO_LINK : 0;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+    conn->inflight++;
+    conn->sending = true;
+}
+
+// send what the session queued and read the next request right after
+// it, both in the same submission
+void UringLoop::queueTurn(UringConnection *conn)
+{
+    Session &session = conn->session;
+
+    if (!conn->sending && session.pendingLength() > 0)
+    {
+        // the leaderboard is the last thing the session sends
+        bool more = session.getState() != CLOSED;
+        queueSend(conn, more);
+        if (!more)
+        {
+            return;
+        }
+    }
+
+    queueRecv(conn);
+}
+
+void UringLoop::onAccept(struct io_uring_cqe *cqe)
+{
+    // kernels before 5.19 accept one client per request
+    if (cqe->res == -EINVAL && multishotAccept)
+    {
+        multishotAccept = false;
+        armAccept();
+        return;
+    }
+
+    // the accept stopped, start it again
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        armAccept();
+    }
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res == -EMFILE || cqe->res == -ENFILE)
+        {
+            admission.shedClient(listenSock);
+        }
+        else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+        {
+            printError("accept", string("client connection: ") +
+                                     strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int clientSock = cqe->res;
+    metrics.count(CONNECTIONS_ACCEPTED);
+    if (!admission.admit(clientSock))
+    {
+        return;
+    }
+
+    UringConnection *conn = new UringConnection;
+    conn->sock = clientSock;
+    conn->timer.owner = conn;
+    conn->inflight = 0;
+    conn->closing = false;
+    conn->sending = false;
+    conn->session.setOwner(conn);
+    conn->session.start();
+
+    queueTurn(conn);
+    armTimer(conn);
+}
+
+void UringLoop::onSend(UringConnection *conn, int res)
+{
+    Session &session = conn->session;
+
+    if (res < 0)
+    {
+        printError("send", session.sending());
+        closeConnection(conn);
+        return;
+    }
+    session.consumed(res);
+    conn->sending = false;
+
+    // the session ends once the leaderboard is out
+    if (session.done())
+    {
+        closeConnection(conn);
+        return;
+    }
+
+    // the turn held back for the send, sent with any room output
+    if (!conn->held.empty())
+    {
+        string input;
+        input.swap(conn->held);
+        handleInput(conn, input.data(), input.size());
+        return;
+    }
+
+    // room output queued behind what was just sent
+    if (session.pendingLength() > 0)
+    {
+        queueSend(conn, false);
+    }
+}
+
+void UringLoop::onRecv(UringConnection *conn, struct io_uring_cqe *cqe)
+{
+    Session &session = conn->session;
+    int res = cqe->res;
+
+    // a short send broke the link, send the rest before reading again
+    if (res == -ECANCELED)
+    {
+        queueTurn(conn);
+        return;
+    }
+
+    // every buffer was in use, try again once some come back
+    if (res == -ENOBUFS)
+    {
+        queueRecv(conn);
+        return;
+    }
+
+    if (res <= 0)
+    {
+        // a client leaving after the game is not an error
+        if (res < 0 || session.getState() != CLOSED)
+        {
+            printError("receive", session.receiving());
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    const char *data = buffers + bid * RECV_BUFFER_SIZE;
+
+    // parsing may grow the output a send still points into; copy the
+    // input aside rather than keep the kernel's buffer
+    if (conn->sending)
+    {
+        conn->held.append(data, res);
+        provideBuffers(bid, 1);
+        return;
+    }
+
+    bool ok = session.onInput(data, res);
+    provideBuffers(bid, 1);
+    handleResult(conn, ok);
+}
+
+// feed received bytes to the session and start its next turn
+void UringLoop::handleInput(UringConnection *conn, const char *data,
+                            size_t length)
+{
+    handleResult(conn, conn->session.onInput(data, length));
+}
+
+// start the session's next turn once its input is parsed, ok is false
+// on a malformed request
+void UringLoop::handleResult(UringConnection *conn, bool ok)
+{
+    Session &session = conn->session;
+
+    if (!ok)
+    {
+        printError("receive", session.receiving());
+        closeConnection(conn);
+        return;
+    }
+
+    queueTurn(conn);
+    armTimer(conn);
+}
+
+// move the connection's timer to the session's current deadline
+void UringLoop::armTimer(UringConnection *conn)
+{
+    uint64_t deadline = conn->session.deadline();
+    if (deadline == 0)
+    {
+        wheel.cancel(&conn->timer);
+    }
+    else
+    {
+        wheel.arm(&conn->timer, tickOf(deadline));
+    }
+}
+
+// close every connection whose deadline has passed
+void UringLoop::expireConnections()
+{
+    expired.clear();
+    wheel.advance(tickOf(monotonicMs()), expired);
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        UringConnection *conn = (UringConnection *)expired[i]->owner;
+        Session &session = conn->session;
+
+        // same report as a client that hung up at this point
+        if (session.pendingLength() > 0)
+        {
+            printError("send", session.sending());
+        }
+        else
+        {
+            printError("receive", session.receiving());
+        }
+        metrics.count(SESSIONS_EXPIRED);
+        closeConnection(conn);
+    }
+}
+
+// send what rooms queued on sessions of this loop
+void UringLoop::flushWoken()
+{
+    while (Session::takeWoken(woken))
+    {
+        for (size_t i = 0; i < woken.size(); i++)
+        {
+            UringConnection *conn = (UringConnection *)woken[i]->getOwner();
+            if (conn->closing)
+            {
+                continue;
+            }
+            if (!conn->sending && conn->session.pendingLength() > 0)
+            {
+                queueSend(conn, false);
+            }
+            armTimer(conn);
+        }
+    }
+}
+
+// close the connection once the kernel is done with it
+void UringLoop::closeConnection(UringConnection *conn)
+{
+    wheel.cancel(&conn->timer);
+
+    if (conn->inflight > 0)
+    {
+        // the shutdown completes whatever is still waiting
+        if (!conn->closing)
+        {
+            conn->closing = true;
+            shutdown(conn->sock, SHUT_RDWR);
+        }
+        return;
+    }
+
+    close(conn->sock);
+    delete conn;
+    admission.release();
+}
+
+void UringLoop::run(int listenSock)
+{
+    this->listenSock = listenSock;
+    armAccept();
+
+    while (true)
+    {
+        if (!timeoutArmed && !wheel.empty())
+        {
+            armTimeout();
+        }
+
+        submit(1);
+        reap();
+
+        // handlers may reap more while they queue requests, those are
+        // handled in this same pass
+        for (size_t i = 0; i < reaped.size(); i++)
+        {
+            struct io_uring_cqe cqe = reaped[i];
+            complete(&cqe);
+        }
+        reaped.clear();
+
+        expireConnections();
+        flushWoken();
+    }
+}
+
+void UringLoop::complete(struct io_uring_cqe *cqe)
+{
+    if (cqe->user_data == ACCEPT_TAG)
+    {
+        onAccept(cqe);
+        return;
+    }
+    if (cqe->user_data == TIMEOUT_TAG)
+    {
+        timeoutArmed = false;
+        return;
+    }
+    if (cqe->user_data == PROVIDE_TAG)
+    {
+        cerr << "Error providing receive buffers" << endl;
+        return;
+    }
+
+    UringConnection *conn =
+        (UringConnection *)(uintptr_t)(cqe->user_data & ~OP_MASK);
+    conn->inflight--;
+
+    if (conn->closing)
+    {
+        // give back a buffer the kernel picked for a late read
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            provideBuffers(cqe->flags >> IORING_CQE_BUFFER_SHIFT, 1);
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    if ((cqe->user_data & OP_MASK) == OP_SEND)
+    {
+        onSend(conn, cqe->res);
+    }
+    else
+    {
+        onRecv(conn, cqe);
+    }
+}
+
+// arguments for loop thread function
+struct UringArgs
+{
+    int listenSock;
+};
+
+// event loop thread function
+static void *uringMain(void *args)
+{
+    struct UringArgs *uringArgs = (struct UringArgs *)args;
+    int listenSock = uringArgs->listenSock;
+    delete uringArgs;
+
+    UringLoop loop;
+    if (!loop.init())
+    {
+        cerr << "Error creating io_uring instance" << endl;
+        return NULL;
+    }
+    loop.run(listenSock);
+
+    return NULL;
+}
+
+bool runUringServer(int listenSock, int loops)
+{
+    // try the whole setup once before committing to this mode
+    {
+        UringLoop probe;
+        if (!probe.init())
+        {
+            return false;
+        }
+    }
+
+    // shedding a client when descriptors run out must never block
+    int flags = fcntl(listenSock, F_GETFL, 0);
+    if (flags < 0 || fcntl(listenSock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        cerr << "Error making listening socket non-blocking" << endl;
+        return true;
+    }
+
+    vector<pthread_t> threads;
+    for (int i = 0; i < loops; i++)
+    {
+        UringArgs *args = new UringArgs;
+        args->listenSock = listenSock;
+
+        pthread_t threadID;
+        int status = pthread_create(&threadID, NULL, uringMain, (void *)args);
+        if (status != 0)
+        {
+            cerr << "Error creating event loop thread" << endl;
+            delete args;
+            break;
+        }
+        threads.push_back(threadID);
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    return true;
+}
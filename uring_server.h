@@ -0,0 +1,22 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/io_uring server mode
+*/
+
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+/* Serve every session from event loops built on io_uring, talking to
+   the kernel through the raw system calls.
+   Each loop keeps a multishot accept armed on the shared listening
+   socket and receives into a pool of kernel-picked buffers. A turn's
+   reply and the read of the next guess go in as one linked pair, and
+   one io_uring_enter() submits the work of every ready session while
+   collecting their completions.
+   Returns false at once if the kernel lacks any of that, so the caller
+   can fall back to another mode; otherwise only returns if the loops
+   could not be started. */
+bool runUringServer(int listenSock, int loops);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Pre-spawned worker pool server mode
+*/
+
+#include "worker_pool.h"
+
+#include <sched.h>
+#include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iostream>
+
+using namespace std;
+
+SocketQueue::SocketQueue(size_t capacity) : ring(capacity)
+{
+    // only capacity slots are handed out even if the ring is bigger
+    sem_init(&freeSlots, 0, capacity);
+    sem_init(&usedSlots, 0, 0);
+}
+
+SocketQueue::~SocketQueue()
+{
+    sem_destroy(&freeSlots);
+    sem_destroy(&usedSlots);
+}
+
+bool SocketQueue::push(int clientSock, bool wait)
+{
+    if (wait)
+    {
+        while (sem_wait(&freeSlots) < 0 && errno == EINTR)
+        {
+        }
+    }
+    else if (sem_trywait(&freeSlots) < 0)
+    {
+        return false;
+    }
+
+    // the semaphore guarantees a free slot, this only waits for a
+    // worker that is still reading it from the previous lap
+    while (!ring.tryPush(clientSock))
+    {
+        sched_yield();
+    }
+    sem_post(&usedSlots);
+    return true;
+}
+
+int SocketQueue::pop()
+{
+    while (sem_wait(&usedSlots) < 0 && errno == EINTR)
+    {
+    }
+
+    // the semaphore guarantees a used slot, this only waits for the
+    // accept loop to finish writing it
+    int clientSock;
+    while (!ring.tryPop(clientSock))
+    {
+        sched_yield();
+    }
+    sem_post(&freeSlots);
+    return clientSock;
+}
+
+// arguments for worker thread function
+struct WorkerArgs
+{
+    WorkerPool *pool;
+};
+
+WorkerPool::WorkerPool(const WorkerPoolConfig &config, void (*handler)(int))
+    : config(config), handler(handler), queue(config.queueSize)
+{
+}
+
+bool WorkerPool::start()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (config.stackSize > 0)
+    {
+        size_t stackSize = config.stackSize;
+        // a sysconf() call returning long on newer glibc
+        if (stackSize < (size_t)PTHREAD_STACK_MIN)
+        {
+            stackSize = PTHREAD_STACK_MIN;
+        }
+        pthread_attr_setstacksize(&attr, stackSize);
+    }
+
+    for (int i = 0; i < config.workers; i++)
+    {
+        if (config.pin && cpus > 0)
+        {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % cpus, &cpuset);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+        }
+
+        WorkerArgs *args = new WorkerArgs;
+        args->pool = this;
+
+        pthread_t threadID;
+        int status = pthread_create(&threadID, &attr, workerMain, args);
+        if (status != 0)
+        {
+            cerr << "Error creating worker thread " << i << endl;
+            delete args;
+            pthread_attr_destroy(&attr);
+            return false;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return true;
+}
+
+bool WorkerPool::submit(int clientSock)
+{
+    return queue.push(clientSock, config.overflow == BLOCK);
+}
+
+// worker thread function
+void *WorkerPool::workerMain(void *args)
+{
+    WorkerArgs *workerArgs = (WorkerArgs *)args;
+    WorkerPool *pool = workerArgs->pool;
+    delete workerArgs;
+
+    while (true)
+    {
+        int clientSock = pool->queue.pop();
+
+        // Communicate with client
+        pool->handler(clientSock);
+        close(clientSock);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,73 @@
+/*
+    Adamou Tidjani
+    CPSC3500
+    PA4: Treasure Hunt/Pre-spawned worker pool server mode
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "mpmc_queue.h"
+
+#include <semaphore.h>
+#include <cstddef>
+
+// what submit() does when every queue slot is taken
+enum OverflowPolicy
+{
+    SHED,  // refuse the connection right away
+    BLOCK  // wait in accept loop until a worker frees a slot
+};
+
+/* Bounded queue of accepted sockets between the accept loop and the
+   workers. Two semaphores count free and used slots of the lock-free
+   ring so both sides can sleep instead of spinning. */
+class SocketQueue
+{
+public:
+    explicit SocketQueue(size_t capacity);
+    ~SocketQueue();
+
+    // false if the queue is full and wait is false
+    bool push(int clientSock, bool wait);
+
+    // sleep until a socket is available
+    int pop();
+
+private:
+    MpmcQueue<int> ring;
+    sem_t freeSlots;
+    sem_t usedSlots;
+};
+
+struct WorkerPoolConfig
+{
+    int workers;           // threads created up front
+    size_t queueSize;      // accepted sockets waiting for a worker
+    size_t stackSize;      // bytes per worker stack, 0 for the default
+    bool pin;              // pin worker i to cpu i modulo the cpu count
+    OverflowPolicy overflow;
+};
+
+/* Fixed set of threads, created before the first accept, that take
+   accepted sockets from a SocketQueue and run handler on each of them. */
+class WorkerPool
+{
+public:
+    WorkerPool(const WorkerPoolConfig &config, void (*handler)(int));
+
+    // create every worker, false if one of them could not be created
+    bool start();
+
+    // hand an accepted socket to a worker, false if it was shed
+    bool submit(int clientSock);
+
+private:
+    static void *workerMain(void *args);
+
+    WorkerPoolConfig config;
+    void (*handler)(int);
+    SocketQueue queue;
+};
+
+#endif